@@ -0,0 +1,521 @@
+// Bench.cpp : Emulator throughput benchmarks.
+//
+// usage: Emu6502Bench [--cycles <count>] [--json <file>] [--variant 6502|65C02|2A03]
+//                     [--rom <file> [--rom-start <address>] [--rom-cycles <count>]]
+//
+//   --cycles      emulated cycles to run per microbenchmark and kernel (default 20000000)
+//   --variant     6502, 65C02 or 2A03: measure CPU, CPU65C02 or CPU2A03 (default 6502). The
+//                 microbenchmarks cover every opcode documented for the variant
+//   --json        write machine-readable results to this file
+//   --rom         also run a full test ROM image (e.g. the 6502 functional test), loaded
+//                 at $0000 with CPU::loadROM and started at --rom-start (default $0400).
+//                 The run stops when the ROM traps (jumps to itself) or after --rom-cycles.
+//
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <vector>
+#include "../Emu6502Console/CPU.h"
+#include "../Emu6502Console/Disassembler.h"
+
+// cycles handed to CPU::execute per call
+static constexpr s32 SliceCycles = 100000;
+
+// where benchmark programs are assembled
+static constexpr Word CodeStart = 0x0400;
+
+struct BenchResult
+{
+	std::string Category;
+	std::string Name;
+	u64 Instructions;
+	u64 Cycles;
+	double Seconds;
+
+	double mips() const { return Seconds > 0 ? Instructions / Seconds / 1e6 : 0; }
+	double mhz() const { return Seconds > 0 ? Cycles / Seconds / 1e6 : 0; }
+};
+
+// minimal assembler for building benchmark programs
+struct Assembler
+{
+	CPU::Memory& Memory;
+	Word PC;
+
+	Word here() const { return PC; }
+
+	void op(Byte opcode)
+	{
+		Memory.write(PC++, opcode);
+	}
+
+	void op(Byte opcode, Byte operand)
+	{
+		op(opcode);
+		Memory.write(PC++, operand);
+	}
+
+	void op16(Byte opcode, Word operand)
+	{
+		op(opcode);
+		Memory.write(PC++, operand & 0xFF);
+		Memory.write(PC++, operand >> 8);
+	}
+
+	// emit a branch to an address that has already been assembled
+	void branch(Byte opcode, Word target)
+	{
+		op(opcode, (Byte)(target - (PC + 2)));
+	}
+
+	// emit a forward branch, returning where its offset has to be patched
+	Word branchForward(Byte opcode)
+	{
+		op(opcode, 0);
+		return PC - 1;
+	}
+
+	// point a forward branch at the current address
+	void patch(Word offsetAddress)
+	{
+		Memory.write(offsetAddress, (Byte)(PC - (offsetAddress + 1)));
+	}
+};
+
+// run the already loaded program for the requested number of cycles
+template <class Variant>
+static BenchResult Run(BasicCPU<Variant>& cpu, CPU::Memory& memory, const std::string& category, const std::string& name, u64 cycles)
+{
+	const u64 StartCycles = cpu.TotalCycles;
+	const u64 StartInstructions = cpu.TotalInstructions;
+	const auto Start = std::chrono::steady_clock::now();
+	while (cpu.TotalCycles - StartCycles < cycles)
+	{
+		cpu.execute(SliceCycles, memory);
+	}
+	const auto End = std::chrono::steady_clock::now();
+
+	BenchResult Result;
+	Result.Category = category;
+	Result.Name = name;
+	Result.Instructions = cpu.TotalInstructions - StartInstructions;
+	Result.Cycles = cpu.TotalCycles - StartCycles;
+	Result.Seconds = std::chrono::duration<double>(End - Start).count();
+	return Result;
+}
+
+static const char* ModeName(AddressingMode mode)
+{
+	switch (mode)
+	{
+	case AddressingMode::Implied: return "";
+	case AddressingMode::Accumulator: return "A";
+	case AddressingMode::Immediate: return "#";
+	case AddressingMode::ZeroPage: return "ZP";
+	case AddressingMode::ZeroPageX: return "ZP,X";
+	case AddressingMode::ZeroPageY: return "ZP,Y";
+	case AddressingMode::Absolute: return "ABS";
+	case AddressingMode::AbsoluteX: return "ABS,X";
+	case AddressingMode::AbsoluteY: return "ABS,Y";
+	case AddressingMode::Indirect: return "(IND)";
+	case AddressingMode::IndirectX: return "(ZP,X)";
+	case AddressingMode::IndirectY: return "(ZP),Y";
+	case AddressingMode::Relative: return "REL";
+	case AddressingMode::ZeroPageIndirect: return "(ZP)";
+	}
+	return "";
+}
+
+// one benchmark per documented opcode: a block of copies of the instruction followed by a JMP back
+template <class Variant>
+static void RunMicrobenchmarks(BasicCPU<Variant>& cpu, CPU::Memory& memory, u64 cycles, std::vector<BenchResult>& results)
+{
+	const OpcodeTable& Table = Variant::HasCMOSInstructions ? Opcodes65C02 : Opcodes;
+
+	// copies of the instruction per loop iteration, keeps the closing JMP a small fraction
+	static constexpr u32 Copies = 32;
+	static constexpr Word SubroutineAddress = 0x0600;
+	static constexpr Word JumpTable = 0x0700;
+
+	for (u32 Opcode = 0; Opcode < 256; Opcode++)
+	{
+		const OpcodeInfo& Info = Table[(Byte)Opcode];
+		if (Info.Mnemonic[0] == '?' || Opcode == CPU::INS_RTS || Opcode == CPU::INS_RTI)
+		{
+			// RTS and RTI are measured together with JSR and BRK
+			continue;
+		}
+
+		cpu.reset(CodeStart, memory);
+		// zero page pointer used by the indirect modes
+		memory.write(0x10, 0x00);
+		memory.write(0x11, 0x03);
+
+		std::string Name = std::string(Info.Mnemonic) + " " + ModeName(Info.Mode);
+		Assembler Asm{ memory, CodeStart };
+		for (u32 i = 0; i < Copies; i++)
+		{
+			const Word Next = Asm.here() + Info.Length;
+			if (Opcode == CPU::INS_JMP_ABS)
+			{
+				Asm.op16(CPU::INS_JMP_ABS, Next);
+			}
+			else if (Opcode == CPU::INS_JMP_IND)
+			{
+				// each copy gets its own pointer to the following instruction
+				const Word Pointer = JumpTable + i * 2;
+				memory.write(Pointer, Next & 0xFF);
+				memory.write(Pointer + 1, Next >> 8);
+				Asm.op16(CPU::INS_JMP_IND, Pointer);
+			}
+			else if (Opcode == CPU::INS_JSR)
+			{
+				Asm.op16(CPU::INS_JSR, SubroutineAddress);
+				memory.write(SubroutineAddress, CPU::INS_RTS);
+				Name = "JSR+RTS";
+			}
+			else if (Opcode == CPU::INS_BRK)
+			{
+				// BRK skips a padding byte, vector to an RTI
+				Asm.op(CPU::INS_BRK, CPU::INS_NOP);
+				memory.write(0xFFFE, SubroutineAddress & 0xFF);
+				memory.write(0xFFFF, SubroutineAddress >> 8);
+				memory.write(SubroutineAddress, CPU::INS_RTI);
+				Name = "BRK+RTI";
+			}
+			else if (Info.Length == 1)
+			{
+				Asm.op((Byte)Opcode);
+			}
+			else if (Info.Length == 2)
+			{
+				// zero page operands hit the pointer, relative branches fall through to the next copy
+				Byte Operand = 0x10;
+				if (Info.Mode == AddressingMode::Immediate)
+				{
+					Operand = 0x01;
+				}
+				else if (Info.Mode == AddressingMode::Relative)
+				{
+					Operand = 0x00;
+				}
+				Asm.op((Byte)Opcode, Operand);
+			}
+			else
+			{
+				Asm.op16((Byte)Opcode, 0x0200);
+			}
+		}
+		Asm.op16(CPU::INS_JMP_ABS, CodeStart);
+
+		char Label[8];
+		snprintf(Label, sizeof(Label), "$%02X ", Opcode);
+		results.push_back(Run(cpu, memory, "opcode", Label + Name, cycles));
+	}
+}
+
+// copy a page with LDA abs,X / STA abs,X
+static void AssembleMemcpy(Assembler& Asm)
+{
+	const Word Start = Asm.here();
+	Asm.op(CPU::INS_LDX_IM, 0x00);
+	const Word Loop = Asm.here();
+	Asm.op16(CPU::INS_LDA_ABSX, 0x0200);
+	Asm.op16(CPU::INS_STA_ABSX, 0x0300);
+	Asm.op(CPU::INS_INX);
+	Asm.branch(CPU::INS_BNE, Loop);
+	Asm.op16(CPU::INS_JMP_ABS, Start);
+}
+
+// 16x16 -> 32 bit shift-and-add multiply of $10-$11 by $12-$13 into $14-$17
+static void AssembleMultiply(Assembler& Asm)
+{
+	const Word Start = Asm.here();
+	Asm.op(CPU::INS_LDA_IM, 0x34);
+	Asm.op(CPU::INS_STA_ZP, 0x10);
+	Asm.op(CPU::INS_LDA_IM, 0x12);
+	Asm.op(CPU::INS_STA_ZP, 0x11);
+	Asm.op(CPU::INS_LDA_IM, 0x78);
+	Asm.op(CPU::INS_STA_ZP, 0x12);
+	Asm.op(CPU::INS_LDA_IM, 0x56);
+	Asm.op(CPU::INS_STA_ZP, 0x13);
+	Asm.op(CPU::INS_LDA_IM, 0x00);
+	Asm.op(CPU::INS_STA_ZP, 0x16);
+	Asm.op(CPU::INS_STA_ZP, 0x17);
+	Asm.op(CPU::INS_LDX_IM, 16);
+	const Word Loop = Asm.here();
+	Asm.op(CPU::INS_LSR_ZP, 0x13);
+	Asm.op(CPU::INS_ROR_ZP, 0x12);
+	const Word Skip = Asm.branchForward(CPU::INS_BCC);
+	Asm.op(CPU::INS_CLC);
+	Asm.op(CPU::INS_LDA_ZP, 0x16);
+	Asm.op(CPU::INS_ADC_ZP, 0x10);
+	Asm.op(CPU::INS_STA_ZP, 0x16);
+	Asm.op(CPU::INS_LDA_ZP, 0x17);
+	Asm.op(CPU::INS_ADC_ZP, 0x11);
+	Asm.op(CPU::INS_STA_ZP, 0x17);
+	Asm.patch(Skip);
+	Asm.op(CPU::INS_ROR_ZP, 0x17);
+	Asm.op(CPU::INS_ROR_ZP, 0x16);
+	Asm.op(CPU::INS_ROR_ZP, 0x15);
+	Asm.op(CPU::INS_ROR_ZP, 0x14);
+	Asm.op(CPU::INS_DEX);
+	Asm.branch(CPU::INS_BNE, Loop);
+	Asm.op16(CPU::INS_JMP_ABS, Start);
+}
+
+// six digit packed BCD counter, two digits per byte at $20-$22, least significant first
+static void AssembleBCDCounter(Assembler& Asm)
+{
+	const Word Start = Asm.here();
+	Asm.op(CPU::INS_SED);
+	Asm.op(CPU::INS_CLC);
+	Asm.op(CPU::INS_LDA_ZP, 0x20);
+	Asm.op(CPU::INS_ADC, 0x01);
+	Asm.op(CPU::INS_STA_ZP, 0x20);
+	Asm.op(CPU::INS_LDA_ZP, 0x21);
+	Asm.op(CPU::INS_ADC, 0x00);
+	Asm.op(CPU::INS_STA_ZP, 0x21);
+	Asm.op(CPU::INS_LDA_ZP, 0x22);
+	Asm.op(CPU::INS_ADC, 0x00);
+	Asm.op(CPU::INS_STA_ZP, 0x22);
+	Asm.op(CPU::INS_CLD);
+	Asm.op16(CPU::INS_JMP_ABS, Start);
+}
+
+// bubble sort 64 bytes at $0300, refilled in descending order before every sort
+static void AssembleSort(Assembler& Asm)
+{
+	const Word Start = Asm.here();
+	Asm.op(CPU::INS_LDX_IM, 63);
+	const Word Fill = Asm.here();
+	Asm.op(CPU::INS_TXA);
+	Asm.op(CPU::INS_EOR_IM, 0x3F);
+	Asm.op16(CPU::INS_STA_ABSX, 0x0300);
+	Asm.op(CPU::INS_DEX);
+	Asm.branch(CPU::INS_BPL, Fill);
+	const Word Outer = Asm.here();
+	Asm.op(CPU::INS_LDY_IM, 0x00);
+	Asm.op(CPU::INS_LDX_IM, 0x00);
+	const Word Inner = Asm.here();
+	Asm.op16(CPU::INS_LDA_ABSX, 0x0300);
+	Asm.op16(CPU::INS_CMP_ABSX, 0x0301);
+	const Word NoSwapLess = Asm.branchForward(CPU::INS_BCC);
+	const Word NoSwapEqual = Asm.branchForward(CPU::INS_BEQ);
+	Asm.op(CPU::INS_PHA);
+	Asm.op16(CPU::INS_LDA_ABSX, 0x0301);
+	Asm.op16(CPU::INS_STA_ABSX, 0x0300);
+	Asm.op(CPU::INS_PLA);
+	Asm.op16(CPU::INS_STA_ABSX, 0x0301);
+	Asm.op(CPU::INS_LDY_IM, 0x01);
+	Asm.patch(NoSwapLess);
+	Asm.patch(NoSwapEqual);
+	Asm.op(CPU::INS_INX);
+	Asm.op(CPU::INS_CPX, 63);
+	Asm.branch(CPU::INS_BNE, Inner);
+	Asm.op(CPU::INS_TYA);
+	Asm.branch(CPU::INS_BNE, Outer);
+	Asm.op16(CPU::INS_JMP_ABS, Start);
+}
+
+template <class Variant>
+static void RunKernels(BasicCPU<Variant>& cpu, CPU::Memory& memory, u64 cycles, std::vector<BenchResult>& results)
+{
+	struct Kernel
+	{
+		const char* Name;
+		void (*Assemble)(Assembler&);
+	};
+	static const Kernel Kernels[] = {
+		{ "memcpy", AssembleMemcpy },
+		{ "multiply16", AssembleMultiply },
+		{ "bcd_counter", AssembleBCDCounter },
+		{ "bubble_sort", AssembleSort },
+	};
+
+	for (const Kernel& K : Kernels)
+	{
+		cpu.reset(CodeStart, memory);
+		Assembler Asm{ memory, CodeStart };
+		K.Assemble(Asm);
+		results.push_back(Run(cpu, memory, "kernel", K.Name, cycles));
+	}
+}
+
+// run a ROM image until it traps in a jump-to-self loop or the cycle limit is reached, false if
+// it could not be read
+template <class Variant>
+static bool RunROM(BasicCPU<Variant>& cpu, CPU::Memory& memory, const std::string& path, Word start, u64 maxCycles, std::vector<BenchResult>& results)
+{
+	cpu.reset(start, memory);
+	if (!cpu.loadROM(path, memory))
+	{
+		fprintf(stderr, "Error: Could not read ROM: %s\n", path.c_str());
+		return false;
+	}
+
+	const auto Start = std::chrono::steady_clock::now();
+	bool Trapped = false;
+	while (!Trapped && cpu.TotalCycles < maxCycles)
+	{
+		cpu.execute(SliceCycles, memory);
+		// single step once: a trap loop leaves the PC where it was
+		const Word PC = cpu.registers.PC;
+		cpu.execute(1, memory);
+		Trapped = cpu.registers.PC == PC;
+	}
+	const auto End = std::chrono::steady_clock::now();
+
+	BenchResult Result;
+	Result.Category = "rom";
+	Result.Name = path;
+	Result.Instructions = cpu.TotalInstructions;
+	Result.Cycles = cpu.TotalCycles;
+	Result.Seconds = std::chrono::duration<double>(End - Start).count();
+	results.push_back(Result);
+
+	printf("ROM %s %s at $%04X\n", path.c_str(), Trapped ? "trapped" : "still running", cpu.registers.PC);
+	return true;
+}
+
+// escape a string for a JSON string literal
+static std::string JSONString(const std::string& text)
+{
+	std::string Out = "\"";
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+		{
+			Out += '\\';
+		}
+		Out += c;
+	}
+	return Out + "\"";
+}
+
+static bool WriteJSON(const std::string& path, const char* variant, const std::vector<BenchResult>& results)
+{
+	FILE* file = fopen(path.c_str(), "w");
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	fprintf(file, "{\n  \"version\": 1,\n  \"variant\": %s,\n  \"results\": [\n", JSONString(variant).c_str());
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BenchResult& R = results[i];
+		fprintf(file, "    { \"category\": %s, \"name\": %s, \"instructions\": %llu, \"cycles\": %llu, "
+			"\"seconds\": %.6f, \"mips\": %.3f, \"mhz\": %.3f }%s\n",
+			JSONString(R.Category).c_str(), JSONString(R.Name).c_str(), R.Instructions, R.Cycles,
+			R.Seconds, R.mips(), R.mhz(), i + 1 < results.size() ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+	fclose(file);
+	return true;
+}
+
+// run every benchmark on the variant's CPU, false if one could not run
+template <class Variant>
+static bool RunBenchmarks(u64 cycles, const std::string& romPath, Word romStart, u64 romCycles, std::vector<BenchResult>& results)
+{
+	BasicCPU<Variant>* cpu = new BasicCPU<Variant>();
+	CPU::Memory* memory = new CPU::Memory();
+
+	RunMicrobenchmarks(*cpu, *memory, cycles, results);
+	RunKernels(*cpu, *memory, cycles, results);
+	bool Ran = true;
+	if (!romPath.empty())
+	{
+		Ran = RunROM(*cpu, *memory, romPath, romStart, romCycles, results);
+	}
+
+	delete memory;
+	delete cpu;
+	return Ran;
+}
+
+int main(int argc, char* argv[])
+{
+	u64 cycles = 20000000;
+	u64 romCycles = 100000000;
+	Word romStart = 0x0400;
+	std::string romPath;
+	std::string jsonPath;
+	const char* variant = NMOS6502::Name;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+		{
+			cycles = strtoull(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+		{
+			jsonPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--variant") == 0 && i + 1 < argc)
+		{
+			variant = argv[++i];
+		}
+		else if (strcmp(argv[i], "--rom") == 0 && i + 1 < argc)
+		{
+			romPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--rom-start") == 0 && i + 1 < argc)
+		{
+			romStart = (Word)strtoul(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--rom-cycles") == 0 && i + 1 < argc)
+		{
+			romCycles = strtoull(argv[++i], NULL, 0);
+		}
+		else
+		{
+			fprintf(stderr, "Error: Unknown argument: %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	std::vector<BenchResult> results;
+	bool ran;
+	if (strcmp(variant, NMOS6502::Name) == 0)
+	{
+		ran = RunBenchmarks<NMOS6502>(cycles, romPath, romStart, romCycles, results);
+	}
+	else if (strcmp(variant, WDC65C02::Name) == 0)
+	{
+		ran = RunBenchmarks<WDC65C02>(cycles, romPath, romStart, romCycles, results);
+	}
+	else if (strcmp(variant, Ricoh2A03::Name) == 0)
+	{
+		ran = RunBenchmarks<Ricoh2A03>(cycles, romPath, romStart, romCycles, results);
+	}
+	else
+	{
+		fprintf(stderr, "Error: Unknown variant: %s\n", variant);
+		return 1;
+	}
+	if (!ran)
+	{
+		return 1;
+	}
+
+	printf("variant %s\n", variant);
+	printf("%-8s %-24s %10s %10s\n", "category", "name", "MIPS", "MHz");
+	for (const BenchResult& R : results)
+	{
+		printf("%-8s %-24s %10.2f %10.2f\n", R.Category.c_str(), R.Name.c_str(), R.mips(), R.mhz());
+	}
+
+	int status = 0;
+	if (!jsonPath.empty() && !WriteJSON(jsonPath, variant, results))
+	{
+		fprintf(stderr, "Error: Could not write file: %s\n", jsonPath.c_str());
+		status = 1;
+	}
+	return status;
+}
@@ -0,0 +1,160 @@
+#include "AsyncDevice.h"
+#include <chrono>
+#include <string.h>
+
+// polls of an empty ring before the worker starts sleeping between polls
+static constexpr u32 IdleSpins = 1 << 12;
+
+AsyncDevice::AsyncDevice(u32 size, u32 capacity)
+	: size(size), shadow(new Byte[size]), buffer(new Event[capacity]), capacity(capacity), mask(capacity - 1),
+	head(0), tailCache(0), tail(0), stopping(false)
+{
+	memset(shadow, 0x00, size);
+}
+
+AsyncDevice::~AsyncDevice()
+{
+	stop();
+	delete[] buffer;
+	delete[] shadow;
+}
+
+void AsyncDevice::start()
+{
+	if (worker.joinable())
+	{
+		return;
+	}
+	stopping.store(false, std::memory_order_relaxed);
+	worker = std::thread(&AsyncDevice::run, this);
+}
+
+void AsyncDevice::stop()
+{
+	if (worker.joinable())
+	{
+		stopping.store(true, std::memory_order_release);
+		worker.join();
+	}
+}
+
+void AsyncDevice::advanceTo(u64 cycle)
+{
+	push(cycle, TimeMarker, 0);
+}
+
+void AsyncDevice::sync(u64 cycle)
+{
+	push(cycle, TimeMarker, 0);
+	if (!worker.joinable())
+	{
+		drain();
+		return;
+	}
+	const u64 Head = head.load(std::memory_order_relaxed);
+	tailCache = tail.load(std::memory_order_acquire);
+	while (tailCache != Head)
+	{
+		std::this_thread::yield();
+		tailCache = tail.load(std::memory_order_acquire);
+	}
+}
+
+Byte AsyncDevice::read(Word address, u64 cycle)
+{
+	const u32 Register = address & (size - 1);
+	if (!readHasSideEffect(Register))
+	{
+		return shadow[Register];
+	}
+	sync(cycle);
+	return registerRead(Register, cycle);
+}
+
+void AsyncDevice::write(Word address, Byte value, u64 cycle)
+{
+	const u32 Register = address & (size - 1);
+	shadow[Register] = value;
+	push(cycle, Register, value);
+}
+
+void AsyncDevice::push(u64 cycle, u32 reg, u32 value)
+{
+	const u64 Head = head.load(std::memory_order_relaxed);
+	if (Head - tailCache >= capacity)
+	{
+		waitForSpace(Head);
+	}
+
+	Event& Slot = buffer[Head & mask];
+	Slot.Cycle = cycle;
+	Slot.Register = reg;
+	Slot.Value = value;
+
+	head.store(Head + 1, std::memory_order_release);
+}
+
+void AsyncDevice::waitForSpace(u64 Head)
+{
+	if (!worker.joinable())
+	{
+		drain();
+		return;
+	}
+	tailCache = tail.load(std::memory_order_acquire);
+	while (Head - tailCache >= capacity)
+	{
+		std::this_thread::yield();
+		tailCache = tail.load(std::memory_order_acquire);
+	}
+}
+
+void AsyncDevice::run()
+{
+	u64 Tail = tail.load(std::memory_order_relaxed);
+	u32 Idle = 0;
+	while (true)
+	{
+		const bool Stop = stopping.load(std::memory_order_acquire);
+		const u64 Head = head.load(std::memory_order_acquire);
+		if (Head != Tail)
+		{
+			Tail = process(Tail, Head);
+			// publishing the tail also publishes the device state to a CPU thread waiting in sync
+			tail.store(Tail, std::memory_order_release);
+			Idle = 0;
+		}
+		else if (Stop)
+		{
+			break;
+		}
+		else if (++Idle < IdleSpins)
+		{
+			std::this_thread::yield();
+		}
+		else
+		{
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+	}
+}
+
+u64 AsyncDevice::process(u64 Tail, u64 Head)
+{
+	for (; Tail != Head; Tail++)
+	{
+		const Event& Next = buffer[Tail & mask];
+		advance(Next.Cycle);
+		if (Next.Register != TimeMarker)
+		{
+			registerWritten(Next.Register, (Byte)Next.Value, Next.Cycle);
+		}
+	}
+	return Tail;
+}
+
+void AsyncDevice::drain()
+{
+	tailCache = process(tail.load(std::memory_order_relaxed), head.load(std::memory_order_relaxed));
+	tail.store(tailCache, std::memory_order_relaxed);
+}
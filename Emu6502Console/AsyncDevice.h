@@ -0,0 +1,106 @@
+/**
+* Class name: AsyncDevice
+* Purpose: Base for expensive peripherals (video, audio, ...) that emulate on their own thread.
+*
+* The CPU thread never runs device code for a write: the write lands in the shadow register file
+* and goes to the worker as a timestamped event on a lock-free single producer, single consumer
+* ring. Reads are served from the shadow registers, except for registers the device declares as
+* having a side effect (status, FIFOs, counters). For those the CPU waits until the worker has
+* processed every earlier event and advanced to the cycle of the read, then reads the register
+* on its own thread while the worker is idle.
+*
+* The worker only sees events in cycle order and the CPU only sees device state at sync points,
+* so the result does not depend on how the two threads are scheduled. Without a running worker
+* the CPU thread processes the events itself when it syncs or the ring fills.
+**/
+#pragma once
+#include <atomic>
+#include <thread>
+#include "IODevice.h"
+
+class AsyncDevice : public IODevice
+{
+public:
+	// ring buffer size in events, must be a power of two
+	static constexpr u32 DefaultCapacity = 1 << 14;
+
+	// size registers, a power of two, mirrored across the mapped pages
+	explicit AsyncDevice(u32 size, u32 capacity = DefaultCapacity);
+
+	// derived classes must call stop() in their own destructor, while their state is still alive
+	virtual ~AsyncDevice();
+
+	// start the worker thread
+	void start();
+
+	// process the remaining events and stop the worker thread
+	void stop();
+
+	// let the device run up to cycle without a register access, e.g. once per frame
+	void advanceTo(u64 cycle);
+
+	// block until the worker has processed every event and advanced to cycle
+	void sync(u64 cycle);
+
+	// IODevice
+	Byte read(Word address, u64 cycle) override;
+	void write(Word address, Byte value, u64 cycle) override;
+
+protected:
+	// worker thread: run the device up to cycle. Cycles never go backwards
+	virtual void advance(u64 cycle) = 0;
+
+	// worker thread: the CPU wrote value to reg at cycle, after advance(cycle)
+	virtual void registerWritten(u32 reg, Byte value, u64 cycle) = 0;
+
+	// whether reading reg has a side effect or depends on the device's progress
+	virtual bool readHasSideEffect(u32 reg) const = 0;
+
+	// CPU thread, with the worker idle and advanced to cycle: read reg
+	virtual Byte registerRead(u32 reg, u64 cycle) = 0;
+
+	// number of registers
+	const u32 size;
+
+	// last value the CPU wrote to each register, only ever written by the CPU thread
+	Byte* shadow;
+
+private:
+	// one register write, or a time marker when Register is TimeMarker
+	struct Event
+	{
+		u64 Cycle;
+		u32 Register;
+		u32 Value;
+	};
+
+	static constexpr u32 TimeMarker = ~0u;
+
+	void push(u64 cycle, u32 reg, u32 value);
+
+	// block the CPU thread until the worker has freed a slot
+	void waitForSpace(u64 Head);
+
+	// worker thread body
+	void run();
+
+	// run the events from Tail up to Head, returning Head
+	u64 process(u64 Tail, u64 Head);
+
+	// without a worker, before start() or after stop(): run every queued event on the CPU thread
+	void drain();
+
+	Event* buffer;
+	const u32 capacity;
+	const u32 mask;
+
+	// producer side (CPU thread)
+	alignas(64) std::atomic<u64> head;
+	u64 tailCache;
+
+	// consumer side (worker thread)
+	alignas(64) std::atomic<u64> tail;
+	std::atomic<bool> stopping;
+
+	std::thread worker;
+};
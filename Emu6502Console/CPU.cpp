@@ -1,21 +1,97 @@
 #include "CPU.h"
+#include "Disassembler.h"
+#include "IODevice.h"
+#include "PerfCounters.h"
+#include "Trace.h"
 #include <iostream>
 
-#define ASSERT(Condition, Text) { if ( !Condition ) { throw -1; } }
+CPUBase::CPUBase()
+{
+	TotalCycles = 0;
+	TotalInstructions = 0;
+	tracer = nullptr;
+	profiler = nullptr;
+	coverage = nullptr;
+	coveragePrevious = 0;
+	verbose = true;
+	UnknownInstructions = 0;
+	cycleBase = 0;
+	pendingStall = 0;
+	zeroPage = nullptr;
+	stackPage = nullptr;
+	for (u32 Page = 0; Page < 256; Page++)
+	{
+		devices[Page] = nullptr;
+	}
+}
+
+CPUBase::~CPUBase()
+{
+}
+
+CPUBase::Memory::Memory()
+	: Memory(MemoryArena::shared())
+{
+}
+
+CPUBase::Memory::Memory(MemoryArena& arena, std::shared_ptr<const ROMImage> rom)
+	: rom(std::move(rom)), arena(arena)
+{
+	const u32 FirstROMPage = this->rom ? this->rom->firstPage : PAGES;
+	const u32 ROMPages = this->rom ? this->rom->pageCount : 0;
+	ramPages = PAGES - ROMPages;
+	ram = arena.allocate(ramPages);
+
+	Byte* NextRAM = ram;
+	for (u32 Page = 0; Page < PAGES; Page++)
+	{
+		if (Page >= FirstROMPage && Page < FirstROMPage + ROMPages)
+		{
+			pages[Page] = this->rom->data + (Page - FirstROMPage) * PAGE_SIZE;
+			writable[Page] = nullptr;
+		}
+		else
+		{
+			pages[Page] = NextRAM;
+			writable[Page] = NextRAM;
+			NextRAM += PAGE_SIZE;
+		}
+	}
+	flat = this->rom ? nullptr : ram;
+	init();
+}
+
+CPUBase::Memory::~Memory()
+{
+	arena.release(ram, ramPages);
+}
 
-CPU::CPU()
+void CPUBase::Memory::init()
 {
-	// new memory object
-	Memory* memory = new Memory();
-	// initialize memory
-	memory->init();
+	memset(ram, 0x00, (size_t)ramPages * PAGE_SIZE);
+	hash = rom ? rom->hash : 0;
 }
 
-CPU::~CPU()
+void CPUBase::Memory::writeRAM(Byte* cells, Word address, const Byte* data, u32 length)
 {
+	// the hash is linear in every byte, so it takes the difference before the bytes move
+	for (u32 Index = 0; Index < length; Index++)
+	{
+		hash += hashKey((Word)(address + Index)) * (u64)((s32)data[Index] - (s32)cells[Index]);
+	}
+	memmove(cells, data, length);
 }
 
-Byte CPU::FetchByte(s32& cycles, Memory& memory)
+void CPUBase::Memory::fillRAM(Byte* cells, Word address, Byte data, u32 length)
+{
+	for (u32 Index = 0; Index < length; Index++)
+	{
+		hash += hashKey((Word)(address + Index)) * (u64)((s32)data - (s32)cells[Index]);
+	}
+	memset(cells, data, length);
+}
+
+Byte CPUBase::FetchByte(s32& cycles, Memory& memory)
 {
 	Byte data = memory.read(registers.PC);
 	registers.PC++;
@@ -23,7 +99,7 @@ Byte CPU::FetchByte(s32& cycles, Memory& memory)
 	return data;
 }
 
-SByte CPU::FetchSByte(s32& cycles, Memory& memory)
+SByte CPUBase::FetchSByte(s32& cycles, Memory& memory)
 {
 	SByte data = memory.read(registers.PC);
 	registers.PC++;
@@ -31,7 +107,7 @@ SByte CPU::FetchSByte(s32& cycles, Memory& memory)
 	return data;
 }
 
-Word CPU::FetchWord(s32& cycles, Memory& memory)
+Word CPUBase::FetchWord(s32& cycles, Memory& memory)
 {
 	Word data = memory.read(registers.PC);
 	registers.PC++;
@@ -42,86 +118,161 @@ Word CPU::FetchWord(s32& cycles, Memory& memory)
 	return data;
 }
 
-Byte CPU::ReadByte(s32& cycles, Word address, Memory& memory)
+Byte CPUBase::ReadByte(s32& cycles, Word address, Memory& memory)
 {
+	IODevice* Device = devices[address >> 8];
+	if (Device)
+	{
+		Byte data = Device->read(address, currentCycle(cycles));
+		cycles -= (s32)pendingStall + 1;
+		pendingStall = 0;
+		return data;
+	}
 	Byte data = memory.read(address);
 	cycles--;
 	return data;
 }
 
-Word CPU::ReadWord(s32& cycles, Word address, Memory& memory)
+Word CPUBase::ReadWord(s32& cycles, Word address, Memory& memory)
 {
 	Byte LoByte = ReadByte(cycles, address, memory);
 	Byte HiByte = ReadByte(cycles, address + 1, memory);
 	return LoByte | (HiByte << 8);
 }
 
-void CPU::WriteByte(s32& cycles, Word address, Byte value, Memory& memory)
+Byte CPUBase::ReadZeroPage(s32& cycles, Byte offset, Memory& memory)
+{
+	if (zeroPage)
+	{
+		cycles--;
+		return zeroPage[offset];
+	}
+	return ReadByte(cycles, offset, memory);
+}
+
+void CPUBase::WriteZeroPage(s32& cycles, Byte offset, Byte value, Memory& memory)
 {
-	memory.write(address, value);
+	if (zeroPage)
+	{
+		memory.writeRAM(zeroPage[offset], offset, value);
+		cycles--;
+		return;
+	}
+	WriteByte(cycles, offset, value, memory);
+}
+
+Word CPUBase::ReadZeroPageWord(s32& cycles, Byte address, Memory& memory)
+{
+	// the high byte of a pointer at $FF comes from $00, not $0100
+	if (zeroPage)
+	{
+		cycles -= 2;
+		return zeroPage[address] | (zeroPage[(Byte)(address + 1)] << 8);
+	}
+	Byte LoByte = ReadByte(cycles, address, memory);
+	Byte HiByte = ReadByte(cycles, (Byte)(address + 1), memory);
+	return LoByte | (HiByte << 8);
+}
+
+void CPUBase::WriteByte(s32& cycles, Word address, Byte value, Memory& memory)
+{
+	IODevice* Device = devices[address >> 8];
+	if (Device)
+	{
+		Device->write(address, value, currentCycle(cycles));
+		cycles -= (s32)pendingStall;
+		pendingStall = 0;
+	}
+	else
+	{
+		memory.write(address, value);
+	}
 	cycles--;
 }
 
-void CPU::WriteWord(s32& cycles, Word address, Word value, Memory& memory)
+void CPUBase::WriteWord(s32& cycles, Word address, Word value, Memory& memory)
 {
 	WriteByte(cycles, address, value & 0xFF, memory);
 	WriteByte(cycles, address + 1, value >> 8, memory);
 }
 
-Word CPU::SPToAddress()
+void CPUBase::mapDevice(IODevice* device, Word first, Word last)
 {
-	return 0x0100 | registers.SP;
+	for (u32 Page = first >> 8; Page <= (u32)(last >> 8); Page++)
+	{
+		devices[Page] = device;
+	}
 }
 
-void CPU::PushWord(s32& cycles, Word value, Memory& memory)
+Byte CPUBase::ReadStack(s32& cycles, Byte offset, Memory& memory)
 {
-	WriteByte(cycles, SPToAddress(), value >> 8, memory);
-	registers.SP--;
-	WriteByte(cycles, SPToAddress(), value & 0xFF, memory);
-	registers.SP--;
+	if (stackPage)
+	{
+		cycles--;
+		return stackPage[offset];
+	}
+	return ReadByte(cycles, 0x0100 | offset, memory);
 }
 
-void CPU::PushPC(s32& cycles, Memory& memory)
+void CPUBase::WriteStack(s32& cycles, Byte offset, Byte value, Memory& memory)
+{
+	if (stackPage)
+	{
+		memory.writeRAM(stackPage[offset], 0x0100 | offset, value);
+		cycles--;
+		return;
+	}
+	WriteByte(cycles, 0x0100 | offset, value, memory);
+}
+
+void CPUBase::PushWord(s32& cycles, Word value, Memory& memory)
+{
+	PushByte(cycles, value >> 8, memory);
+	PushByte(cycles, value & 0xFF, memory);
+}
+
+void CPUBase::PushPC(s32& cycles, Memory& memory)
 {
 	PushWord(cycles, registers.PC, memory);
 }
 
-void CPU::PushPCMinusOne(s32& cycles, Memory& memory)
+void CPUBase::PushPCMinusOne(s32& cycles, Memory& memory)
 {
 	PushWord(cycles, registers.PC - 1, memory);
 }
 
-void CPU::PushPCPlusOne(s32& cycles, Memory& memory)
+void CPUBase::PushPCPlusOne(s32& cycles, Memory& memory)
 {
 	PushWord(cycles, registers.PC + 1, memory);
 }
 
-void CPU::PushByte(s32& cycles, Byte value, Memory& memory)
+void CPUBase::PushByte(s32& cycles, Byte value, Memory& memory)
 {
-	WriteByte(cycles, SPToAddress(), value, memory);
+	WriteStack(cycles, registers.SP, value, memory);
 	registers.SP--;
 }
 
-Byte CPU::PopByte(s32& cycles, Memory& memory)
+Byte CPUBase::PopByte(s32& cycles, Memory& memory)
 {
 	registers.SP++;
-	return ReadByte(cycles, SPToAddress(), memory);
+	return ReadStack(cycles, registers.SP, memory);
 }
 
-Word CPU::PopWord(s32& cycles, Memory& memory)
+Word CPUBase::PopWord(s32& cycles, Memory& memory)
 {
-	Word ValueFromStack = ReadWord(cycles, SPToAddress(), memory);
-	registers.SP += 2;
-	return ValueFromStack;
+	// pop the bytes one at a time so the stack pointer wraps within page 1
+	Byte LoByte = PopByte(cycles, memory);
+	Byte HiByte = PopByte(cycles, memory);
+	return LoByte | (HiByte << 8);
 }
 
-void CPU::SetZNFlags(Byte reg)
+void CPUBase::SetZNFlags(Byte reg)
 {
 	status.Z = (reg == 0);
 	status.N = (reg & NegativeFlagBit) > 0;
 }
 
-Word CPU::LoadPrg(const Byte* prg, u32 NumBytes, Memory& memory)
+Word CPUBase::LoadPrg(const Byte* prg, u32 NumBytes, Memory& memory)
 {
 	Word LoadAddress = 0;
 	if (prg && NumBytes > 2)
@@ -139,13 +290,13 @@ Word CPU::LoadPrg(const Byte* prg, u32 NumBytes, Memory& memory)
 }
 
 // reset
-void CPU::reset(Memory& memory)
+void CPUBase::reset(Memory& memory)
 {
 	reset(0xFFFC, memory);
 }
 
 // reset to reset vector
-void CPU::reset(Word ResetVector, Memory& memory)
+void CPUBase::reset(Word ResetVector, Memory& memory)
 {
 	// reset registers
 	registers.A = 0x00;
@@ -161,22 +312,59 @@ void CPU::reset(Word ResetVector, Memory& memory)
 	status.B = 0;
 	status.V = 0;
 	status.N = 0;
+	TotalCycles = 0;
+	TotalInstructions = 0;
+	UnknownInstructions = 0;
+	coveragePrevious = 0;
 
 	// reset memory
 	memory.init();
 }
 
-// load ROM file into EEPROM
-void CPU::loadROM(std::string path, Memory& memory)
+void CPUBase::saveSnapshot(Snapshot& snapshot, const Memory& memory) const
+{
+	snapshot.registers = registers;
+	snapshot.PS = PS;
+	snapshot.TotalCycles = TotalCycles;
+	snapshot.TotalInstructions = TotalInstructions;
+	snapshot.UnknownInstructions = UnknownInstructions;
+	for (u32 Page = 0; Page < Memory::PAGES; Page++)
+	{
+		memcpy(snapshot.memory + Page * Memory::PAGE_SIZE, memory.pages[Page], Memory::PAGE_SIZE);
+	}
+	snapshot.memoryHash = memory.hash;
+}
+
+void CPUBase::restoreSnapshot(const Snapshot& snapshot, Memory& memory)
+{
+	registers = snapshot.registers;
+	PS = snapshot.PS;
+	TotalCycles = snapshot.TotalCycles;
+	TotalInstructions = snapshot.TotalInstructions;
+	UnknownInstructions = snapshot.UnknownInstructions;
+	coveragePrevious = 0;
+	// ROM pages are the same in every machine mapping the image, only RAM needs restoring
+	for (u32 Page = 0; Page < Memory::PAGES; Page++)
+	{
+		if (memory.writable[Page])
+		{
+			memcpy(memory.writable[Page], snapshot.memory + Page * Memory::PAGE_SIZE, Memory::PAGE_SIZE);
+		}
+	}
+	memory.hash = snapshot.memoryHash;
+}
+
+// load ROM file into memory
+bool CPUBase::loadROM(std::string path, Memory& memory)
 {
-	// open the file using fopen_s
-	FILE* file;
-	fopen_s(&file, path.c_str(), "rb");
+	// open the file
+	FILE* file = fopen(path.c_str(), "rb");
 	
 	// check if the file is open
 	if (file == NULL) {
-		std::cout << "Error: Could not open file: " << path << std::endl;
-		return;
+		if (verbose)
+			std::cout << "Error: Could not open file: " << path << std::endl;
+		return false;
 	}
 	
 	// write the file into memory one byte at a time
@@ -188,326 +376,41 @@ void CPU::loadROM(std::string path, Memory& memory)
 
 	// close the file
 	fclose(file);
+	return true;
 }
 
 // print status
-void CPU::printStatus() const
-{
-	// print CPU status
-	std::cout << "CPU Status:" << std::endl;
-	std::cout << "A: " << (int)registers.A << std::endl;
-	std::cout << "X: " << (int)registers.X << std::endl;
-	std::cout << "Y: " << (int)registers.Y << std::endl;
-	std::cout << "PC: " << (int)registers.PC << std::endl;
-	std::cout << "SP: " << (int)registers.SP << std::endl;
-	std::cout << "C: " << (int)status.C << std::endl;
-	std::cout << "Z: " << (int)status.Z << std::endl;
-	std::cout << "I: " << (int)status.I << std::endl;
-	std::cout << "D: " << (int)status.D << std::endl;
-	std::cout << "B: " << (int)status.B << std::endl;
-	std::cout << "V: " << (int)status.V << std::endl;
+void CPUBase::printStatus() const
+{
+	// print CPU status, flushing once at the end rather than per line
+	std::cout << "CPU Status:" << '\n';
+	std::cout << "A: " << (int)registers.A << '\n';
+	std::cout << "X: " << (int)registers.X << '\n';
+	std::cout << "Y: " << (int)registers.Y << '\n';
+	std::cout << "PC: " << (int)registers.PC << '\n';
+	std::cout << "SP: " << (int)registers.SP << '\n';
+	std::cout << "C: " << (int)status.C << '\n';
+	std::cout << "Z: " << (int)status.Z << '\n';
+	std::cout << "I: " << (int)status.I << '\n';
+	std::cout << "D: " << (int)status.D << '\n';
+	std::cout << "B: " << (int)status.B << '\n';
+	std::cout << "V: " << (int)status.V << '\n';
 	std::cout << "N: " << (int)status.N << std::endl;
 }
 
-s32 CPU::execute(s32 cycles, Memory& memory)
+Word CPUBase::AddrMode_IM(s32& /*cycles*/, Memory& /*memory*/)
 {
-	// load a register with the value from the memory address
-	auto LoadRegister = [&cycles, &memory, this] (Word Address, Byte& Register)
-	{
-		Register = ReadByte(cycles, Address, memory);
-		SetZNFlags(Register);
-	};
-
-	// AND the A register with the value from the memory address
-	auto AND = [&cycles, &memory, this](Word Address)
-	{
-		registers.A &= ReadByte(cycles, Address, memory);
-		SetZNFlags(registers.A);
-	};
-
-	// OR the A register with the value from the memory address
-	auto ORA = [&cycles, &memory, this](Word Address)
-	{
-		registers.A |= ReadByte(cycles, Address, memory);
-		SetZNFlags(registers.A);
-	};
-
-	// XOR the A register with the value from the memory address
-	auto EOR = [&cycles, &memory, this](Word Address)
-	{
-		registers.A ^= ReadByte(cycles, Address, memory);
-		SetZNFlags(registers.A);
-	};
-	
-	// conditional branch
-	auto BranchIf = [&cycles, &memory, this](bool Test, bool Expected)
-	{
-		SByte Offset = FetchSByte(cycles, memory);
-		if (Test == Expected)
-		{
-			const Word PCOld = registers.PC;
-			registers.PC += Offset;
-			cycles--;
-
-			const bool PageChanged = (registers.PC >> 8) != (PCOld >> 8);
-			if (PageChanged)
-			{
-				cycles--;
-			}
-		}
-	};
-
-	// Add with carry given the operand
-	auto ADC = [&cycles, &memory, this](Byte Operand)
-	{
-		// decimal mode not supported
-		ASSERT(!status.D, "Decimal mode not supported");
-		const bool AreSignBitsTheSame = !((registers.A ^ Operand) & NegativeFlagBit);
-		Word Sum = registers.A;
-		Sum += Operand;
-		Sum += status.C;
-		registers.A = (Sum & 0xFF);
-		SetZNFlags(registers.A);
-		status.C = Sum > 0xFF;
-		status.V = AreSignBitsTheSame && ((registers.A ^ Operand) & NegativeFlagBit);
-	};
-
-	// subtract with carry
-	auto SBC = [&ADC](Byte Operand)
-	{
-		ADC(~Operand);
-	};
-
-	// set CPU status for a CMP/CPX/CPY operation
-	auto RegisterCompare = [&cycles, &memory, this](Byte Operand, Byte RegisterValue)
-	{
-		const Byte Difference = RegisterValue - Operand;
-		status.N = (Difference & NegativeFlagBit) > 0;
-		status.Z = RegisterValue == Operand;
-		status.C = RegisterValue >= Operand;
-	};
-
-	// arithmetic shift left
-	auto ASL = [&cycles, &memory, this](Byte Operand) -> Byte
-	{
-		status.C = (Operand & NegativeFlagBit) > 0;
-		Byte Result = Operand << 1;
-		SetZNFlags(Result);
-		cycles--;
-		return Result;
-	};
-
-	// logical shift right
-	auto LSR = [&cycles, this](Byte Operand) -> Byte
-	{
-		status.C = (Operand & NegativeFlagBit) > 0;
-		Byte Result = Operand >> 1;
-		SetZNFlags(Result);
-		cycles--;
-		return Result;
-	};
-
-	// rotate left
-	auto ROL = [&cycles, this](Byte Operand) -> Byte
-	{
-		const bool Carry = status.C;
-		status.C = (Operand & NegativeFlagBit) > 0;
-		Byte Result = Operand << 1;
-		Result |= Carry;
-		SetZNFlags(Result);
-		cycles--;
-		return Result;
-	};
-
-	// rotate right
-	auto ROR = [&cycles, this](Byte Operand) -> Byte
-	{
-		const bool Carry = status.C;
-		status.C = (Operand & NegativeFlagBit) > 0;
-		Byte Result = Operand >> 1;
-		Result |= Carry << 7;
-		SetZNFlags(Result);
-		cycles--;
-		return Result;
-	};
-
-	// push status onto the stack, setting bits 4 & 5 on the stack
-	auto PushStatus = [&cycles, &memory, this]()
-	{
-		Byte PSStack = PS | BreakFlagBit | UnusedFlagBit;
-		PushByte(cycles, PSStack, memory);
-	};
-
-	// pop CPU status from the stack, clearing bits 4 & 5 (break & unused)
-	auto PopStatus = [&cycles, &memory, this]()
-	{
-		PS = PopByte(cycles, memory);
-		status.B = false;
-		status.U = false;
-	};
-
-	const s32 CyclesRequested = cycles;
-	while (cycles > 0)
-	{
-		Byte Instruction = FetchByte(cycles, memory);
-
-		switch (Instruction)
-		{
-		case INS_JMP_ABS:
-		{
-			Word Address = AddrMode_ABS(cycles, memory);
-			registers.PC = Address;
-		}
-		case INS_JMP_IND:
-		{
-			Word Address = AddrMode_ABS(cycles, memory);
-			registers.PC = ReadWord(cycles, Address, memory);
-			break;
-		}
-		case INS_LDA_ABS:
-		{
-			Word Address = AddrMode_ABS(cycles, memory);
-			LoadRegister(Address, registers.A);
-			break;
-		}
-		case INS_LDA_ABSX:
-		{
-			Word Address = AddrMode_ABSX(cycles, memory);
-			LoadRegister(Address, registers.A);
-			break;
-		}
-		case INS_LDA_ABSY:
-		{
-			Word Address = AddrMode_ABSY(cycles, memory);
-			LoadRegister(Address, registers.A);
-			break;
-		}
-		case INS_LDA_IM:
-		{
-			registers.A = FetchByte(cycles, memory);
-			SetZNFlags(registers.A);
-			break;
-		}
-		case INS_LDA_INDX:
-		{
-			Word Address = AddrMode_INDX(cycles, memory);
-			LoadRegister(Address, registers.A);
-			break;
-		}
-		case INS_LDA_INDY:
-		{
-			Word Address = AddrMode_INDY(cycles, memory);
-			LoadRegister(Address, registers.A);
-			break;
-		}
-		case INS_LDA_ZP:
-		{
-			Word Address = AddrMode_ZP(cycles, memory);
-			LoadRegister(Address, registers.A);
-			break;
-		}
-		case INS_LDA_ZPX:
-		{
-			Word Address = AddrMode_ZPX(cycles, memory);
-			LoadRegister(Address, registers.A);
-			break;
-		}
-		case INS_ROR:
-		{
-			registers.A = ROR(registers.A);
-			break;
-		}
-		case INS_ROR_ABS:
-		{
-			Word Address = AddrMode_ABS(cycles, memory);
-			Byte Operand = ReadByte(cycles, Address, memory);
-			Byte Result = ROR(Operand);
-			WriteByte(cycles, Address, Result, memory);
-			break;
-		}
-		case INS_ROR_ABSX:
-		{
-			Word Address = AddrMode_ABSX(cycles, memory);
-			Byte Operand = ReadByte(cycles, Address, memory);
-			Byte Result = ROR(Operand);
-			WriteByte(cycles, Address, Result, memory);
-			break;
-		}
-		case INS_ROR_ZP:
-		{
-			Word Address = AddrMode_ZP(cycles, memory);
-			Byte Operand = ReadByte(cycles, Address, memory);
-			Byte Result = ROR(Operand);
-			WriteByte(cycles, Address, Result, memory);
-			break;
-		}
-		case INS_ROR_ZPX:
-		{
-			Word Address = AddrMode_ZPX(cycles, memory);
-			Byte Operand = ReadByte(cycles, Address, memory);
-			Byte Result = ROR(Operand);
-			WriteByte(cycles, Address, Result, memory);
-			break;
-		}
-		case INS_STA_ABS:
-		{
-			Word Address = AddrMode_ABS(cycles, memory);
-			WriteByte(cycles, Address, registers.A, memory);
-			break;
-		}
-		case INS_STA_ABSX:
-		{
-			Word Address = AddrMode_ABSX(cycles, memory);
-			WriteByte(cycles, Address, registers.A, memory);
-			break;
-		}
-		case INS_STA_ABSY:
-		{
-			Word Address = AddrMode_ABSY(cycles, memory);
-			WriteByte(cycles, Address, registers.A, memory);
-			break;
-		}
-		case INS_STA_INDX:
-		{
-			Word Address = AddrMode_INDX(cycles, memory);
-			WriteByte(cycles, Address, registers.A, memory);
-			break;
-		}
-		case INS_STA_INDY:
-		{
-			Word Address = AddrMode_INDY(cycles, memory);
-			WriteByte(cycles, Address, registers.A, memory);
-			break;
-		}
-		case INS_STA_ZP:
-		{
-			Word Address = AddrMode_ZP(cycles, memory);
-			WriteByte(cycles, Address, registers.A, memory);
-			break;
-		}
-		case INS_STA_ZPX:
-		{
-			Word Address = AddrMode_ZPX(cycles, memory);
-			WriteByte(cycles, Address, registers.A, memory);
-			break;
-		}
-		default:
-			std::cout << "Error: Unknown instruction: " << std::hex << (int)Instruction << std::endl;
-			break;
-		}
-	}
-
-	const s32 NumCyclesUsed = CyclesRequested - cycles;
-	return NumCyclesUsed;
+	// the read of the operand is charged by the handler
+	return registers.PC++;
 }
 
-Word CPU::AddrMode_ZP(s32& cycles, Memory& memory)
+Word CPUBase::AddrMode_ZP(s32& cycles, Memory& memory)
 {
 	Byte ZPAddress = FetchByte(cycles, memory);
 	return ZPAddress;
 }
 
-Word CPU::AddrMode_ZPX(s32& cycles, Memory& memory)
+Word CPUBase::AddrMode_ZPX(s32& cycles, Memory& memory)
 {
 	Byte ZPAddress = FetchByte(cycles, memory);
 	ZPAddress += registers.X;
@@ -515,7 +418,7 @@ Word CPU::AddrMode_ZPX(s32& cycles, Memory& memory)
 	return ZPAddress;
 }
 
-Word CPU::AddrMode_ZPY(s32& cycles, Memory& memory)
+Word CPUBase::AddrMode_ZPY(s32& cycles, Memory& memory)
 {
 	Byte ZPAddress = FetchByte(cycles, memory);
 	ZPAddress += registers.Y;
@@ -523,13 +426,13 @@ Word CPU::AddrMode_ZPY(s32& cycles, Memory& memory)
 	return ZPAddress;
 }
 
-Word CPU::AddrMode_ABS(s32& cycles, Memory& memory)
+Word CPUBase::AddrMode_ABS(s32& cycles, Memory& memory)
 {
 	Word ABSAddress = FetchWord(cycles, memory);
 	return ABSAddress;
 }
 
-Word CPU::AddrMode_ABSX(s32& cycles, Memory& memory)
+Word CPUBase::AddrMode_ABSX(s32& cycles, Memory& memory)
 {
 	Word ABSAddress = FetchWord(cycles, memory);
 	Word ABSAddressX = ABSAddress + registers.X;
@@ -541,7 +444,7 @@ Word CPU::AddrMode_ABSX(s32& cycles, Memory& memory)
 	return ABSAddressX;
 }
 
-Word CPU::AddrMode_ABSX5(s32& cycles, Memory& memory)
+Word CPUBase::AddrMode_ABSX5(s32& cycles, Memory& memory)
 {
 	Word ABSAddress = FetchWord(cycles, memory);
 	Word ABSAddressX = ABSAddress + registers.X;
@@ -549,7 +452,7 @@ Word CPU::AddrMode_ABSX5(s32& cycles, Memory& memory)
 	return ABSAddressX;
 }
 
-Word CPU::AddrMode_ABSY(s32& cycles, Memory& memory)
+Word CPUBase::AddrMode_ABSY(s32& cycles, Memory& memory)
 {
 	Word ABSAddress = FetchWord(cycles, memory);
 	Word ABSAddressY = ABSAddress + registers.Y;
@@ -561,7 +464,7 @@ Word CPU::AddrMode_ABSY(s32& cycles, Memory& memory)
 	return ABSAddressY;
 }
 
-Word CPU::AddrMode_ABSY5(s32& cycles, Memory& memory)
+Word CPUBase::AddrMode_ABSY5(s32& cycles, Memory& memory)
 {
 	Word ABSAddress = FetchWord(cycles, memory);
 	Word ABSAddressY = ABSAddress + registers.Y;
@@ -569,19 +472,19 @@ Word CPU::AddrMode_ABSY5(s32& cycles, Memory& memory)
 	return ABSAddressY;
 }
 
-Word CPU::AddrMode_INDX(s32& cycles, Memory& memory)
+Word CPUBase::AddrMode_INDX(s32& cycles, Memory& memory)
 {
 	Byte ZPAddress = FetchByte(cycles, memory);
 	ZPAddress += registers.X;
 	cycles--;
-	Word EffectiveAddress = ReadWord(cycles, ZPAddress, memory);
+	Word EffectiveAddress = ReadZeroPageWord(cycles, ZPAddress, memory);
 	return EffectiveAddress;
 }
 
-Word CPU::AddrMode_INDY(s32& cycles, Memory& memory)
+Word CPUBase::AddrMode_INDY(s32& cycles, Memory& memory)
 {
 	Byte ZPAddress = FetchByte(cycles, memory);
-	Word EffectiveAddress = ReadWord(cycles, ZPAddress, memory);
+	Word EffectiveAddress = ReadZeroPageWord(cycles, ZPAddress, memory);
 	Word EffectiveAddressY = EffectiveAddress + registers.Y;
 	const bool CrossedPageBoundary = (EffectiveAddress ^ EffectiveAddressY) >> 8;
 	if (CrossedPageBoundary)
@@ -591,11 +494,849 @@ Word CPU::AddrMode_INDY(s32& cycles, Memory& memory)
 	return EffectiveAddressY;
 }
 
-Word CPU::AddrMode_INDY6(s32& cycles, Memory& memory)
+Word CPUBase::AddrMode_INDY6(s32& cycles, Memory& memory)
 {
 	Byte ZPAddress = FetchByte(cycles, memory);
-	Word EffectiveAddress = ReadWord(cycles, ZPAddress, memory);
+	Word EffectiveAddress = ReadZeroPageWord(cycles, ZPAddress, memory);
 	Word EffectiveAddressY = EffectiveAddress + registers.Y;
 	cycles--;
 	return EffectiveAddressY;
 }
+
+Word CPUBase::AddrMode_ZPI(s32& cycles, Memory& memory)
+{
+	Byte ZPAddress = FetchByte(cycles, memory);
+	Word EffectiveAddress = ReadZeroPageWord(cycles, ZPAddress, memory);
+	return EffectiveAddress;
+}
+
+// arithmetic shift left
+template <class Variant>
+Byte BasicCPU<Variant>::ASL(s32& cycles, Byte operand)
+{
+	status.C = (operand & NegativeFlagBit) > 0;
+	Byte Result = operand << 1;
+	SetZNFlags(Result);
+	cycles--;
+	return Result;
+}
+
+// logical shift right
+template <class Variant>
+Byte BasicCPU<Variant>::LSR(s32& cycles, Byte operand)
+{
+	status.C = (operand & 0x01) > 0;
+	Byte Result = operand >> 1;
+	SetZNFlags(Result);
+	cycles--;
+	return Result;
+}
+
+// rotate left
+template <class Variant>
+Byte BasicCPU<Variant>::ROL(s32& cycles, Byte operand)
+{
+	const bool Carry = status.C;
+	status.C = (operand & NegativeFlagBit) > 0;
+	Byte Result = operand << 1;
+	Result |= Carry;
+	SetZNFlags(Result);
+	cycles--;
+	return Result;
+}
+
+// rotate right
+template <class Variant>
+Byte BasicCPU<Variant>::ROR(s32& cycles, Byte operand)
+{
+	const bool Carry = status.C;
+	status.C = (operand & 0x01) > 0;
+	Byte Result = operand >> 1;
+	Result |= Carry << 7;
+	SetZNFlags(Result);
+	cycles--;
+	return Result;
+}
+
+// add with carry given the operand
+template <class Variant>
+void BasicCPU<Variant>::AddWithCarry(s32& cycles, Byte operand)
+{
+	if constexpr (Variant::HasDecimalMode)
+	{
+		if (status.D)
+		{
+			// NMOS decimal mode: Z comes from the binary sum, N and V from the
+			// intermediate result before the high nibble is adjusted
+			const Word Binary = registers.A + operand + status.C;
+			Word Lo = (registers.A & 0x0F) + (operand & 0x0F) + status.C;
+			if (Lo > 0x09)
+			{
+				Lo += 0x06;
+			}
+			Word Hi = (registers.A >> 4) + (operand >> 4) + (Lo > 0x0F);
+			status.Z = (Binary & 0xFF) == 0;
+			status.N = (Hi & 0x08) != 0;
+			status.V = ((~(registers.A ^ operand) & (registers.A ^ (Hi << 4))) & NegativeFlagBit) != 0;
+			if (Hi > 0x09)
+			{
+				Hi += 0x06;
+			}
+			status.C = Hi > 0x0F;
+			registers.A = (Byte)((Hi << 4) | (Lo & 0x0F));
+			if constexpr (Variant::HasCMOSTiming)
+			{
+				// the 65C02 spends a cycle to make N and Z valid
+				SetZNFlags(registers.A);
+				cycles--;
+			}
+			return;
+		}
+	}
+
+	const bool AreSignBitsTheSame = !((registers.A ^ operand) & NegativeFlagBit);
+	Word Sum = registers.A;
+	Sum += operand;
+	Sum += status.C;
+	registers.A = (Sum & 0xFF);
+	SetZNFlags(registers.A);
+	status.C = Sum > 0xFF;
+	status.V = AreSignBitsTheSame && ((registers.A ^ operand) & NegativeFlagBit);
+}
+
+// subtract with carry given the operand
+template <class Variant>
+void BasicCPU<Variant>::SubtractWithCarry(s32& cycles, Byte operand)
+{
+	if constexpr (Variant::HasDecimalMode)
+	{
+		if (status.D)
+		{
+			// NMOS decimal mode: all flags come from the binary subtraction
+			const s32 Borrow = !status.C;
+			const Word Binary = registers.A - operand - Borrow;
+			s32 Lo = (registers.A & 0x0F) - (operand & 0x0F) - Borrow;
+			status.C = Binary < 0x100;
+			status.V = (((registers.A ^ operand) & (registers.A ^ Binary)) & NegativeFlagBit) != 0;
+			SetZNFlags((Byte)Binary);
+			if constexpr (Variant::HasCMOSTiming)
+			{
+				// the 65C02 adjusts the whole difference before the low digit, which only
+				// differs from the NMOS result for operands that are not BCD. It spends a
+				// cycle to make N and Z valid
+				Word Result = Binary;
+				if (Binary >= 0x100)
+				{
+					Result -= 0x60;
+				}
+				if (Lo < 0)
+				{
+					Result -= 0x06;
+				}
+				registers.A = (Byte)Result;
+				SetZNFlags(registers.A);
+				cycles--;
+				return;
+			}
+			s32 Hi = (registers.A >> 4) - (operand >> 4);
+			if (Lo < 0)
+			{
+				Lo -= 0x06;
+				Hi--;
+			}
+			if (Hi < 0)
+			{
+				Hi -= 0x06;
+			}
+			registers.A = (Byte)(((Hi & 0x0F) << 4) | (Lo & 0x0F));
+			return;
+		}
+	}
+
+	// binary subtraction is addition of the complement
+	AddWithCarry(cycles, ~operand);
+}
+
+// conditional branch
+template <class Variant>
+void BasicCPU<Variant>::BranchIf(s32& cycles, bool condition, Memory& memory)
+{
+	SByte Offset = FetchSByte(cycles, memory);
+	if (condition)
+	{
+		const Word PCOld = registers.PC;
+		registers.PC += Offset;
+		cycles--;
+
+		const bool PageChanged = (registers.PC >> 8) != (PCOld >> 8);
+		if (PageChanged)
+		{
+			cycles--;
+		}
+	}
+}
+
+// push status onto the stack, setting bits 4 & 5 on the stack
+template <class Variant>
+void BasicCPU<Variant>::PushStatus(s32& cycles, Memory& memory)
+{
+	Byte PSStack = PS | BreakFlagBit | UnusedFlagBit;
+	PushByte(cycles, PSStack, memory);
+}
+
+// pop CPU status from the stack, clearing bits 4 & 5 (break & unused)
+template <class Variant>
+void BasicCPU<Variant>::PopStatus(s32& cycles, Memory& memory)
+{
+	PS = PopByte(cycles, memory);
+	status.B = false;
+	status.U = false;
+}
+
+template <class Variant>
+template <Word (CPUBase::*Mode)(s32&, CPUBase::Memory&)>
+Byte BasicCPU<Variant>::ReadOperand(s32& cycles, Word address, Memory& memory)
+{
+	if constexpr (IsZeroPageMode<Mode>)
+	{
+		return ReadZeroPage(cycles, (Byte)address, memory);
+	}
+	else
+	{
+		return ReadByte(cycles, address, memory);
+	}
+}
+
+template <class Variant>
+template <Word (CPUBase::*Mode)(s32&, CPUBase::Memory&)>
+void BasicCPU<Variant>::WriteOperand(s32& cycles, Word address, Byte value, Memory& memory)
+{
+	if constexpr (IsZeroPageMode<Mode>)
+	{
+		WriteZeroPage(cycles, (Byte)address, value, memory);
+	}
+	else
+	{
+		WriteByte(cycles, address, value, memory);
+	}
+}
+
+template <class Variant>
+template <Byte CPUBase::Registers::* Reg, Word (CPUBase::*Mode)(s32&, CPUBase::Memory&)>
+s32 BasicCPU<Variant>::Load(s32 cycles, Memory& memory)
+{
+	Word Address = (this->*Mode)(cycles, memory);
+	registers.*Reg = ReadOperand<Mode>(cycles, Address, memory);
+	SetZNFlags(registers.*Reg);
+	return cycles;
+}
+
+template <class Variant>
+template <Byte CPUBase::Registers::* Reg, Word (CPUBase::*Mode)(s32&, CPUBase::Memory&)>
+s32 BasicCPU<Variant>::Store(s32 cycles, Memory& memory)
+{
+	Word Address = (this->*Mode)(cycles, memory);
+	WriteOperand<Mode>(cycles, Address, registers.*Reg, memory);
+	return cycles;
+}
+
+template <class Variant>
+template <Word (CPUBase::*Mode)(s32&, CPUBase::Memory&)>
+s32 BasicCPU<Variant>::StoreZero(s32 cycles, Memory& memory)
+{
+	Word Address = (this->*Mode)(cycles, memory);
+	WriteOperand<Mode>(cycles, Address, 0x00, memory);
+	return cycles;
+}
+
+template <class Variant>
+template <Byte CPUBase::Registers::* From, Byte CPUBase::Registers::* To>
+s32 BasicCPU<Variant>::Transfer(s32 cycles, Memory& /*memory*/)
+{
+	registers.*To = registers.*From;
+	SetZNFlags(registers.*To);
+	cycles--;
+	return cycles;
+}
+
+template <class Variant>
+template <Byte CPUBase::Registers::* Reg, Byte Delta>
+s32 BasicCPU<Variant>::IncrementRegister(s32 cycles, Memory& /*memory*/)
+{
+	registers.*Reg += Delta;
+	SetZNFlags(registers.*Reg);
+	cycles--;
+	return cycles;
+}
+
+template <class Variant>
+template <Word (CPUBase::*Mode)(s32&, CPUBase::Memory&), Byte Delta>
+s32 BasicCPU<Variant>::IncrementMemory(s32 cycles, Memory& memory)
+{
+	Word Address = (this->*Mode)(cycles, memory);
+	Byte Value = ReadOperand<Mode>(cycles, Address, memory);
+	Value += Delta;
+	cycles--;
+	WriteOperand<Mode>(cycles, Address, Value, memory);
+	SetZNFlags(Value);
+	return cycles;
+}
+
+template <class Variant>
+template <Word (CPUBase::*Mode)(s32&, CPUBase::Memory&)>
+s32 BasicCPU<Variant>::AND(s32 cycles, Memory& memory)
+{
+	Word Address = (this->*Mode)(cycles, memory);
+	registers.A &= ReadOperand<Mode>(cycles, Address, memory);
+	SetZNFlags(registers.A);
+	return cycles;
+}
+
+template <class Variant>
+template <Word (CPUBase::*Mode)(s32&, CPUBase::Memory&)>
+s32 BasicCPU<Variant>::ORA(s32 cycles, Memory& memory)
+{
+	Word Address = (this->*Mode)(cycles, memory);
+	registers.A |= ReadOperand<Mode>(cycles, Address, memory);
+	SetZNFlags(registers.A);
+	return cycles;
+}
+
+template <class Variant>
+template <Word (CPUBase::*Mode)(s32&, CPUBase::Memory&)>
+s32 BasicCPU<Variant>::EOR(s32 cycles, Memory& memory)
+{
+	Word Address = (this->*Mode)(cycles, memory);
+	registers.A ^= ReadOperand<Mode>(cycles, Address, memory);
+	SetZNFlags(registers.A);
+	return cycles;
+}
+
+template <class Variant>
+template <Word (CPUBase::*Mode)(s32&, CPUBase::Memory&)>
+s32 BasicCPU<Variant>::BIT(s32 cycles, Memory& memory)
+{
+	Word Address = (this->*Mode)(cycles, memory);
+	Byte Value = ReadOperand<Mode>(cycles, Address, memory);
+	status.Z = !(registers.A & Value);
+	status.N = (Value & NegativeFlagBit) != 0;
+	status.V = (Value & OverflowFlagBit) != 0;
+	return cycles;
+}
+
+template <class Variant>
+template <Word (CPUBase::*Mode)(s32&, CPUBase::Memory&)>
+s32 BasicCPU<Variant>::ADC(s32 cycles, Memory& memory)
+{
+	Word Address = (this->*Mode)(cycles, memory);
+	Byte Operand = ReadOperand<Mode>(cycles, Address, memory);
+	AddWithCarry(cycles, Operand);
+	return cycles;
+}
+
+template <class Variant>
+template <Word (CPUBase::*Mode)(s32&, CPUBase::Memory&)>
+s32 BasicCPU<Variant>::SBC(s32 cycles, Memory& memory)
+{
+	Word Address = (this->*Mode)(cycles, memory);
+	Byte Operand = ReadOperand<Mode>(cycles, Address, memory);
+	SubtractWithCarry(cycles, Operand);
+	return cycles;
+}
+
+// set CPU status for a CMP/CPX/CPY operation
+template <class Variant>
+template <Byte CPUBase::Registers::* Reg, Word (CPUBase::*Mode)(s32&, CPUBase::Memory&)>
+s32 BasicCPU<Variant>::Compare(s32 cycles, Memory& memory)
+{
+	Word Address = (this->*Mode)(cycles, memory);
+	Byte Operand = ReadOperand<Mode>(cycles, Address, memory);
+	const Byte RegisterValue = registers.*Reg;
+	const Byte Difference = RegisterValue - Operand;
+	status.N = (Difference & NegativeFlagBit) > 0;
+	status.Z = RegisterValue == Operand;
+	status.C = RegisterValue >= Operand;
+	return cycles;
+}
+
+template <class Variant>
+template <Byte (BasicCPU<Variant>::*Operation)(s32&, Byte)>
+s32 BasicCPU<Variant>::ShiftAccumulator(s32 cycles, Memory& /*memory*/)
+{
+	registers.A = (this->*Operation)(cycles, registers.A);
+	return cycles;
+}
+
+template <class Variant>
+template <Byte (BasicCPU<Variant>::*Operation)(s32&, Byte), Word (CPUBase::*Mode)(s32&, CPUBase::Memory&)>
+s32 BasicCPU<Variant>::ShiftMemory(s32 cycles, Memory& memory)
+{
+	Word Address = (this->*Mode)(cycles, memory);
+	Byte Operand = ReadOperand<Mode>(cycles, Address, memory);
+	Byte Result = (this->*Operation)(cycles, Operand);
+	WriteOperand<Mode>(cycles, Address, Result, memory);
+	return cycles;
+}
+
+template <class Variant>
+template <Byte Flag, bool Expected>
+s32 BasicCPU<Variant>::Branch(s32 cycles, Memory& memory)
+{
+	BranchIf(cycles, ((PS & Flag) != 0) == Expected, memory);
+	return cycles;
+}
+
+template <class Variant>
+template <Byte Flag, bool Value>
+s32 BasicCPU<Variant>::SetFlag(s32 cycles, Memory& /*memory*/)
+{
+	if constexpr (Value)
+	{
+		PS |= Flag;
+	}
+	else
+	{
+		PS &= ~Flag;
+	}
+	cycles--;
+	return cycles;
+}
+
+template <class Variant>
+template <Byte CPUBase::Registers::* Reg>
+s32 BasicCPU<Variant>::Push(s32 cycles, Memory& memory)
+{
+	PushByte(cycles, registers.*Reg, memory);
+	cycles--;
+	return cycles;
+}
+
+template <class Variant>
+template <Byte CPUBase::Registers::* Reg>
+s32 BasicCPU<Variant>::Pull(s32 cycles, Memory& memory)
+{
+	registers.*Reg = PopByte(cycles, memory);
+	SetZNFlags(registers.*Reg);
+	cycles -= 2;
+	return cycles;
+}
+
+template <class Variant>
+s32 BasicCPU<Variant>::TXS(s32 cycles, Memory& /*memory*/)
+{
+	registers.SP = registers.X;
+	cycles--;
+	return cycles;
+}
+
+template <class Variant>
+s32 BasicCPU<Variant>::PHP(s32 cycles, Memory& memory)
+{
+	PushStatus(cycles, memory);
+	cycles--;
+	return cycles;
+}
+
+template <class Variant>
+s32 BasicCPU<Variant>::PLP(s32 cycles, Memory& memory)
+{
+	PopStatus(cycles, memory);
+	cycles -= 2;
+	return cycles;
+}
+
+template <class Variant>
+s32 BasicCPU<Variant>::JMP_ABS(s32 cycles, Memory& memory)
+{
+	Word Address = AddrMode_ABS(cycles, memory);
+	registers.PC = Address;
+	return cycles;
+}
+
+template <class Variant>
+s32 BasicCPU<Variant>::JMP_IND(s32 cycles, Memory& memory)
+{
+	Word Address = AddrMode_ABS(cycles, memory);
+	Byte LoByte = ReadByte(cycles, Address, memory);
+	Byte HiByte;
+	if constexpr (Variant::HasJMPIndirectBug)
+	{
+		// NMOS bug: a pointer at $xxFF takes its high byte from $xx00
+		HiByte = ReadByte(cycles, (Address & 0xFF00) | ((Address + 1) & 0x00FF), memory);
+	}
+	else
+	{
+		HiByte = ReadByte(cycles, Address + 1, memory);
+	}
+	if constexpr (Variant::HasCMOSTiming)
+	{
+		cycles--;
+	}
+	registers.PC = LoByte | (HiByte << 8);
+	return cycles;
+}
+
+template <class Variant>
+s32 BasicCPU<Variant>::JSR(s32 cycles, Memory& memory)
+{
+	Word SubAddress = FetchWord(cycles, memory);
+	PushPCMinusOne(cycles, memory);
+	registers.PC = SubAddress;
+	cycles--;
+	return cycles;
+}
+
+template <class Variant>
+s32 BasicCPU<Variant>::RTS(s32 cycles, Memory& memory)
+{
+	Word ReturnAddress = PopWord(cycles, memory);
+	registers.PC = ReturnAddress + 1;
+	cycles -= 3;
+	return cycles;
+}
+
+template <class Variant>
+s32 BasicCPU<Variant>::BRK(s32 cycles, Memory& memory)
+{
+	// the byte after BRK is padding, the return address skips it
+	PushPCPlusOne(cycles, memory);
+	PushStatus(cycles, memory);
+	registers.PC = ReadWord(cycles, 0xFFFE, memory);
+	status.I = true;
+	if constexpr (Variant::BRKClearsDecimal)
+	{
+		status.D = false;
+	}
+	cycles--;
+	return cycles;
+}
+
+template <class Variant>
+s32 BasicCPU<Variant>::RTI(s32 cycles, Memory& memory)
+{
+	PopStatus(cycles, memory);
+	registers.PC = PopWord(cycles, memory);
+	cycles -= 2;
+	return cycles;
+}
+
+template <class Variant>
+s32 BasicCPU<Variant>::BRA(s32 cycles, Memory& memory)
+{
+	BranchIf(cycles, true, memory);
+	return cycles;
+}
+
+template <class Variant>
+s32 BasicCPU<Variant>::NOP(s32 cycles, Memory& /*memory*/)
+{
+	cycles--;
+	return cycles;
+}
+
+template <class Variant>
+s32 BasicCPU<Variant>::Unknown(s32 cycles, Memory& memory)
+{
+	// skip the operands and charge the documented cycle count so
+	// that the instruction stream and timing stay in step
+	const Byte Instruction = memory.read(registers.PC - 1);
+	const OpcodeInfo& Info = Variant::HasCMOSInstructions ? Opcodes65C02[Instruction] : Opcodes[Instruction];
+	registers.PC += Info.Length - 1;
+	cycles -= Info.Cycles - 1;
+	UnknownInstructions++;
+	if (verbose)
+		std::cout << "Error: Unknown instruction: " << std::hex << (int)Instruction << " (" << Info.Mnemonic << ")" << std::dec << std::endl;
+	return cycles;
+}
+
+template <class Variant>
+constexpr typename BasicCPU<Variant>::DispatchTable BasicCPU<Variant>::MakeDispatchTable()
+{
+	using B = CPUBase;
+	using R = Registers;
+	using T = BasicCPU;
+	DispatchTable Table = {};
+	for (u32 i = 0; i < 256; i++)
+	{
+		Table.Handlers[i] = &T::Unknown;
+	}
+	Handler* H = Table.Handlers;
+
+	// the 65C02 fixed the dummy cycle of shifts and rotates with abs,X that do not cross a page
+	constexpr AddrMode ShiftABSX = Variant::HasCMOSTiming ? &B::AddrMode_ABSX : &B::AddrMode_ABSX5;
+
+	// load/store
+	H[INS_LDA_IM] = &T::Load<&R::A, &B::AddrMode_IM>;
+	H[INS_LDA_ZP] = &T::Load<&R::A, &B::AddrMode_ZP>;
+	H[INS_LDA_ZPX] = &T::Load<&R::A, &B::AddrMode_ZPX>;
+	H[INS_LDA_ABS] = &T::Load<&R::A, &B::AddrMode_ABS>;
+	H[INS_LDA_ABSX] = &T::Load<&R::A, &B::AddrMode_ABSX>;
+	H[INS_LDA_ABSY] = &T::Load<&R::A, &B::AddrMode_ABSY>;
+	H[INS_LDA_INDX] = &T::Load<&R::A, &B::AddrMode_INDX>;
+	H[INS_LDA_INDY] = &T::Load<&R::A, &B::AddrMode_INDY>;
+
+	H[INS_LDX_IM] = &T::Load<&R::X, &B::AddrMode_IM>;
+	H[INS_LDX_ZP] = &T::Load<&R::X, &B::AddrMode_ZP>;
+	H[INS_LDX_ZPY] = &T::Load<&R::X, &B::AddrMode_ZPY>;
+	H[INS_LDX_ABS] = &T::Load<&R::X, &B::AddrMode_ABS>;
+	H[INS_LDX_ABSY] = &T::Load<&R::X, &B::AddrMode_ABSY>;
+
+	H[INS_LDY_IM] = &T::Load<&R::Y, &B::AddrMode_IM>;
+	H[INS_LDY_ZP] = &T::Load<&R::Y, &B::AddrMode_ZP>;
+	H[INS_LDY_ZPX] = &T::Load<&R::Y, &B::AddrMode_ZPX>;
+	H[INS_LDY_ABS] = &T::Load<&R::Y, &B::AddrMode_ABS>;
+	H[INS_LDY_ABSX] = &T::Load<&R::Y, &B::AddrMode_ABSX>;
+
+	H[INS_STA_ZP] = &T::Store<&R::A, &B::AddrMode_ZP>;
+	H[INS_STA_ZPX] = &T::Store<&R::A, &B::AddrMode_ZPX>;
+	H[INS_STA_ABS] = &T::Store<&R::A, &B::AddrMode_ABS>;
+	H[INS_STA_ABSX] = &T::Store<&R::A, &B::AddrMode_ABSX5>;
+	H[INS_STA_ABSY] = &T::Store<&R::A, &B::AddrMode_ABSY5>;
+	H[INS_STA_INDX] = &T::Store<&R::A, &B::AddrMode_INDX>;
+	H[INS_STA_INDY] = &T::Store<&R::A, &B::AddrMode_INDY6>;
+
+	H[INS_STX_ZP] = &T::Store<&R::X, &B::AddrMode_ZP>;
+	H[INS_STX_ZPY] = &T::Store<&R::X, &B::AddrMode_ZPY>;
+	H[INS_STX_ABS] = &T::Store<&R::X, &B::AddrMode_ABS>;
+
+	H[INS_STY_ZP] = &T::Store<&R::Y, &B::AddrMode_ZP>;
+	H[INS_STY_ZPX] = &T::Store<&R::Y, &B::AddrMode_ZPX>;
+	H[INS_STY_ABS] = &T::Store<&R::Y, &B::AddrMode_ABS>;
+
+	// stack
+	H[INS_TSX] = &T::Transfer<&R::SP, &R::X>;
+	H[INS_TXS] = &T::TXS;
+	H[INS_PHA] = &T::Push<&R::A>;
+	H[INS_PLA] = &T::Pull<&R::A>;
+	H[INS_PHP] = &T::PHP;
+	H[INS_PLP] = &T::PLP;
+
+	// jumps and calls
+	H[INS_JMP_ABS] = &T::JMP_ABS;
+	H[INS_JMP_IND] = &T::JMP_IND;
+	H[INS_JSR] = &T::JSR;
+	H[INS_RTS] = &T::RTS;
+
+	// logical
+	H[INS_AND_IM] = &T::AND<&B::AddrMode_IM>;
+	H[INS_AND_ZP] = &T::AND<&B::AddrMode_ZP>;
+	H[INS_AND_ZPX] = &T::AND<&B::AddrMode_ZPX>;
+	H[INS_AND_ABS] = &T::AND<&B::AddrMode_ABS>;
+	H[INS_AND_ABSX] = &T::AND<&B::AddrMode_ABSX>;
+	H[INS_AND_ABSY] = &T::AND<&B::AddrMode_ABSY>;
+	H[INS_AND_INDX] = &T::AND<&B::AddrMode_INDX>;
+	H[INS_AND_INDY] = &T::AND<&B::AddrMode_INDY>;
+
+	H[INS_ORA_IM] = &T::ORA<&B::AddrMode_IM>;
+	H[INS_ORA_ZP] = &T::ORA<&B::AddrMode_ZP>;
+	H[INS_ORA_ZPX] = &T::ORA<&B::AddrMode_ZPX>;
+	H[INS_ORA_ABS] = &T::ORA<&B::AddrMode_ABS>;
+	H[INS_ORA_ABSX] = &T::ORA<&B::AddrMode_ABSX>;
+	H[INS_ORA_ABSY] = &T::ORA<&B::AddrMode_ABSY>;
+	H[INS_ORA_INDX] = &T::ORA<&B::AddrMode_INDX>;
+	H[INS_ORA_INDY] = &T::ORA<&B::AddrMode_INDY>;
+
+	H[INS_EOR_IM] = &T::EOR<&B::AddrMode_IM>;
+	H[INS_EOR_ZP] = &T::EOR<&B::AddrMode_ZP>;
+	H[INS_EOR_ZPX] = &T::EOR<&B::AddrMode_ZPX>;
+	H[INS_EOR_ABS] = &T::EOR<&B::AddrMode_ABS>;
+	H[INS_EOR_ABSX] = &T::EOR<&B::AddrMode_ABSX>;
+	H[INS_EOR_ABSY] = &T::EOR<&B::AddrMode_ABSY>;
+	H[INS_EOR_INDX] = &T::EOR<&B::AddrMode_INDX>;
+	H[INS_EOR_INDY] = &T::EOR<&B::AddrMode_INDY>;
+
+	H[INS_BIT_ZP] = &T::BIT<&B::AddrMode_ZP>;
+	H[INS_BIT_ABS] = &T::BIT<&B::AddrMode_ABS>;
+
+	// register transfers
+	H[INS_TAX] = &T::Transfer<&R::A, &R::X>;
+	H[INS_TAY] = &T::Transfer<&R::A, &R::Y>;
+	H[INS_TXA] = &T::Transfer<&R::X, &R::A>;
+	H[INS_TYA] = &T::Transfer<&R::Y, &R::A>;
+
+	// increments and decrements
+	H[INS_INX] = &T::IncrementRegister<&R::X, 0x01>;
+	H[INS_INY] = &T::IncrementRegister<&R::Y, 0x01>;
+	H[INS_DEX] = &T::IncrementRegister<&R::X, 0xFF>;
+	H[INS_DEY] = &T::IncrementRegister<&R::Y, 0xFF>;
+	H[INS_INC_ZP] = &T::IncrementMemory<&B::AddrMode_ZP, 0x01>;
+	H[INS_INC_ZPX] = &T::IncrementMemory<&B::AddrMode_ZPX, 0x01>;
+	H[INS_INC_ABS] = &T::IncrementMemory<&B::AddrMode_ABS, 0x01>;
+	H[INS_INC_ABSX] = &T::IncrementMemory<&B::AddrMode_ABSX5, 0x01>;
+	H[INS_DEC_ZP] = &T::IncrementMemory<&B::AddrMode_ZP, 0xFF>;
+	H[INS_DEC_ZPX] = &T::IncrementMemory<&B::AddrMode_ZPX, 0xFF>;
+	H[INS_DEC_ABS] = &T::IncrementMemory<&B::AddrMode_ABS, 0xFF>;
+	H[INS_DEC_ABSX] = &T::IncrementMemory<&B::AddrMode_ABSX5, 0xFF>;
+
+	// branches
+	H[INS_BEQ] = &T::Branch<ZeroFlagBit, true>;
+	H[INS_BNE] = &T::Branch<ZeroFlagBit, false>;
+	H[INS_BCS] = &T::Branch<CarryFlagBit, true>;
+	H[INS_BCC] = &T::Branch<CarryFlagBit, false>;
+	H[INS_BMI] = &T::Branch<NegativeFlagBit, true>;
+	H[INS_BPL] = &T::Branch<NegativeFlagBit, false>;
+	H[INS_BVS] = &T::Branch<OverflowFlagBit, true>;
+	H[INS_BVC] = &T::Branch<OverflowFlagBit, false>;
+
+	// status flag changes
+	H[INS_CLC] = &T::SetFlag<CarryFlagBit, false>;
+	H[INS_SEC] = &T::SetFlag<CarryFlagBit, true>;
+	H[INS_CLD] = &T::SetFlag<DecimalFlagBit, false>;
+	H[INS_SED] = &T::SetFlag<DecimalFlagBit, true>;
+	H[INS_CLI] = &T::SetFlag<InterruptDisableFlagBit, false>;
+	H[INS_SEI] = &T::SetFlag<InterruptDisableFlagBit, true>;
+	H[INS_CLV] = &T::SetFlag<OverflowFlagBit, false>;
+
+	// arithmetic
+	H[INS_ADC] = &T::ADC<&B::AddrMode_IM>;
+	H[INS_ADC_ZP] = &T::ADC<&B::AddrMode_ZP>;
+	H[INS_ADC_ZPX] = &T::ADC<&B::AddrMode_ZPX>;
+	H[INS_ADC_ABS] = &T::ADC<&B::AddrMode_ABS>;
+	H[INS_ADC_ABSX] = &T::ADC<&B::AddrMode_ABSX>;
+	H[INS_ADC_ABSY] = &T::ADC<&B::AddrMode_ABSY>;
+	H[INS_ADC_INDX] = &T::ADC<&B::AddrMode_INDX>;
+	H[INS_ADC_INDY] = &T::ADC<&B::AddrMode_INDY>;
+
+	H[INS_SBC] = &T::SBC<&B::AddrMode_IM>;
+	H[INS_SBC_ZP] = &T::SBC<&B::AddrMode_ZP>;
+	H[INS_SBC_ZPX] = &T::SBC<&B::AddrMode_ZPX>;
+	H[INS_SBC_ABS] = &T::SBC<&B::AddrMode_ABS>;
+	H[INS_SBC_ABSX] = &T::SBC<&B::AddrMode_ABSX>;
+	H[INS_SBC_ABSY] = &T::SBC<&B::AddrMode_ABSY>;
+	H[INS_SBC_INDX] = &T::SBC<&B::AddrMode_INDX>;
+	H[INS_SBC_INDY] = &T::SBC<&B::AddrMode_INDY>;
+
+	H[INS_CMP] = &T::Compare<&R::A, &B::AddrMode_IM>;
+	H[INS_CMP_ZP] = &T::Compare<&R::A, &B::AddrMode_ZP>;
+	H[INS_CMP_ZPX] = &T::Compare<&R::A, &B::AddrMode_ZPX>;
+	H[INS_CMP_ABS] = &T::Compare<&R::A, &B::AddrMode_ABS>;
+	H[INS_CMP_ABSX] = &T::Compare<&R::A, &B::AddrMode_ABSX>;
+	H[INS_CMP_ABSY] = &T::Compare<&R::A, &B::AddrMode_ABSY>;
+	H[INS_CMP_INDX] = &T::Compare<&R::A, &B::AddrMode_INDX>;
+	H[INS_CMP_INDY] = &T::Compare<&R::A, &B::AddrMode_INDY>;
+
+	H[INS_CPX] = &T::Compare<&R::X, &B::AddrMode_IM>;
+	H[INS_CPX_ZP] = &T::Compare<&R::X, &B::AddrMode_ZP>;
+	H[INS_CPX_ABS] = &T::Compare<&R::X, &B::AddrMode_ABS>;
+	H[INS_CPY] = &T::Compare<&R::Y, &B::AddrMode_IM>;
+	H[INS_CPY_ZP] = &T::Compare<&R::Y, &B::AddrMode_ZP>;
+	H[INS_CPY_ABS] = &T::Compare<&R::Y, &B::AddrMode_ABS>;
+
+	// shifts and rotates
+	H[INS_ASL] = &T::ShiftAccumulator<&T::ASL>;
+	H[INS_ASL_ZP] = &T::ShiftMemory<&T::ASL, &B::AddrMode_ZP>;
+	H[INS_ASL_ZPX] = &T::ShiftMemory<&T::ASL, &B::AddrMode_ZPX>;
+	H[INS_ASL_ABS] = &T::ShiftMemory<&T::ASL, &B::AddrMode_ABS>;
+	H[INS_ASL_ABSX] = &T::ShiftMemory<&T::ASL, ShiftABSX>;
+
+	H[INS_LSR] = &T::ShiftAccumulator<&T::LSR>;
+	H[INS_LSR_ZP] = &T::ShiftMemory<&T::LSR, &B::AddrMode_ZP>;
+	H[INS_LSR_ZPX] = &T::ShiftMemory<&T::LSR, &B::AddrMode_ZPX>;
+	H[INS_LSR_ABS] = &T::ShiftMemory<&T::LSR, &B::AddrMode_ABS>;
+	H[INS_LSR_ABSX] = &T::ShiftMemory<&T::LSR, ShiftABSX>;
+
+	H[INS_ROL] = &T::ShiftAccumulator<&T::ROL>;
+	H[INS_ROL_ZP] = &T::ShiftMemory<&T::ROL, &B::AddrMode_ZP>;
+	H[INS_ROL_ZPX] = &T::ShiftMemory<&T::ROL, &B::AddrMode_ZPX>;
+	H[INS_ROL_ABS] = &T::ShiftMemory<&T::ROL, &B::AddrMode_ABS>;
+	H[INS_ROL_ABSX] = &T::ShiftMemory<&T::ROL, ShiftABSX>;
+
+	H[INS_ROR] = &T::ShiftAccumulator<&T::ROR>;
+	H[INS_ROR_ZP] = &T::ShiftMemory<&T::ROR, &B::AddrMode_ZP>;
+	H[INS_ROR_ZPX] = &T::ShiftMemory<&T::ROR, &B::AddrMode_ZPX>;
+	H[INS_ROR_ABS] = &T::ShiftMemory<&T::ROR, &B::AddrMode_ABS>;
+	H[INS_ROR_ABSX] = &T::ShiftMemory<&T::ROR, ShiftABSX>;
+
+	// misc
+	H[INS_NOP] = &T::NOP;
+	H[INS_BRK] = &T::BRK;
+	H[INS_RTI] = &T::RTI;
+
+	if constexpr (Variant::HasCMOSInstructions)
+	{
+		H[INS_BRA] = &T::BRA;
+
+		H[INS_STZ_ZP] = &T::StoreZero<&B::AddrMode_ZP>;
+		H[INS_STZ_ZPX] = &T::StoreZero<&B::AddrMode_ZPX>;
+		H[INS_STZ_ABS] = &T::StoreZero<&B::AddrMode_ABS>;
+		H[INS_STZ_ABSX] = &T::StoreZero<&B::AddrMode_ABSX5>;
+
+		H[INS_PHX] = &T::Push<&R::X>;
+		H[INS_PLX] = &T::Pull<&R::X>;
+		H[INS_PHY] = &T::Push<&R::Y>;
+		H[INS_PLY] = &T::Pull<&R::Y>;
+
+		H[INS_ORA_ZPI] = &T::ORA<&B::AddrMode_ZPI>;
+		H[INS_AND_ZPI] = &T::AND<&B::AddrMode_ZPI>;
+		H[INS_EOR_ZPI] = &T::EOR<&B::AddrMode_ZPI>;
+		H[INS_ADC_ZPI] = &T::ADC<&B::AddrMode_ZPI>;
+		H[INS_STA_ZPI] = &T::Store<&R::A, &B::AddrMode_ZPI>;
+		H[INS_LDA_ZPI] = &T::Load<&R::A, &B::AddrMode_ZPI>;
+		H[INS_CMP_ZPI] = &T::Compare<&R::A, &B::AddrMode_ZPI>;
+		H[INS_SBC_ZPI] = &T::SBC<&B::AddrMode_ZPI>;
+	}
+	return Table;
+}
+
+// one switch case per opcode, calling the handler from the constant dispatch table
+#define DISPATCH_CASE(Opcode) case Opcode: cycles = (this->*Dispatch.Handlers[Opcode])(cycles, memory); break;
+#define DISPATCH_CASES_16(Base) \
+	DISPATCH_CASE(Base + 0x0) DISPATCH_CASE(Base + 0x1) DISPATCH_CASE(Base + 0x2) DISPATCH_CASE(Base + 0x3) \
+	DISPATCH_CASE(Base + 0x4) DISPATCH_CASE(Base + 0x5) DISPATCH_CASE(Base + 0x6) DISPATCH_CASE(Base + 0x7) \
+	DISPATCH_CASE(Base + 0x8) DISPATCH_CASE(Base + 0x9) DISPATCH_CASE(Base + 0xA) DISPATCH_CASE(Base + 0xB) \
+	DISPATCH_CASE(Base + 0xC) DISPATCH_CASE(Base + 0xD) DISPATCH_CASE(Base + 0xE) DISPATCH_CASE(Base + 0xF)
+
+template <class Variant>
+s32 BasicCPU<Variant>::execute(s32 cycles, Memory& memory)
+{
+	// the table is a constant, so every case below is a direct call that the compiler can inline
+	// into the switch, and the switch gives each opcode its own indirect branch history
+	static constexpr DispatchTable Dispatch = MakeDispatchTable();
+
+	const s32 CyclesRequested = cycles;
+	cycleBase = TotalCycles + CyclesRequested;
+	zeroPage = devices[0x00] ? nullptr : memory.writable[0x00];
+	stackPage = devices[0x01] ? nullptr : memory.writable[0x01];
+	u64 NumInstructions = 0;
+	while (cycles > 0)
+	{
+		NumInstructions++;
+		if (tracer)
+		{
+			tracer->record(*this, memory, currentCycle(cycles));
+		}
+		if (coverage)
+		{
+			const Word Location = registers.PC;
+			coverage[Location ^ coveragePrevious]++;
+			coveragePrevious = Location >> 1;
+		}
+		if (profiler)
+		{
+			profiler->beginInstruction(memory.read(registers.PC), cycles);
+		}
+
+		Byte Instruction = FetchByte(cycles, memory);
+		switch (Instruction)
+		{
+			DISPATCH_CASES_16(0x00) DISPATCH_CASES_16(0x10) DISPATCH_CASES_16(0x20) DISPATCH_CASES_16(0x30)
+			DISPATCH_CASES_16(0x40) DISPATCH_CASES_16(0x50) DISPATCH_CASES_16(0x60) DISPATCH_CASES_16(0x70)
+			DISPATCH_CASES_16(0x80) DISPATCH_CASES_16(0x90) DISPATCH_CASES_16(0xA0) DISPATCH_CASES_16(0xB0)
+			DISPATCH_CASES_16(0xC0) DISPATCH_CASES_16(0xD0) DISPATCH_CASES_16(0xE0) DISPATCH_CASES_16(0xF0)
+		}
+
+		if (profiler)
+		{
+			profiler->endInstruction(cycles);
+		}
+	}
+
+	const s32 NumCyclesUsed = CyclesRequested - cycles;
+	TotalCycles += NumCyclesUsed;
+	TotalInstructions += NumInstructions;
+	return NumCyclesUsed;
+}
+
+template class BasicCPU<NMOS6502>;
+template class BasicCPU<WDC65C02>;
+template class BasicCPU<Ricoh2A03>;
@@ -1,37 +1,37 @@
 /**
 * Class name: CPU
-* Purpose: Implement a 6502 CPU
+* Purpose: Implement a 6502 CPU. CPUCore holds the state every instruction touches, CPUBase the
+*          rest of the machine state and the variant independent helpers, BasicCPU<Variant> adds
+*          the instruction set of one chip (see the variant traits below) and CPU is the NMOS 6502.
+*          Memory is owned by the caller and passed to every call that needs it.
 **/
 #pragma once
+#include <memory>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <string.h>
+#include "MemoryArena.h"
+#include "Types.h"
 
-using SByte = char;
-using Byte = unsigned char;
-using Word = unsigned short;
+class Tracer;
+class IODevice;
+class PerfCounters;
 
-using u32 = unsigned int;
-using s32 = int;
-
-class CPU
+/**
+* CPU Registers:
+*	- 8-bit Accumulator (A)
+*	- 8-bit X Register (X)
+*	- 8-bit Y Register (Y)
+*	- 8-bit Stack Pointer (S)
+*	- 16-bit Program Counter (PC)
+*	- 8-bit Status Register (P)
+*
+* The registers, counters and page pointers used on every instruction share one cache line,
+* ahead of the device map, coverage and tracer state of CPUBase that most instructions never read.
+**/
+struct alignas(64) CPUCore
 {
-	/**
-	* CPU Registers:
-	*	- 8-bit Accumulator (A)
-	*	- 8-bit X Register (X)
-	*	- 8-bit Y Register (Y)
-	*	- 8-bit Stack Pointer (S)
-	*	- 16-bit Program Counter (PC)
-	*	- 8-bit Status Register (P)
-	**/
-public:
-	// constructor
-	CPU();
-	
-	// destructor
-	~CPU();
-
 	struct StatusFlags
 	{
 		Byte C : 1; // Carry Flag
@@ -63,47 +63,112 @@ public:
 		Byte PS;
 		StatusFlags status;
 	};
+
+	// total number of cycles executed since the last reset
+	u64 TotalCycles;
+
+	// total number of instructions executed since the last reset
+	u64 TotalInstructions;
+
+	// TotalCycles plus the budget of the execute in progress, see CPUBase::currentCycle
+	u64 cycleBase;
+
+	// RAM of the zero page and of the stack page, bound by execute, or nullptr where the page
+	// is ROM or has a device and accesses must take the general path
+	Byte* zeroPage;
+	Byte* stackPage;
+};
+
+static_assert(sizeof(CPUCore) == 64, "CPUCore must fill exactly one cache line");
+
+class CPUBase : public CPUCore
+{
+public:
+	// constructor
+	CPUBase();
 	
+	// destructor
+	~CPUBase();
+
+	// The 64KB address space as 256 pages, each backed by RAM from a MemoryArena or by a shared
+	// ROMImage. Writes to ROM pages are ignored.
 	struct Memory {
 		static constexpr u32 MAX_MEM = 1024 * 64;
-		unsigned char data[MAX_MEM];
+		static constexpr u32 PAGE_SIZE = MemoryArena::PageSize;
+		static constexpr u32 PAGES = MAX_MEM / PAGE_SIZE;
 
-		void init() {
-			for (u32 i = 0; i < MAX_MEM; i++) {
-				data[i] = 0x00;
-			}
-		}
+		// all of the address space in RAM from the shared arena
+		Memory();
+
+		// RAM from arena for every page rom, if any, does not cover
+		explicit Memory(MemoryArena& arena, std::shared_ptr<const ROMImage> rom = nullptr);
+
+		// destructor, gives the RAM back to the arena
+		~Memory();
+
+		Memory(const Memory&) = delete;
+		Memory& operator=(const Memory&) = delete;
+
+		// data of each page
+		const Byte* pages[PAGES];
+
+		// data of each RAM page, nullptr for ROM pages
+		Byte* writable[PAGES];
+
+		// hash of the address space, kept up to date by write (see StateHash.h)
+		u64 hash;
+
+		// RAM pages in address order, contiguous; the whole address space when there is no ROM
+		Byte* ram;
+		u32 ramPages;
+
+		// ram when it is the whole address space, or nullptr. Reads index it directly, which
+		// spares the page table lookup on every fetch of a machine without ROM
+		const Byte* flat;
+
+		// mapped ROM, or nullptr
+		std::shared_ptr<const ROMImage> rom;
+
+		// clear RAM
+		void init();
 
 		// read 1 byte
-		unsigned char read(Byte address) {
-			return data[address];
+		Byte read(Word address) const {
+			return flat ? flat[address] : pages[address >> 8][address & 0xFF];
 		}
 
 		// write 1 byte
 		void write(Word address, Byte data) {
-			this->data[address] = data;
-		}
-	};
-
-	struct EEPROM {
-		static constexpr u32 MAX_MEM = 1024 * 64;
-		unsigned char data[MAX_MEM];
-
-		void init() {
-			for (u32 i = 0; i < MAX_MEM; i++) {
-				data[i] = 0x00;
+			Byte* Page = writable[address >> 8];
+			if (Page == nullptr)
+			{
+				return;
 			}
+			writeRAM(Page[address & 0xFF], address, data);
 		}
 
-		// read 1 byte
-		unsigned char read(Byte address) {
-			return data[address];
+		// write 1 byte to cell, the RAM behind address, for callers that already hold the page
+		void writeRAM(Byte& cell, Word address, Byte data) {
+			hash += hashKey(address) * (u64)((s32)data - (s32)cell);
+			cell = data;
 		}
 
-		// write 1 byte
-		void write(Word address, Byte data) {
-			this->data[address] = data;
+		// write length bytes of data to cells, the RAM behind address, within one page. data may
+		// overlap cells, the result is that of memmove
+		void writeRAM(Byte* cells, Word address, const Byte* data, u32 length);
+
+		// write length copies of data to cells, the RAM behind address, within one page
+		void fillRAM(Byte* cells, Word address, Byte data, u32 length);
+
+		// multiplier for the byte at address in the memory hash
+		static u64 hashKey(Word address) {
+			u64 key = address * 0x9E3779B97F4A7C15ull + 0x632BE59BD9B4E019ull;
+			key = (key ^ (key >> 32)) * 0xD6E8FEB86659FD93ull;
+			return key ^ (key >> 32);
 		}
+
+	private:
+		MemoryArena& arena;
 	};
 
 	// Process status bits
@@ -113,7 +178,10 @@ public:
 		BreakFlagBit = 0b000010000,
 		UnusedFlagBit = 0b000100000,
 		InterruptDisableFlagBit = 0b000000100,
-		ZeroBit = 0b00000001;
+		ZeroBit = 0b00000001,
+		CarryFlagBit = 0b00000001,
+		ZeroFlagBit = 0b00000010,
+		DecimalFlagBit = 0b00001000;
 
 	// 6502 opcodes
 	static constexpr Byte
@@ -307,10 +375,88 @@ public:
 		INS_NOP = 0xEA,
 		INS_BRK = 0x00,
 		INS_RTI = 0x40;
-	
-	// memory
-	EEPROM eeprom;
-	Memory memory;
+
+	// 65C02 opcodes, only dispatched when the variant has HasCMOSInstructions
+	static constexpr Byte
+		INS_BRA = 0x80,
+
+		INS_STZ_ZP = 0x64,
+		INS_STZ_ZPX = 0x74,
+		INS_STZ_ABS = 0x9C,
+		INS_STZ_ABSX = 0x9E,
+
+		INS_PHX = 0xDA,
+		INS_PLX = 0xFA,
+		INS_PHY = 0x5A,
+		INS_PLY = 0x7A,
+
+		INS_ORA_ZPI = 0x12,
+		INS_AND_ZPI = 0x32,
+		INS_EOR_ZPI = 0x52,
+		INS_ADC_ZPI = 0x72,
+		INS_STA_ZPI = 0x92,
+		INS_LDA_ZPI = 0xB2,
+		INS_CMP_ZPI = 0xD2,
+		INS_SBC_ZPI = 0xF2;
+
+	// instruction tracer, or nullptr when tracing is disabled
+	Tracer* tracer;
+
+	// host performance counters charged per instruction to its opcode class, or nullptr when
+	// profiling is disabled (see PerfCounters.h)
+	PerfCounters* profiler;
+
+	// size of an edge coverage map
+	static constexpr u32 CoverageMapSize = 1 << 16;
+
+	// edge coverage map of CoverageMapSize hit counters indexed by previous PC -> PC,
+	// or nullptr when coverage is disabled
+	Byte* coverage;
+
+	// previous PC, pre-shifted, for edge coverage
+	Word coveragePrevious;
+
+	// report errors such as unknown instructions on the console
+	bool verbose;
+
+	// number of unknown instructions executed since the last reset
+	u64 UnknownInstructions;
+
+	// memory-mapped device of each page, or nullptr where the page is plain memory.
+	// data accesses through ReadByte and WriteByte go to the device, instruction fetches do not
+	IODevice* devices[256];
+
+	// cycle count since the last reset at the current point of execute, given its remaining cycles
+	u64 currentCycle(s32 cycles) const { return cycleBase - cycles; }
+
+	// cycles the device being accessed has stalled the CPU for, see stall
+	u32 pendingStall;
+
+	// stall the CPU for cycles from within a device access, e.g. for a DMA transfer. ReadByte and
+	// WriteByte charge them to the execute in progress once the device returns
+	void stall(u32 cycles) { pendingStall += cycles; }
+
+	// map device over the pages containing first..last, or unmap them with nullptr
+	void mapDevice(IODevice* device, Word first, Word last);
+
+	// complete machine state, for restoring without a reset
+	struct Snapshot
+	{
+		Registers registers;
+		Byte PS;
+		u64 TotalCycles;
+		u64 TotalInstructions;
+		u64 UnknownInstructions;
+		// contents of the address space and its hash
+		Byte memory[Memory::MAX_MEM];
+		u64 memoryHash;
+	};
+
+	// save the machine state into snapshot
+	void saveSnapshot(Snapshot& snapshot, const Memory& memory) const;
+
+	// restore the machine state from snapshot
+	void restoreSnapshot(const Snapshot& snapshot, Memory& memory);
 
 	// fetch byte from memory
 	Byte FetchByte(s32& cycles, Memory& memory);
@@ -327,6 +473,15 @@ public:
 	// read word from memory
 	Word ReadWord(s32& cycles, Word address, Memory& memory);
 	
+	// read byte offset of the zero page. The offset is a Byte, so the access cannot leave the page
+	Byte ReadZeroPage(s32& cycles, Byte offset, Memory& memory);
+
+	// write byte offset of the zero page
+	void WriteZeroPage(s32& cycles, Byte offset, Byte value, Memory& memory);
+
+	// read word from the zero page, wrapping within it
+	Word ReadZeroPageWord(s32& cycles, Byte address, Memory& memory);
+
 	// write 1 byte to memory
 	void WriteByte(s32& cycles, Word address, Byte value, Memory& memory);
 
@@ -334,7 +489,11 @@ public:
 	void WriteWord(s32& cycles, Word address, Word value, Memory& memory);
 
 	// return the stack pointer as a full 16-bit address (in the 1st page)
-	Word SPToAddress();
+	Word SPToAddress() const { return 0x0100 | registers.SP; }
+
+	// read and write byte offset of the stack page, like the zero page accesses
+	Byte ReadStack(s32& cycles, Byte offset, Memory& memory);
+	void WriteStack(s32& cycles, Byte offset, Byte value, Memory& memory);
 	
 	// push word to stack
 	void PushWord(s32& cycles, Word value, Memory& memory);
@@ -369,14 +528,14 @@ public:
 	// reset CPU with reset vector
 	void reset(Word ResetVector, Memory& memory);
 	
-	// load ROM file
-	void loadROM(std::string path, Memory& memory);
+	// load ROM file at $0000, returning false if it could not be opened
+	bool loadROM(std::string path, Memory& memory);
 	
 	// print status
 	void printStatus() const;
 
-	// execute 1 instruction, returning the number of cycles that were used
-	s32 execute(s32 cycles, Memory& memory);
+	// Addressing mode - Immediate, the operand is the byte at PC
+	Word AddrMode_IM(s32& cycles, Memory& memory);
 
 	// Addressing mode - Zero page
 	Word AddrMode_ZP(s32& cycles, Memory& memory);
@@ -410,5 +569,146 @@ public:
 
 	// Addressing mode - Indirect, Y 6
 	Word AddrMode_INDY6(s32& cycles, Memory& memory);
+
+	// Addressing mode - Zero page indirect (65C02)
+	Word AddrMode_ZPI(s32& cycles, Memory& memory);
+};
+
+/**
+* CPU variants. Each trait is a set of compile time switches that BasicCPU uses to build its
+* dispatch table and specialise its handlers, so the interpreter never tests the variant at runtime.
+**/
+
+// original NMOS 6502
+struct NMOS6502
+{
+	static constexpr const char* Name = "6502";
+	// ADC and SBC honour the D flag
+	static constexpr bool HasDecimalMode = true;
+	// JMP ($xxFF) takes the high byte of the target from $xx00
+	static constexpr bool HasJMPIndirectBug = true;
+	// BRA, STZ, PHX/PLX/PHY/PLY and (zp) addressing
+	static constexpr bool HasCMOSInstructions = false;
+	// extra cycle for decimal ADC/SBC and JMP (ind), no fixed penalty on shifts with abs,X
+	static constexpr bool HasCMOSTiming = false;
+	// BRK clears the D flag
+	static constexpr bool BRKClearsDecimal = false;
 };
 
+// WDC/Rockwell 65C02
+struct WDC65C02
+{
+	static constexpr const char* Name = "65C02";
+	static constexpr bool HasDecimalMode = true;
+	static constexpr bool HasJMPIndirectBug = false;
+	static constexpr bool HasCMOSInstructions = true;
+	static constexpr bool HasCMOSTiming = true;
+	static constexpr bool BRKClearsDecimal = true;
+};
+
+// Ricoh 2A03 (NES), an NMOS 6502 with the decimal adder removed
+struct Ricoh2A03
+{
+	static constexpr const char* Name = "2A03";
+	static constexpr bool HasDecimalMode = false;
+	static constexpr bool HasJMPIndirectBug = true;
+	static constexpr bool HasCMOSInstructions = false;
+	static constexpr bool HasCMOSTiming = false;
+	static constexpr bool BRKClearsDecimal = false;
+};
+
+template <class Variant>
+class BasicCPU : public CPUBase
+{
+public:
+	using VariantType = Variant;
+
+	// execute instructions until cycles have been used, returning the number of cycles that were used
+	s32 execute(s32 cycles, Memory& memory);
+
+private:
+	// addressing mode, fetching the operands and returning the effective address
+	using AddrMode = Word (CPUBase::*)(s32& cycles, Memory& memory);
+
+	// register operand of a handler
+	using Register = Byte Registers::*;
+
+	// shift or rotate of an operand
+	using ShiftOperation = Byte (BasicCPU::*)(s32& cycles, Byte operand);
+
+	// instruction handler, called after the opcode has been fetched. The cycle budget is passed
+	// and returned by value so that it stays in a register across the handler
+	using Handler = s32 (BasicCPU::*)(s32 cycles, Memory& memory);
+
+	struct DispatchTable
+	{
+		Handler Handlers[256];
+	};
+
+	// build the dispatch table for Variant from the INS_* opcodes
+	static constexpr DispatchTable MakeDispatchTable();
+
+	// whether every effective address of Mode is in the zero page
+	template <AddrMode Mode>
+	static constexpr bool IsZeroPageMode = Mode == &CPUBase::AddrMode_ZP || Mode == &CPUBase::AddrMode_ZPX
+		|| Mode == &CPUBase::AddrMode_ZPY;
+
+	// read and write the operand at the effective address of Mode, through the zero page
+	// accesses when the mode cannot leave it
+	template <AddrMode Mode> Byte ReadOperand(s32& cycles, Word address, Memory& memory);
+	template <AddrMode Mode> void WriteOperand(s32& cycles, Word address, Byte value, Memory& memory);
+
+	// operations shared by several handlers
+	Byte ASL(s32& cycles, Byte operand);
+	Byte LSR(s32& cycles, Byte operand);
+	Byte ROL(s32& cycles, Byte operand);
+	Byte ROR(s32& cycles, Byte operand);
+	void AddWithCarry(s32& cycles, Byte operand);
+	void SubtractWithCarry(s32& cycles, Byte operand);
+	void BranchIf(s32& cycles, bool condition, Memory& memory);
+	void PushStatus(s32& cycles, Memory& memory);
+	void PopStatus(s32& cycles, Memory& memory);
+
+	// handlers
+	template <Register Reg, AddrMode Mode> s32 Load(s32 cycles, Memory& memory);
+	template <Register Reg, AddrMode Mode> s32 Store(s32 cycles, Memory& memory);
+	template <AddrMode Mode> s32 StoreZero(s32 cycles, Memory& memory);
+	template <Register From, Register To> s32 Transfer(s32 cycles, Memory& memory);
+	template <Register Reg, Byte Delta> s32 IncrementRegister(s32 cycles, Memory& memory);
+	template <AddrMode Mode, Byte Delta> s32 IncrementMemory(s32 cycles, Memory& memory);
+	template <AddrMode Mode> s32 AND(s32 cycles, Memory& memory);
+	template <AddrMode Mode> s32 ORA(s32 cycles, Memory& memory);
+	template <AddrMode Mode> s32 EOR(s32 cycles, Memory& memory);
+	template <AddrMode Mode> s32 BIT(s32 cycles, Memory& memory);
+	template <AddrMode Mode> s32 ADC(s32 cycles, Memory& memory);
+	template <AddrMode Mode> s32 SBC(s32 cycles, Memory& memory);
+	template <Register Reg, AddrMode Mode> s32 Compare(s32 cycles, Memory& memory);
+	template <ShiftOperation Operation> s32 ShiftAccumulator(s32 cycles, Memory& memory);
+	template <ShiftOperation Operation, AddrMode Mode> s32 ShiftMemory(s32 cycles, Memory& memory);
+	template <Byte Flag, bool Expected> s32 Branch(s32 cycles, Memory& memory);
+	template <Byte Flag, bool Value> s32 SetFlag(s32 cycles, Memory& memory);
+	template <Register Reg> s32 Push(s32 cycles, Memory& memory);
+	template <Register Reg> s32 Pull(s32 cycles, Memory& memory);
+	s32 TXS(s32 cycles, Memory& memory);
+	s32 PHP(s32 cycles, Memory& memory);
+	s32 PLP(s32 cycles, Memory& memory);
+	s32 JMP_ABS(s32 cycles, Memory& memory);
+	s32 JMP_IND(s32 cycles, Memory& memory);
+	s32 JSR(s32 cycles, Memory& memory);
+	s32 RTS(s32 cycles, Memory& memory);
+	s32 BRK(s32 cycles, Memory& memory);
+	s32 RTI(s32 cycles, Memory& memory);
+	s32 BRA(s32 cycles, Memory& memory);
+	s32 NOP(s32 cycles, Memory& memory);
+	s32 Unknown(s32 cycles, Memory& memory);
+};
+
+// instantiated in CPU.cpp
+extern template class BasicCPU<NMOS6502>;
+extern template class BasicCPU<WDC65C02>;
+extern template class BasicCPU<Ricoh2A03>;
+
+using CPU = BasicCPU<NMOS6502>;
+using CPU65C02 = BasicCPU<WDC65C02>;
+using CPU2A03 = BasicCPU<Ricoh2A03>;
+
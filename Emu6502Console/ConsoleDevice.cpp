@@ -0,0 +1,216 @@
+#include "ConsoleDevice.h"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <conio.h>
+#include <io.h>
+#else
+#include <errno.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+// write two buffers to fd as one gathered write, retrying until everything is out
+static void WriteAll(int fd, const Byte* first, u32 firstLength, const Byte* second, u32 secondLength)
+{
+#ifdef _WIN32
+	// no writev, two plain writes of large blocks are the next best thing
+	if (firstLength > 0)
+	{
+		_write(fd, first, firstLength);
+	}
+	if (secondLength > 0)
+	{
+		_write(fd, second, secondLength);
+	}
+#else
+	iovec Vectors[2] = { { (void*)first, firstLength }, { (void*)second, secondLength } };
+	iovec* Next = Vectors;
+	int Count = secondLength > 0 ? 2 : 1;
+	while (Count > 0)
+	{
+		ssize_t Written = writev(fd, Next, Count);
+		if (Written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return;
+		}
+		// skip what a short write already took care of
+		while (Count > 0 && (size_t)Written >= Next->iov_len)
+		{
+			Written -= Next->iov_len;
+			Next++;
+			Count--;
+		}
+		if (Count > 0)
+		{
+			Next->iov_base = (Byte*)Next->iov_base + Written;
+			Next->iov_len -= Written;
+		}
+	}
+#endif
+}
+
+// read up to size bytes that fd has ready, returning the count, 0 if none are ready or -1 at end of input
+static long ReadAvailable(int fd, Byte* buffer, u32 size)
+{
+#ifdef _WIN32
+	HANDLE Handle = (HANDLE)_get_osfhandle(fd);
+	DWORD Available = size;
+	switch (GetFileType(Handle))
+	{
+	case FILE_TYPE_CHAR:
+		// an interactive console, one key at a time
+		if (!_kbhit())
+		{
+			return 0;
+		}
+		buffer[0] = (Byte)_getch();
+		return 1;
+	case FILE_TYPE_PIPE:
+		if (!PeekNamedPipe(Handle, NULL, 0, NULL, &Available, NULL))
+		{
+			return -1;
+		}
+		if (Available == 0)
+		{
+			return 0;
+		}
+		break;
+	default:
+		// files never block
+		break;
+	}
+	const int Read = _read(fd, buffer, Available < size ? Available : size);
+	return Read > 0 ? Read : -1;
+#else
+	pollfd Poll = { fd, POLLIN, 0 };
+	if (poll(&Poll, 1, 0) <= 0)
+	{
+		return 0;
+	}
+	const ssize_t Read = read(fd, buffer, size);
+	if (Read < 0)
+	{
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+	}
+	return Read > 0 ? (long)Read : -1;
+#endif
+}
+
+ConsoleDevice::ConsoleDevice(Word output, Word input, Word status, CPUBase::Memory& memory, int outputFd, int inputFd)
+	: lineBuffered(true), outputAddress(output), inputAddress(input), statusAddress(status), memory(memory),
+	outputFd(outputFd), inputFd(inputFd), output(new Byte[OutputCapacity]), outputHead(0), outputTail(0),
+	input(new Byte[InputCapacity]), inputHead(0), inputTail(0), nextPoll(0), inputClosed(false)
+{
+}
+
+ConsoleDevice::~ConsoleDevice()
+{
+	flush();
+	delete[] output;
+	delete[] input;
+}
+
+void ConsoleDevice::map(CPUBase& cpu)
+{
+	cpu.mapDevice(this, outputAddress, outputAddress);
+	cpu.mapDevice(this, inputAddress, inputAddress);
+	cpu.mapDevice(this, statusAddress, statusAddress);
+}
+
+void ConsoleDevice::flush()
+{
+	if (outputHead == outputTail)
+	{
+		return;
+	}
+	// the pending bytes may wrap around the end of the ring
+	const u32 Start = (u32)(outputTail & (OutputCapacity - 1));
+	const u32 Pending = (u32)(outputHead - outputTail);
+	const u32 First = Start + Pending > OutputCapacity ? OutputCapacity - Start : Pending;
+	WriteAll(outputFd, output + Start, First, output, Pending - First);
+	outputTail = outputHead;
+}
+
+void ConsoleDevice::prefetch(u64 cycle)
+{
+	// after an empty poll wait PollInterval cycles, unless the cycle count went back with a reset
+	if (inputClosed || (cycle < nextPoll && nextPoll - cycle <= PollInterval))
+	{
+		return;
+	}
+
+	// fill the free space up to the end of the ring, the next poll takes care of the rest
+	const u32 Start = (u32)(inputHead & (InputCapacity - 1));
+	const u32 Free = InputCapacity - (u32)(inputHead - inputTail);
+	const u32 Contiguous = InputCapacity - Start;
+	const long Read = ReadAvailable(inputFd, input + Start, Free < Contiguous ? Free : Contiguous);
+	if (Read < 0)
+	{
+		inputClosed = true;
+	}
+	else if (Read == 0)
+	{
+		nextPoll = cycle + PollInterval;
+	}
+	else
+	{
+		inputHead += Read;
+	}
+}
+
+Byte ConsoleDevice::read(Word address, u64 cycle)
+{
+	if (address == statusAddress)
+	{
+		if (inputHead == inputTail)
+		{
+			prefetch(cycle);
+		}
+		return inputHead != inputTail ? InputReady : 0x00;
+	}
+	if (address == inputAddress)
+	{
+		if (inputHead == inputTail)
+		{
+			prefetch(cycle);
+		}
+		if (inputHead == inputTail)
+		{
+			return 0x00;
+		}
+		return input[inputTail++ & (InputCapacity - 1)];
+	}
+	if (address == outputAddress)
+	{
+		return 0x00;
+	}
+	return memory.read(address);
+}
+
+void ConsoleDevice::write(Word address, Byte value, u64 /*cycle*/)
+{
+	if (address == outputAddress)
+	{
+		if (outputHead - outputTail == OutputCapacity)
+		{
+			flush();
+		}
+		output[outputHead++ & (OutputCapacity - 1)] = value;
+		if (value == '\n' && lineBuffered)
+		{
+			flush();
+		}
+		return;
+	}
+	if (address == inputAddress || address == statusAddress)
+	{
+		return;
+	}
+	memory.write(address, value);
+}
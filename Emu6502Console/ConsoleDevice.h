@@ -0,0 +1,74 @@
+/**
+* Class name: ConsoleDevice
+* Purpose: Memory-mapped character I/O for test ROMs and firmware logs.
+*
+* Registers (each at its own configurable address):
+*	- output: writing a byte appends it to the output buffer
+*	- input:  reading returns the next input byte and consumes it, 0 when there is none
+*	- status: reading returns InputReady when an input byte is waiting
+*
+* Output collects in a ring buffer that is written to the host in one writev when a newline
+* arrives (if line buffered) or the buffer fills, never per byte. Input is read ahead in chunks
+* with a non-blocking poll, at most once every PollInterval cycles while the guest finds the
+* buffer empty. The rest of the pages the registers sit in stays ordinary memory.
+**/
+#pragma once
+#include "IODevice.h"
+
+class ConsoleDevice : public IODevice
+{
+public:
+	// status register bits
+	static constexpr Byte InputReady = 0x01;
+
+	// buffer sizes, must be powers of two
+	static constexpr u32 OutputCapacity = 1 << 14;
+	static constexpr u32 InputCapacity = 1 << 12;
+
+	// minimum cycles between two host polls for input that find nothing
+	static constexpr u64 PollInterval = 10000;
+
+	// registers at output/input/status, other addresses in their pages fall through to memory
+	ConsoleDevice(Word output, Word input, Word status, CPUBase::Memory& memory, int outputFd = 1, int inputFd = 0);
+
+	// destructor, flushes the output buffer
+	~ConsoleDevice();
+
+	// map the pages holding the registers into cpu
+	void map(CPUBase& cpu);
+
+	// write the buffered output to the host
+	void flush();
+
+	// flush on every newline, otherwise only when the buffer is full or on flush()
+	bool lineBuffered;
+
+	// IODevice
+	Byte read(Word address, u64 cycle) override;
+	void write(Word address, Byte value, u64 cycle) override;
+
+private:
+	// read whatever input the host has ready without blocking
+	void prefetch(u64 cycle);
+
+	const Word outputAddress;
+	const Word inputAddress;
+	const Word statusAddress;
+	CPUBase::Memory& memory;
+	const int outputFd;
+	const int inputFd;
+
+	// output ring, bytes [outputTail, outputHead) are pending
+	Byte* output;
+	u64 outputHead;
+	u64 outputTail;
+
+	// input ring, bytes [inputTail, inputHead) have been read from the host
+	Byte* input;
+	u64 inputHead;
+	u64 inputTail;
+
+	// earliest cycle for the next host poll after one found nothing, and whether the input has ended
+	u64 nextPoll;
+	bool inputClosed;
+};
@@ -0,0 +1,154 @@
+#include "DMADevice.h"
+#include <iostream>
+
+DMADevice::DMADevice(Word base, CPUBase::Memory& memory, u32 cyclesPerByte)
+	: base(base), cyclesPerByte(cyclesPerByte), transfers(0), bytesTransferred(0), stallCycles(0),
+	memory(memory), cpu(nullptr), covered{ nullptr, nullptr }
+{
+	memset(registers, 0x00, sizeof(registers));
+}
+
+void DMADevice::map(CPUBase& cpu)
+{
+	this->cpu = &cpu;
+	const Word Last = (Word)(base + RegisterCount - 1);
+	if (cpu.devices[base >> 8] != this)
+	{
+		covered[0] = cpu.devices[base >> 8];
+	}
+	if (cpu.devices[Last >> 8] != this)
+	{
+		covered[1] = cpu.devices[Last >> 8];
+	}
+	cpu.mapDevice(this, base, base);
+	cpu.mapDevice(this, Last, Last);
+}
+
+void DMADevice::printStats() const
+{
+	std::cout << "DMA transfers: " << transfers << '\n';
+	std::cout << "DMA bytes: " << bytesTransferred << '\n';
+	std::cout << "DMA stall cycles: " << stallCycles << std::endl;
+}
+
+IODevice* DMADevice::deviceAt(Word address) const
+{
+	IODevice* Device = cpu ? cpu->devices[address >> 8] : nullptr;
+	return Device == this ? coveredAt(address) : Device;
+}
+
+IODevice* DMADevice::coveredAt(Word address) const
+{
+	return (address >> 8) == (base >> 8) ? covered[0] : covered[1];
+}
+
+Byte DMADevice::read(Word address, u64 cycle)
+{
+	const Word Offset = (Word)(address - base);
+	if (Offset >= RegisterCount)
+	{
+		IODevice* Device = coveredAt(address);
+		return Device ? Device->read(address, cycle) : memory.read(address);
+	}
+	return Offset == Control ? 0x00 : registers[Offset];
+}
+
+void DMADevice::write(Word address, Byte value, u64 cycle)
+{
+	const Word Offset = (Word)(address - base);
+	if (Offset >= RegisterCount)
+	{
+		IODevice* Device = coveredAt(address);
+		if (Device)
+		{
+			Device->write(address, value, cycle);
+		}
+		else
+		{
+			memory.write(address, value);
+		}
+		return;
+	}
+	registers[Offset] = value;
+	if (Offset != Control)
+	{
+		return;
+	}
+
+	const u32 Count = registers[Length] | (registers[Length + 1] << 8);
+	if (Count == 0)
+	{
+		return;
+	}
+	const u32 Stall = StartCycles + Count * cyclesPerByte;
+	transfer(registers[Source] | (registers[Source + 1] << 8), registers[Destination] | (registers[Destination + 1] << 8),
+		Count, (value & Fill) != 0, cycle + StartCycles);
+	if (cpu)
+	{
+		cpu->stall(Stall);
+	}
+	transfers++;
+	bytesTransferred += Count;
+	stallCycles += Stall;
+}
+
+void DMADevice::transfer(Word source, Word destination, u32 length, bool fill, u64 cycle)
+{
+	// a destination less than length above the source reads bytes this transfer wrote, so no
+	// block may be longer than that distance
+	const u32 Distance = (Word)(destination - source);
+	const u32 MaxBlock = !fill && Distance != 0 && Distance < length ? Distance : length;
+
+	u32 Done = 0;
+	while (Done < length)
+	{
+		const Word From = (Word)(source + (fill ? 0 : Done));
+		const Word To = (Word)(destination + Done);
+		IODevice* FromDevice = deviceAt(From);
+		IODevice* ToDevice = deviceAt(To);
+		if (FromDevice || ToDevice)
+		{
+			// a byte at a time, at the cycle it moves
+			const u64 ByteCycle = cycle + (u64)Done * cyclesPerByte;
+			const Byte Value = FromDevice ? FromDevice->read(From, ByteCycle) : memory.read(From);
+			if (ToDevice)
+			{
+				ToDevice->write(To, Value, ByteCycle);
+			}
+			else
+			{
+				memory.write(To, Value);
+			}
+			Done++;
+			continue;
+		}
+
+		// plain memory up to the end of the destination page, and of the source page for a copy
+		u32 Block = CPUBase::Memory::PAGE_SIZE - (To & 0xFF);
+		if (!fill && CPUBase::Memory::PAGE_SIZE - (From & 0xFF) < Block)
+		{
+			Block = CPUBase::Memory::PAGE_SIZE - (From & 0xFF);
+		}
+		if (Block > MaxBlock)
+		{
+			Block = MaxBlock;
+		}
+		if (Block > length - Done)
+		{
+			Block = length - Done;
+		}
+		Byte* Cells = memory.writable[To >> 8];
+		if (Cells != nullptr)
+		{
+			if (fill)
+			{
+				memory.fillRAM(Cells + (To & 0xFF), To, memory.read(From), Block);
+			}
+			else
+			{
+				memory.writeRAM(Cells + (To & 0xFF), To, memory.pages[From >> 8] + (From & 0xFF), Block);
+			}
+		}
+		Done += Block;
+	}
+}
@@ -0,0 +1,83 @@
+/**
+* Class name: DMADevice
+* Purpose: Memory-mapped DMA controller that copies or fills blocks of the address space for the
+*          guest, so firmware does not have to move sprite and tile data with LDA/STA loops.
+*
+* Registers (from the base address, little-endian pairs):
+*	- Source:      address of the first byte to read
+*	- Destination: address of the first byte to write
+*	- Length:      bytes to transfer, 0 for none
+*	- Control:     writing starts the transfer, with the Fill bit to write the byte at Source
+*	               Length times instead of copying; reads return 0
+*
+* The transfer completes within the write to Control. The CPU is stalled for StartCycles plus
+* cyclesPerByte per byte, charged to the execute in progress. Addresses wrap at $FFFF and the
+* bytes move in ascending order, so a destination just above the source repeats a pattern the
+* way hardware does. Runs of plain memory move with memcpy and memset a page at a time, keeping
+* the memory hash up to date; ROM pages ignore the writes, and pages with another device mapped
+* go through that device a byte at a time, at the cycle the byte would move. The registers keep
+* their values, so writing Control again repeats the transfer. The rest of the pages the registers
+* sit in, for the CPU and for transfers, goes to the device that was mapped there before, or to
+* memory if there was none.
+**/
+#pragma once
+#include "IODevice.h"
+
+class DMADevice : public IODevice
+{
+public:
+	// register offsets from base
+	static constexpr Word Source = 0;
+	static constexpr Word Destination = 2;
+	static constexpr Word Length = 4;
+	static constexpr Word Control = 6;
+	static constexpr Word RegisterCount = 7;
+
+	// Control bits
+	static constexpr Byte Fill = 0x01;
+
+	// cycles the CPU is stalled for before the first byte moves
+	static constexpr u32 StartCycles = 1;
+
+	// registers at base..base + RegisterCount - 1; cyclesPerByte for every byte transferred, a read
+	// and a write like the 2A03 sprite DMA
+	DMADevice(Word base, CPUBase::Memory& memory, u32 cyclesPerByte = 2);
+
+	// map the pages holding the registers into cpu, whose devices the transfers go through,
+	// over any device already mapped there
+	void map(CPUBase& cpu);
+
+	// print the transfer counters on the console
+	void printStats() const;
+
+	const Word base;
+	const u32 cyclesPerByte;
+
+	// transfers done, bytes moved and cycles the CPU was stalled for
+	u64 transfers;
+	u64 bytesTransferred;
+	u64 stallCycles;
+
+	// IODevice
+	Byte read(Word address, u64 cycle) override;
+	void write(Word address, Byte value, u64 cycle) override;
+
+private:
+	// move length bytes from source to destination, the first at cycle
+	void transfer(Word source, Word destination, u32 length, bool fill, u64 cycle);
+
+	// the device other than this one mapped over the page of address, or nullptr
+	IODevice* deviceAt(Word address) const;
+
+	// the device this one was mapped over in the register page of address, or nullptr
+	IODevice* coveredAt(Word address) const;
+
+	CPUBase::Memory& memory;
+	CPUBase* cpu;
+
+	// devices mapped over the pages of the first and the last register before map
+	IODevice* covered[2];
+
+	// register values
+	Byte registers[RegisterCount];
+};
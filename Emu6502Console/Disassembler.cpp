@@ -0,0 +1,116 @@
+#include "Disassembler.h"
+
+static const char HexDigits[] = "0123456789ABCDEF";
+
+static char* PutHex8(char* out, Byte value)
+{
+	*out++ = '$';
+	*out++ = HexDigits[value >> 4];
+	*out++ = HexDigits[value & 0x0F];
+	return out;
+}
+
+static char* PutHex16(char* out, Word value)
+{
+	*out++ = '$';
+	*out++ = HexDigits[value >> 12];
+	*out++ = HexDigits[(value >> 8) & 0x0F];
+	*out++ = HexDigits[(value >> 4) & 0x0F];
+	*out++ = HexDigits[value & 0x0F];
+	return out;
+}
+
+static char* PutSuffix(char* out, char a, char b)
+{
+	*out++ = a;
+	*out++ = b;
+	return out;
+}
+
+u32 Disassemble(Word address, Byte opcode, Byte lo, Byte hi, char* out, const OpcodeTable& table)
+{
+	const OpcodeInfo& Info = table[opcode];
+	char* Start = out;
+
+	*out++ = Info.Mnemonic[0];
+	*out++ = Info.Mnemonic[1];
+	*out++ = Info.Mnemonic[2];
+
+	const Word Absolute = lo | (hi << 8);
+	switch (Info.Mode)
+	{
+	case AddressingMode::Implied:
+		break;
+	case AddressingMode::Accumulator:
+		out = PutSuffix(out, ' ', 'A');
+		break;
+	case AddressingMode::Immediate:
+		out = PutSuffix(out, ' ', '#');
+		out = PutHex8(out, lo);
+		break;
+	case AddressingMode::ZeroPage:
+		*out++ = ' ';
+		out = PutHex8(out, lo);
+		break;
+	case AddressingMode::ZeroPageX:
+		*out++ = ' ';
+		out = PutHex8(out, lo);
+		out = PutSuffix(out, ',', 'X');
+		break;
+	case AddressingMode::ZeroPageY:
+		*out++ = ' ';
+		out = PutHex8(out, lo);
+		out = PutSuffix(out, ',', 'Y');
+		break;
+	case AddressingMode::Absolute:
+		*out++ = ' ';
+		out = PutHex16(out, Absolute);
+		break;
+	case AddressingMode::AbsoluteX:
+		*out++ = ' ';
+		out = PutHex16(out, Absolute);
+		out = PutSuffix(out, ',', 'X');
+		break;
+	case AddressingMode::AbsoluteY:
+		*out++ = ' ';
+		out = PutHex16(out, Absolute);
+		out = PutSuffix(out, ',', 'Y');
+		break;
+	case AddressingMode::Indirect:
+		out = PutSuffix(out, ' ', '(');
+		out = PutHex16(out, Absolute);
+		*out++ = ')';
+		break;
+	case AddressingMode::IndirectX:
+		out = PutSuffix(out, ' ', '(');
+		out = PutHex8(out, lo);
+		out = PutSuffix(out, ',', 'X');
+		*out++ = ')';
+		break;
+	case AddressingMode::IndirectY:
+		out = PutSuffix(out, ' ', '(');
+		out = PutHex8(out, lo);
+		out = PutSuffix(out, ')', ',');
+		*out++ = 'Y';
+		break;
+	case AddressingMode::Relative:
+		// show the branch target rather than the raw offset
+		*out++ = ' ';
+		out = PutHex16(out, (Word)(address + 2 + (SByte)lo));
+		break;
+	case AddressingMode::ZeroPageIndirect:
+		out = PutSuffix(out, ' ', '(');
+		out = PutHex8(out, lo);
+		*out++ = ')';
+		break;
+	}
+
+	*out = '\0';
+	return (u32)(out - Start);
+}
+
+u32 Disassemble(const CPUBase::Memory& memory, Word address, char* out, const OpcodeTable& table)
+{
+	return Disassemble(address, memory.read(address), memory.read((Word)(address + 1)),
+		memory.read((Word)(address + 2)), out, table);
+}
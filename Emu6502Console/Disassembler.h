@@ -0,0 +1,335 @@
+/**
+* Purpose: Opcode metadata table and a table-driven 6502 disassembler
+**/
+#pragma once
+#include "CPU.h"
+
+// 6502 addressing modes
+enum class AddressingMode : Byte
+{
+	Implied,
+	Accumulator,
+	Immediate,
+	ZeroPage,
+	ZeroPageX,
+	ZeroPageY,
+	Absolute,
+	AbsoluteX,
+	AbsoluteY,
+	Indirect,
+	IndirectX,
+	IndirectY,
+	Relative,
+	// 65C02 (zp)
+	ZeroPageIndirect,
+};
+
+// what the disassembler and interpreter need to know about one opcode
+struct OpcodeInfo
+{
+	// three letter mnemonic, "???" for opcodes that are not defined
+	const char* Mnemonic;
+	AddressingMode Mode;
+	// instruction length in bytes, including the opcode
+	Byte Length;
+	// base cycle count, without page crossing or branch taken penalties
+	Byte Cycles;
+};
+
+struct OpcodeTable
+{
+	OpcodeInfo Entries[256];
+
+	constexpr const OpcodeInfo& operator[](Byte opcode) const
+	{
+		return Entries[opcode];
+	}
+};
+
+// instruction length implied by an addressing mode
+constexpr Byte InstructionLength(AddressingMode mode)
+{
+	switch (mode)
+	{
+	case AddressingMode::Implied:
+	case AddressingMode::Accumulator:
+		return 1;
+	case AddressingMode::Absolute:
+	case AddressingMode::AbsoluteX:
+	case AddressingMode::AbsoluteY:
+	case AddressingMode::Indirect:
+		return 3;
+	default:
+		return 2;
+	}
+}
+
+// build the table from the INS_* opcodes in CPU.h
+constexpr OpcodeTable MakeOpcodeTable()
+{
+	using M = AddressingMode;
+	OpcodeTable Table = {};
+	for (u32 i = 0; i < 256; i++)
+	{
+		Table.Entries[i] = { "???", M::Implied, 1, 2 };
+	}
+
+	struct Definition
+	{
+		Byte Opcode;
+		const char* Mnemonic;
+		AddressingMode Mode;
+		Byte Cycles;
+	};
+
+	const Definition Definitions[] = {
+		{ CPU::INS_LDA_IM, "LDA", M::Immediate, 2 },
+		{ CPU::INS_LDA_ZP, "LDA", M::ZeroPage, 3 },
+		{ CPU::INS_LDA_ZPX, "LDA", M::ZeroPageX, 4 },
+		{ CPU::INS_LDA_ABS, "LDA", M::Absolute, 4 },
+		{ CPU::INS_LDA_ABSX, "LDA", M::AbsoluteX, 4 },
+		{ CPU::INS_LDA_ABSY, "LDA", M::AbsoluteY, 4 },
+		{ CPU::INS_LDA_INDX, "LDA", M::IndirectX, 6 },
+		{ CPU::INS_LDA_INDY, "LDA", M::IndirectY, 5 },
+
+		{ CPU::INS_LDX_IM, "LDX", M::Immediate, 2 },
+		{ CPU::INS_LDX_ZP, "LDX", M::ZeroPage, 3 },
+		{ CPU::INS_LDX_ZPY, "LDX", M::ZeroPageY, 4 },
+		{ CPU::INS_LDX_ABS, "LDX", M::Absolute, 4 },
+		{ CPU::INS_LDX_ABSY, "LDX", M::AbsoluteY, 4 },
+
+		{ CPU::INS_LDY_IM, "LDY", M::Immediate, 2 },
+		{ CPU::INS_LDY_ZP, "LDY", M::ZeroPage, 3 },
+		{ CPU::INS_LDY_ZPX, "LDY", M::ZeroPageX, 4 },
+		{ CPU::INS_LDY_ABS, "LDY", M::Absolute, 4 },
+		{ CPU::INS_LDY_ABSX, "LDY", M::AbsoluteX, 4 },
+
+		{ CPU::INS_STA_ZP, "STA", M::ZeroPage, 3 },
+		{ CPU::INS_STA_ZPX, "STA", M::ZeroPageX, 4 },
+		{ CPU::INS_STA_ABS, "STA", M::Absolute, 4 },
+		{ CPU::INS_STA_ABSX, "STA", M::AbsoluteX, 5 },
+		{ CPU::INS_STA_ABSY, "STA", M::AbsoluteY, 5 },
+		{ CPU::INS_STA_INDX, "STA", M::IndirectX, 6 },
+		{ CPU::INS_STA_INDY, "STA", M::IndirectY, 6 },
+
+		{ CPU::INS_STX_ZP, "STX", M::ZeroPage, 3 },
+		{ CPU::INS_STX_ZPY, "STX", M::ZeroPageY, 4 },
+		{ CPU::INS_STX_ABS, "STX", M::Absolute, 4 },
+
+		{ CPU::INS_STY_ZP, "STY", M::ZeroPage, 3 },
+		{ CPU::INS_STY_ZPX, "STY", M::ZeroPageX, 4 },
+		{ CPU::INS_STY_ABS, "STY", M::Absolute, 4 },
+
+		{ CPU::INS_TSX, "TSX", M::Implied, 2 },
+		{ CPU::INS_TXS, "TXS", M::Implied, 2 },
+		{ CPU::INS_PHA, "PHA", M::Implied, 3 },
+		{ CPU::INS_PLA, "PLA", M::Implied, 4 },
+		{ CPU::INS_PHP, "PHP", M::Implied, 3 },
+		{ CPU::INS_PLP, "PLP", M::Implied, 4 },
+
+		{ CPU::INS_JMP_ABS, "JMP", M::Absolute, 3 },
+		{ CPU::INS_JMP_IND, "JMP", M::Indirect, 5 },
+		{ CPU::INS_JSR, "JSR", M::Absolute, 6 },
+		{ CPU::INS_RTS, "RTS", M::Implied, 6 },
+
+		{ CPU::INS_AND_IM, "AND", M::Immediate, 2 },
+		{ CPU::INS_AND_ZP, "AND", M::ZeroPage, 3 },
+		{ CPU::INS_AND_ZPX, "AND", M::ZeroPageX, 4 },
+		{ CPU::INS_AND_ABS, "AND", M::Absolute, 4 },
+		{ CPU::INS_AND_ABSX, "AND", M::AbsoluteX, 4 },
+		{ CPU::INS_AND_ABSY, "AND", M::AbsoluteY, 4 },
+		{ CPU::INS_AND_INDX, "AND", M::IndirectX, 6 },
+		{ CPU::INS_AND_INDY, "AND", M::IndirectY, 5 },
+
+		{ CPU::INS_ORA_IM, "ORA", M::Immediate, 2 },
+		{ CPU::INS_ORA_ZP, "ORA", M::ZeroPage, 3 },
+		{ CPU::INS_ORA_ZPX, "ORA", M::ZeroPageX, 4 },
+		{ CPU::INS_ORA_ABS, "ORA", M::Absolute, 4 },
+		{ CPU::INS_ORA_ABSX, "ORA", M::AbsoluteX, 4 },
+		{ CPU::INS_ORA_ABSY, "ORA", M::AbsoluteY, 4 },
+		{ CPU::INS_ORA_INDX, "ORA", M::IndirectX, 6 },
+		{ CPU::INS_ORA_INDY, "ORA", M::IndirectY, 5 },
+
+		{ CPU::INS_EOR_IM, "EOR", M::Immediate, 2 },
+		{ CPU::INS_EOR_ZP, "EOR", M::ZeroPage, 3 },
+		{ CPU::INS_EOR_ZPX, "EOR", M::ZeroPageX, 4 },
+		{ CPU::INS_EOR_ABS, "EOR", M::Absolute, 4 },
+		{ CPU::INS_EOR_ABSX, "EOR", M::AbsoluteX, 4 },
+		{ CPU::INS_EOR_ABSY, "EOR", M::AbsoluteY, 4 },
+		{ CPU::INS_EOR_INDX, "EOR", M::IndirectX, 6 },
+		{ CPU::INS_EOR_INDY, "EOR", M::IndirectY, 5 },
+
+		{ CPU::INS_BIT_ZP, "BIT", M::ZeroPage, 3 },
+		{ CPU::INS_BIT_ABS, "BIT", M::Absolute, 4 },
+
+		{ CPU::INS_TAX, "TAX", M::Implied, 2 },
+		{ CPU::INS_TAY, "TAY", M::Implied, 2 },
+		{ CPU::INS_TXA, "TXA", M::Implied, 2 },
+		{ CPU::INS_TYA, "TYA", M::Implied, 2 },
+
+		{ CPU::INS_INX, "INX", M::Implied, 2 },
+		{ CPU::INS_INY, "INY", M::Implied, 2 },
+		{ CPU::INS_DEY, "DEY", M::Implied, 2 },
+		{ CPU::INS_DEX, "DEX", M::Implied, 2 },
+		{ CPU::INS_DEC_ZP, "DEC", M::ZeroPage, 5 },
+		{ CPU::INS_DEC_ZPX, "DEC", M::ZeroPageX, 6 },
+		{ CPU::INS_DEC_ABS, "DEC", M::Absolute, 6 },
+		{ CPU::INS_DEC_ABSX, "DEC", M::AbsoluteX, 7 },
+		{ CPU::INS_INC_ZP, "INC", M::ZeroPage, 5 },
+		{ CPU::INS_INC_ZPX, "INC", M::ZeroPageX, 6 },
+		{ CPU::INS_INC_ABS, "INC", M::Absolute, 6 },
+		{ CPU::INS_INC_ABSX, "INC", M::AbsoluteX, 7 },
+
+		{ CPU::INS_BEQ, "BEQ", M::Relative, 2 },
+		{ CPU::INS_BNE, "BNE", M::Relative, 2 },
+		{ CPU::INS_BCS, "BCS", M::Relative, 2 },
+		{ CPU::INS_BCC, "BCC", M::Relative, 2 },
+		{ CPU::INS_BMI, "BMI", M::Relative, 2 },
+		{ CPU::INS_BPL, "BPL", M::Relative, 2 },
+		{ CPU::INS_BVC, "BVC", M::Relative, 2 },
+		{ CPU::INS_BVS, "BVS", M::Relative, 2 },
+
+		{ CPU::INS_CLC, "CLC", M::Implied, 2 },
+		{ CPU::INS_SEC, "SEC", M::Implied, 2 },
+		{ CPU::INS_CLD, "CLD", M::Implied, 2 },
+		{ CPU::INS_SED, "SED", M::Implied, 2 },
+		{ CPU::INS_CLI, "CLI", M::Implied, 2 },
+		{ CPU::INS_SEI, "SEI", M::Implied, 2 },
+		{ CPU::INS_CLV, "CLV", M::Implied, 2 },
+
+		{ CPU::INS_ADC, "ADC", M::Immediate, 2 },
+		{ CPU::INS_ADC_ZP, "ADC", M::ZeroPage, 3 },
+		{ CPU::INS_ADC_ZPX, "ADC", M::ZeroPageX, 4 },
+		{ CPU::INS_ADC_ABS, "ADC", M::Absolute, 4 },
+		{ CPU::INS_ADC_ABSX, "ADC", M::AbsoluteX, 4 },
+		{ CPU::INS_ADC_ABSY, "ADC", M::AbsoluteY, 4 },
+		{ CPU::INS_ADC_INDX, "ADC", M::IndirectX, 6 },
+		{ CPU::INS_ADC_INDY, "ADC", M::IndirectY, 5 },
+
+		{ CPU::INS_SBC, "SBC", M::Immediate, 2 },
+		{ CPU::INS_SBC_ZP, "SBC", M::ZeroPage, 3 },
+		{ CPU::INS_SBC_ZPX, "SBC", M::ZeroPageX, 4 },
+		{ CPU::INS_SBC_ABS, "SBC", M::Absolute, 4 },
+		{ CPU::INS_SBC_ABSX, "SBC", M::AbsoluteX, 4 },
+		{ CPU::INS_SBC_ABSY, "SBC", M::AbsoluteY, 4 },
+		{ CPU::INS_SBC_INDX, "SBC", M::IndirectX, 6 },
+		{ CPU::INS_SBC_INDY, "SBC", M::IndirectY, 5 },
+
+		{ CPU::INS_CMP, "CMP", M::Immediate, 2 },
+		{ CPU::INS_CMP_ZP, "CMP", M::ZeroPage, 3 },
+		{ CPU::INS_CMP_ZPX, "CMP", M::ZeroPageX, 4 },
+		{ CPU::INS_CMP_ABS, "CMP", M::Absolute, 4 },
+		{ CPU::INS_CMP_ABSX, "CMP", M::AbsoluteX, 4 },
+		{ CPU::INS_CMP_ABSY, "CMP", M::AbsoluteY, 4 },
+		{ CPU::INS_CMP_INDX, "CMP", M::IndirectX, 6 },
+		{ CPU::INS_CMP_INDY, "CMP", M::IndirectY, 5 },
+
+		{ CPU::INS_CPX, "CPX", M::Immediate, 2 },
+		{ CPU::INS_CPY, "CPY", M::Immediate, 2 },
+		{ CPU::INS_CPX_ZP, "CPX", M::ZeroPage, 3 },
+		{ CPU::INS_CPY_ZP, "CPY", M::ZeroPage, 3 },
+		{ CPU::INS_CPX_ABS, "CPX", M::Absolute, 4 },
+		{ CPU::INS_CPY_ABS, "CPY", M::Absolute, 4 },
+
+		{ CPU::INS_ASL, "ASL", M::Accumulator, 2 },
+		{ CPU::INS_ASL_ZP, "ASL", M::ZeroPage, 5 },
+		{ CPU::INS_ASL_ZPX, "ASL", M::ZeroPageX, 6 },
+		{ CPU::INS_ASL_ABS, "ASL", M::Absolute, 6 },
+		{ CPU::INS_ASL_ABSX, "ASL", M::AbsoluteX, 7 },
+
+		{ CPU::INS_LSR, "LSR", M::Accumulator, 2 },
+		{ CPU::INS_LSR_ZP, "LSR", M::ZeroPage, 5 },
+		{ CPU::INS_LSR_ZPX, "LSR", M::ZeroPageX, 6 },
+		{ CPU::INS_LSR_ABS, "LSR", M::Absolute, 6 },
+		{ CPU::INS_LSR_ABSX, "LSR", M::AbsoluteX, 7 },
+
+		{ CPU::INS_ROL, "ROL", M::Accumulator, 2 },
+		{ CPU::INS_ROL_ZP, "ROL", M::ZeroPage, 5 },
+		{ CPU::INS_ROL_ZPX, "ROL", M::ZeroPageX, 6 },
+		{ CPU::INS_ROL_ABS, "ROL", M::Absolute, 6 },
+		{ CPU::INS_ROL_ABSX, "ROL", M::AbsoluteX, 7 },
+
+		{ CPU::INS_ROR, "ROR", M::Accumulator, 2 },
+		{ CPU::INS_ROR_ZP, "ROR", M::ZeroPage, 5 },
+		{ CPU::INS_ROR_ZPX, "ROR", M::ZeroPageX, 6 },
+		{ CPU::INS_ROR_ABS, "ROR", M::Absolute, 6 },
+		{ CPU::INS_ROR_ABSX, "ROR", M::AbsoluteX, 7 },
+
+		{ CPU::INS_NOP, "NOP", M::Implied, 2 },
+		{ CPU::INS_BRK, "BRK", M::Implied, 7 },
+		{ CPU::INS_RTI, "RTI", M::Implied, 6 },
+	};
+
+	for (const Definition& Def : Definitions)
+	{
+		Table.Entries[Def.Opcode] = { Def.Mnemonic, Def.Mode, InstructionLength(Def.Mode), Def.Cycles };
+	}
+	return Table;
+}
+
+// opcode metadata, indexed by opcode
+inline constexpr OpcodeTable Opcodes = MakeOpcodeTable();
+
+// the NMOS table plus the 65C02 instructions in CPU.h and their timing changes
+constexpr OpcodeTable Make65C02OpcodeTable()
+{
+	using M = AddressingMode;
+	OpcodeTable Table = MakeOpcodeTable();
+
+	struct Definition
+	{
+		Byte Opcode;
+		const char* Mnemonic;
+		AddressingMode Mode;
+		Byte Cycles;
+	};
+
+	constexpr Definition Definitions[] =
+	{
+		{ CPU::INS_BRA, "BRA", M::Relative, 3 },
+
+		{ CPU::INS_STZ_ZP, "STZ", M::ZeroPage, 3 },
+		{ CPU::INS_STZ_ZPX, "STZ", M::ZeroPageX, 4 },
+		{ CPU::INS_STZ_ABS, "STZ", M::Absolute, 4 },
+		{ CPU::INS_STZ_ABSX, "STZ", M::AbsoluteX, 5 },
+
+		{ CPU::INS_PHX, "PHX", M::Implied, 3 },
+		{ CPU::INS_PLX, "PLX", M::Implied, 4 },
+		{ CPU::INS_PHY, "PHY", M::Implied, 3 },
+		{ CPU::INS_PLY, "PLY", M::Implied, 4 },
+
+		{ CPU::INS_ORA_ZPI, "ORA", M::ZeroPageIndirect, 5 },
+		{ CPU::INS_AND_ZPI, "AND", M::ZeroPageIndirect, 5 },
+		{ CPU::INS_EOR_ZPI, "EOR", M::ZeroPageIndirect, 5 },
+		{ CPU::INS_ADC_ZPI, "ADC", M::ZeroPageIndirect, 5 },
+		{ CPU::INS_STA_ZPI, "STA", M::ZeroPageIndirect, 5 },
+		{ CPU::INS_LDA_ZPI, "LDA", M::ZeroPageIndirect, 5 },
+		{ CPU::INS_CMP_ZPI, "CMP", M::ZeroPageIndirect, 5 },
+		{ CPU::INS_SBC_ZPI, "SBC", M::ZeroPageIndirect, 5 },
+
+		{ CPU::INS_JMP_IND, "JMP", M::Indirect, 6 },
+		{ CPU::INS_ASL_ABSX, "ASL", M::AbsoluteX, 6 },
+		{ CPU::INS_LSR_ABSX, "LSR", M::AbsoluteX, 6 },
+		{ CPU::INS_ROL_ABSX, "ROL", M::AbsoluteX, 6 },
+		{ CPU::INS_ROR_ABSX, "ROR", M::AbsoluteX, 6 },
+	};
+
+	for (const Definition& Def : Definitions)
+	{
+		Table.Entries[Def.Opcode] = { Def.Mnemonic, Def.Mode, InstructionLength(Def.Mode), Def.Cycles };
+	}
+	return Table;
+}
+
+// 65C02 opcode metadata, indexed by opcode
+inline constexpr OpcodeTable Opcodes65C02 = Make65C02OpcodeTable();
+
+// longest line Disassemble can produce, including the terminating zero
+static constexpr u32 DisassemblyMaxLength = 16;
+
+// format the instruction made of opcode and operand bytes at address into
+// out (at least DisassemblyMaxLength bytes), returning the length written
+u32 Disassemble(Word address, Byte opcode, Byte lo, Byte hi, char* out, const OpcodeTable& table = Opcodes);
+
+// format the instruction at address in memory into out, returning the length written
+u32 Disassemble(const CPUBase::Memory& memory, Word address, char* out, const OpcodeTable& table = Opcodes);
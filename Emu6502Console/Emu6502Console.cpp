@@ -1,38 +1,349 @@
 // Emu6502Console.cpp : This file contains the 'main' function. Program execution begins and ends there.
 //
+// usage: Emu6502Console [rom] [--trace <file>] [--cycles <count>] [--console <address>] [--clock <hz> [--fps <rate>]]
+//                       [--perf] [--perf-classes] [--perf-json <file>]
+//                       [--video <address> [--video-raw <file>] [--video-png <path>] [--video-shm <name>]]
+//                       [--dma <address>]
+//   --trace    record every executed instruction to a binary trace file (see TraceDecoder)
+//   --cycles   run for the given number of cycles without prompting, then exit
+//   --clock    run in real time at the given clock (e.g. 1.79e6), forever unless --cycles is given
+//   --fps      frames per second for --clock, the slices execute runs between sleeps (default 60)
+//   --console  map a ConsoleDevice with its output, input and status registers at
+//              address, address + 1 and address + 2, connected to stdout and stdin
+//   --perf     count host cycles, instructions, branch misses and L1d misses (Linux perf_event_open)
+//              over the run and report them per emulated instruction and cycle
+//   --perf-classes  also break the counts down by opcode class; reads the counters around every
+//              instruction, so the run is much slower
+//   --perf-json     write the --perf report to a JSON file as well
+//   --video    map a VideoDevice (160x120, 16 colours, see VideoDevice.h) at address, a multiple
+//              of its 16KB window, with a vblank every 1/fps s of --clock (default 1789773 Hz)
+//   --video-raw     write every frame to a file as raw RGBA
+//   --video-png     write every frame as a PNG, to one file per frame if the path holds a
+//              frame number pattern such as frame%05d.png (one integer conversion, no other %),
+//              otherwise as one stream of PNGs
+//   --video-shm     publish the latest frame in POSIX shared memory under the given name
+//   --dma      map a DMADevice (see DMADevice.h) with its registers from address
+//
 
 #include <iostream>
+#include <string.h>
 #include "CPU.h"
+#include "ConsoleDevice.h"
+#include "DMADevice.h"
+#include "Pacer.h"
+#include "PerfCounters.h"
+#include "Trace.h"
+#include "VideoDevice.h"
+
+// CPU clock that vblanks are timed by when --clock is not given, the NTSC NES clock
+static constexpr double DefaultVideoClock = 1789773;
 
-int main()
+int main(int argc, char* argv[])
 {
+	std::string path;
+	std::string tracePath;
+	u64 runCycles = 0;
+	long consoleAddress = -1;
+	double clockHz = 0;
+	double framesPerSecond = 60;
+	bool perfEnabled = false;
+	bool perfClasses = false;
+	std::string perfJsonPath;
+	long videoAddress = -1;
+	std::string videoRawPath;
+	std::string videoPNGPath;
+	std::string videoSharedName;
+	long dmaAddress = -1;
+
+	// parse the command line
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+		{
+			tracePath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+		{
+			runCycles = strtoull(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--console") == 0 && i + 1 < argc)
+		{
+			consoleAddress = strtol(argv[++i], NULL, 0) & 0xFFFF;
+		}
+		else if (strcmp(argv[i], "--clock") == 0 && i + 1 < argc)
+		{
+			clockHz = strtod(argv[++i], NULL);
+		}
+		else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+		{
+			framesPerSecond = strtod(argv[++i], NULL);
+		}
+		else if (strcmp(argv[i], "--perf") == 0)
+		{
+			perfEnabled = true;
+		}
+		else if (strcmp(argv[i], "--perf-classes") == 0)
+		{
+			perfEnabled = true;
+			perfClasses = true;
+		}
+		else if (strcmp(argv[i], "--perf-json") == 0 && i + 1 < argc)
+		{
+			perfEnabled = true;
+			perfJsonPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--video") == 0 && i + 1 < argc)
+		{
+			videoAddress = strtol(argv[++i], NULL, 0) & 0xFFFF;
+		}
+		else if (strcmp(argv[i], "--video-raw") == 0 && i + 1 < argc)
+		{
+			videoRawPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--video-png") == 0 && i + 1 < argc)
+		{
+			videoPNGPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--video-shm") == 0 && i + 1 < argc)
+		{
+			videoSharedName = argv[++i];
+		}
+		else if (strcmp(argv[i], "--dma") == 0 && i + 1 < argc)
+		{
+			dmaAddress = strtol(argv[++i], NULL, 0) & 0xFFFF;
+		}
+		else
+		{
+			path = argv[i];
+		}
+	}
+
     // new Processor
 	CPU* cpu = new CPU();
-	// initialize memory
-	cpu->memory.init();
+	// new memory, cleared
+	CPU::Memory* memory = new CPU::Memory();
 	// reset
-	cpu->reset(cpu->memory);
+	cpu->reset(*memory);
+
+	if (path.empty())
+	{
+		// ask the user for the path to the ROM file
+		std::cout << "Enter the path to the ROM file: ";
+		std::cin >> path;
+	}
 
-	// ask the user for the path to the ROM file
-	std::string path;
-	std::cout << "Enter the path to the ROM file: ";
-	std::cin >> path;
-	
 	// load the ROM file
-	cpu->loadROM(path, cpu->memory);
+	cpu->loadROM(path, *memory);
+
+	// console I/O device
+	ConsoleDevice* console = nullptr;
+	if (consoleAddress >= 0)
+	{
+		console = new ConsoleDevice((Word)consoleAddress, (Word)(consoleAddress + 1), (Word)(consoleAddress + 2), *memory);
+		console->map(*cpu);
+	}
+
+	// framebuffer device, with its outputs open before its worker starts
+	VideoDevice* video = nullptr;
+	if (videoAddress >= 0)
+	{
+		const double FrameClock = clockHz > 0 ? clockHz : DefaultVideoClock;
+		const u64 FrameCycles = (u64)(FrameClock / (framesPerSecond > 0 ? framesPerSecond : 60));
+		video = new VideoDevice((Word)videoAddress, FrameCycles > 0 ? FrameCycles : 1);
+		std::string error;
+		if (videoAddress % VideoDevice::windowSize(video->width, video->height) != 0)
+		{
+			error = "Video address must be a multiple of the window size";
+		}
+		else if (!videoRawPath.empty() && !video->openRaw(videoRawPath))
+		{
+			error = "Could not open file: " + videoRawPath;
+		}
+		else if (!videoPNGPath.empty() && !video->openPNG(videoPNGPath))
+		{
+			error = videoPNGPath.find('%') != std::string::npos
+				? "PNG path pattern must hold one integer conversion such as %05d: " + videoPNGPath
+				: "Could not open file: " + videoPNGPath;
+		}
+		else if (!videoSharedName.empty() && !video->openSharedMemory(videoSharedName))
+		{
+			error = "Could not open shared memory: " + videoSharedName;
+		}
+		if (!error.empty())
+		{
+			std::cout << "Error: " << error << std::endl;
+			delete video;
+			delete console;
+			delete memory;
+			delete cpu;
+			return 1;
+		}
+		video->map(*cpu);
+		video->start();
+	}
+
+	// DMA controller, mapped last so its registers win over another device in the same page, which
+	// keeps the rest of the page
+	DMADevice* dma = nullptr;
+	if (dmaAddress >= 0)
+	{
+		dma = new DMADevice((Word)dmaAddress, *memory);
+		dma->map(*cpu);
+	}
+
+	// start tracing
+	Tracer* tracer = nullptr;
+	if (!tracePath.empty())
+	{
+		tracer = new Tracer();
+		if (!tracer->open(tracePath))
+		{
+			std::cout << "Error: Could not open trace file: " << tracePath << std::endl;
+			delete tracer;
+			delete dma;
+			delete video;
+			delete console;
+			delete memory;
+			delete cpu;
+			return 1;
+		}
+		cpu->tracer = tracer;
+	}
 
-	// a run loop
-	while (true)
+	// host performance counters
+	PerfCounters* perf = nullptr;
+	if (perfEnabled)
 	{
-		// ask the user to press enter to execute the next instruction
-		std::cout << "Press enter to execute the next instruction" << std::endl;
-		std::cin.get();
-		// execute the next instruction
-		cpu->execute(1, cpu->memory);
-		// print the status
+		perf = new PerfCounters();
+		if (!perf->open())
+		{
+			std::cout << "Error: Host performance counters are not available" << std::endl;
+			delete perf;
+			perf = nullptr;
+		}
+		else if (perfClasses)
+		{
+			cpu->profiler = perf;
+		}
+	}
+
+	// execute, through the counters when they are on
+	auto Execute = [&](s32 cycles) {
+		return perf ? perf->execute(*cpu, cycles, *memory) : cpu->execute(cycles, *memory);
+	};
+
+	if (clockHz > 0 && framesPerSecond > 0)
+	{
+		// real time, one frame of cycles between sleeps
+		Pacer pacer(clockHz, framesPerSecond);
+		pacer.start(cpu->TotalCycles);
+		while (runCycles == 0 || cpu->TotalCycles < runCycles)
+		{
+			s32 budget = pacer.frameBudget(cpu->TotalCycles);
+			if (runCycles > 0 && cpu->TotalCycles + budget > runCycles)
+			{
+				budget = (s32)(runCycles - cpu->TotalCycles);
+			}
+			Execute(budget);
+			if (console)
+			{
+				console->flush();
+			}
+			if (video)
+			{
+				video->advanceTo(cpu->TotalCycles);
+			}
+			pacer.endFrame();
+		}
+		cpu->printStatus();
+		pacer.printStats();
+	}
+	else if (runCycles > 0)
+	{
+		// run without prompting, in large slices so the loop overhead stays out of the way; with
+		// video, one frame per slice so that vblanks come while the guest leaves VRAM alone
+		const u64 slice = video && video->frameCycles < 0x40000000 ? video->frameCycles : 0x40000000;
+		while (cpu->TotalCycles < runCycles)
+		{
+			u64 remaining = runCycles - cpu->TotalCycles;
+			Execute(remaining > slice ? (s32)slice : (s32)remaining);
+			if (video)
+			{
+				video->advanceTo(cpu->TotalCycles);
+			}
+		}
+		// the guest's output goes before the status
+		if (console)
+		{
+			console->flush();
+		}
 		cpu->printStatus();
 	}
-	
-	// delete the processor
+	else
+	{
+		// a run loop
+		while (true)
+		{
+			// ask the user to press enter to execute the next instruction
+			std::cout << "Press enter to execute the next instruction" << std::endl;
+			std::cin.get();
+			// execute the next instruction
+			Execute(1);
+			if (console)
+			{
+				console->flush();
+			}
+			if (video)
+			{
+				video->advanceTo(cpu->TotalCycles);
+			}
+			// print the status
+			cpu->printStatus();
+		}
+	}
+
+	// report and close the counters
+	if (perf)
+	{
+		cpu->profiler = nullptr;
+		perf->printReport();
+		if (!perfJsonPath.empty() && !perf->writeJSON(perfJsonPath))
+		{
+			std::cout << "Error: Could not write file: " << perfJsonPath << std::endl;
+		}
+		delete perf;
+	}
+
+	// stop tracing, flushing whatever is still buffered
+	if (tracer)
+	{
+		cpu->tracer = nullptr;
+		if (!tracer->close())
+		{
+			std::cout << "Error: Could not write trace file: " << tracePath << std::endl;
+		}
+		delete tracer;
+	}
+
+	// remove the DMA controller
+	if (dma)
+	{
+		dma->printStats();
+		delete dma;
+	}
+
+	// finish the frames and remove the video device
+	if (video)
+	{
+		video->sync(cpu->TotalCycles);
+		video->printStats();
+		delete video;
+	}
+
+	// flush and remove the console
+	delete console;
+
+	// delete the memory and the processor
+	delete memory;
 	delete cpu;
 }
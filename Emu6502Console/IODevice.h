@@ -0,0 +1,20 @@
+/**
+* Class name: IODevice
+* Purpose: A memory-mapped peripheral. CPUBase::mapDevice assigns it whole pages of the address
+*          space, and every data read and write the CPU makes there calls the device with the
+*          cycle at which the access happens.
+**/
+#pragma once
+#include "CPU.h"
+
+class IODevice
+{
+public:
+	virtual ~IODevice() {}
+
+	// the CPU reads address at cycle
+	virtual Byte read(Word address, u64 cycle) = 0;
+
+	// the CPU writes value to address at cycle
+	virtual void write(Word address, Byte value, u64 cycle) = 0;
+};
@@ -0,0 +1,188 @@
+#include "MemoryArena.h"
+#include "CPU.h"
+#include <new>
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// blocks start on a host page, so their 256-byte pages never straddle a cache line
+static constexpr std::align_val_t BlockAlignment = std::align_val_t(4096);
+
+MemoryArena::MemoryArena(bool shareable)
+	: shareable(shareable), next(nullptr), nextPages(0)
+{
+#if !defined(__linux__)
+	this->shareable = false;
+#endif
+}
+
+MemoryArena::~MemoryArena()
+{
+	for (const Block& B : blocks)
+	{
+#if defined(__linux__)
+		if (B.Fd >= 0)
+		{
+			munmap(B.Data, B.Size);
+			close(B.Fd);
+			continue;
+		}
+#endif
+		::operator delete(B.Data, BlockAlignment);
+	}
+}
+
+Byte* MemoryArena::allocateBlock(u32 pageCount)
+{
+	const size_t Size = (size_t)pageCount * PageSize;
+#if defined(__linux__)
+	if (shareable)
+	{
+		// mappings start on a host page, like the heap blocks
+		const int Fd = memfd_create("emu6502-arena", MFD_CLOEXEC);
+		void* Data = MAP_FAILED;
+		if (Fd >= 0 && ftruncate(Fd, (off_t)Size) == 0)
+		{
+			Data = mmap(nullptr, Size, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+		}
+		if (Data == MAP_FAILED)
+		{
+			if (Fd >= 0)
+			{
+				close(Fd);
+			}
+			throw std::bad_alloc();
+		}
+		blocks.push_back({ (Byte*)Data, Size, Fd });
+		return (Byte*)Data;
+	}
+#endif
+	Byte* Data = (Byte*)::operator new(Size, BlockAlignment);
+	blocks.push_back({ Data, Size, -1 });
+	return Data;
+}
+
+Byte* MemoryArena::allocate(u32 pageCount)
+{
+	std::lock_guard<std::mutex> Guard(lock);
+
+	if (shareable)
+	{
+		return allocateBlock(pageCount);
+	}
+
+	// machines of one kind all ask for the same size, so an exact fit is the common case
+	std::vector<Byte*>& Runs = freeRuns[pageCount];
+	if (!Runs.empty())
+	{
+		Byte* Pages = Runs.back();
+		Runs.pop_back();
+		return Pages;
+	}
+
+	if (pageCount > BlockPages)
+	{
+		return allocateBlock(pageCount);
+	}
+	if (pageCount > nextPages)
+	{
+		// keep the tail of the old block for a smaller request
+		if (nextPages > 0)
+		{
+			freeRuns[nextPages].push_back(next);
+		}
+		next = allocateBlock(BlockPages);
+		nextPages = BlockPages;
+	}
+	Byte* Pages = next;
+	next += (size_t)pageCount * PageSize;
+	nextPages -= pageCount;
+	return Pages;
+}
+
+void MemoryArena::release(Byte* pages, u32 pageCount)
+{
+	if (pages == nullptr)
+	{
+		return;
+	}
+	std::lock_guard<std::mutex> Guard(lock);
+#if defined(__linux__)
+	if (shareable)
+	{
+		for (size_t i = 0; i < blocks.size(); i++)
+		{
+			if (blocks[i].Data == pages)
+			{
+				munmap(blocks[i].Data, blocks[i].Size);
+				close(blocks[i].Fd);
+				blocks[i] = blocks.back();
+				blocks.pop_back();
+				return;
+			}
+		}
+	}
+#endif
+	freeRuns[pageCount].push_back(pages);
+}
+
+bool MemoryArena::locate(const Byte* pages, int& fd, u64& offset, u64& size)
+{
+	std::lock_guard<std::mutex> Guard(lock);
+	for (const Block& B : blocks)
+	{
+		if (B.Fd >= 0 && pages >= B.Data && pages < B.Data + B.Size)
+		{
+			fd = B.Fd;
+			offset = (u64)(pages - B.Data);
+			size = B.Size;
+			return true;
+		}
+	}
+	return false;
+}
+
+MemoryArena& MemoryArena::shared()
+{
+	// never destroyed, so memory released during static destruction still has an arena
+	static MemoryArena* Arena = new MemoryArena();
+	return *Arena;
+}
+
+ROMImage::ROMImage(Word address, const Byte* data, u32 size)
+{
+	if (size > CPUBase::Memory::MAX_MEM - address)
+	{
+		size = CPUBase::Memory::MAX_MEM - address;
+	}
+	firstPage = address / MemoryArena::PageSize;
+	pageCount = size == 0 ? 0 : (address + size - 1) / MemoryArena::PageSize - firstPage + 1;
+	this->data = (Byte*)::operator new((size_t)pageCount * MemoryArena::PageSize, BlockAlignment);
+	memset(this->data, 0x00, (size_t)pageCount * MemoryArena::PageSize);
+	memcpy(this->data + address % MemoryArena::PageSize, data, size);
+
+	hash = 0;
+	for (u32 i = 0; i < pageCount * MemoryArena::PageSize; i++)
+	{
+		hash += CPUBase::Memory::hashKey((Word)(firstPage * MemoryArena::PageSize + i)) * this->data[i];
+	}
+}
+
+ROMImage::~ROMImage()
+{
+	::operator delete(data, BlockAlignment);
+}
+
+std::shared_ptr<const ROMImage> ROMImage::load(const std::string& path, Word address)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file == NULL)
+	{
+		return nullptr;
+	}
+	std::vector<Byte> Contents(CPUBase::Memory::MAX_MEM);
+	const size_t Size = fread(Contents.data(), 1, Contents.size(), file);
+	fclose(file);
+	return std::make_shared<const ROMImage>(address, Contents.data(), (u32)Size);
+}
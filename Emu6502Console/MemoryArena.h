@@ -0,0 +1,108 @@
+/**
+* Class name: MemoryArena, ROMImage
+* Purpose: Storage behind CPUBase::Memory. MemoryArena is a pooled allocator for emulated RAM,
+*          ROMImage a read-only image that any number of machines map without copying it.
+*
+* Fuzzers and batch runs create and destroy machines by the thousand. The arena carves their
+* RAM out of large page-aligned blocks, in whole 256-byte pages, and keeps released runs on a
+* free list per size, so a new machine reuses the RAM of a finished one instead of going back
+* to the heap. A machine whose upper pages are a shared ROMImage only takes RAM for the rest.
+*
+* A shareable arena (Linux only) takes its RAM from memfd files mapped into the process, so
+* another process handed the file can map the same RAM and read it without a copy. Every run
+* gets a file of its own that release closes, so a file handed out never shows another machine's
+* RAM; a shareable arena does no pooling.
+**/
+#pragma once
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Types.h"
+
+class MemoryArena
+{
+public:
+	// bytes in a page of the 6502 address space
+	static constexpr u32 PageSize = 256;
+
+	// pages in each block taken from the heap (1 MB)
+	static constexpr u32 BlockPages = 4096;
+
+	// shareable puts each run in a shared memory file of its own, where the host has them
+	explicit MemoryArena(bool shareable = false);
+
+	// frees every block, so the arena must outlive the memory allocated from it
+	~MemoryArena();
+
+	MemoryArena(const MemoryArena&) = delete;
+	MemoryArena& operator=(const MemoryArena&) = delete;
+
+	// pageCount contiguous pages, cache line aligned and not cleared. Thread safe
+	Byte* allocate(u32 pageCount);
+
+	// give back pages returned by allocate with the same pageCount. Thread safe
+	void release(Byte* pages, u32 pageCount);
+
+	// file descriptor of the shared memory file holding pages from allocate, and their offset and
+	// the file's size, or false if the pages are not in one. The descriptor stays open until the
+	// pages are released. Thread safe
+	bool locate(const Byte* pages, int& fd, u64& offset, u64& size);
+
+	// arena used by memory that is not given one, lives until the process exits
+	static MemoryArena& shared();
+
+private:
+	struct Block
+	{
+		Byte* Data;
+		size_t Size;
+		// shared memory file the block is mapped from, -1 for a heap block
+		int Fd;
+	};
+
+	// take a new block from the heap or a shared memory file
+	Byte* allocateBlock(u32 pageCount);
+
+	std::mutex lock;
+
+	// whether blocks are shared memory files
+	bool shareable;
+
+	// every block taken
+	std::vector<Block> blocks;
+
+	// unused pages at the end of the newest block
+	Byte* next;
+	u32 nextPages;
+
+	// released runs by page count
+	std::unordered_map<u32, std::vector<Byte*>> freeRuns;
+};
+
+class ROMImage
+{
+public:
+	// image of size bytes of data placed at address. It covers whole pages, bytes of those pages
+	// outside address..address + size - 1 read as zero. size is clipped at the end of memory
+	ROMImage(Word address, const Byte* data, u32 size);
+
+	~ROMImage();
+
+	ROMImage(const ROMImage&) = delete;
+	ROMImage& operator=(const ROMImage&) = delete;
+
+	// image of the file at path placed at address, or nullptr if it could not be read
+	static std::shared_ptr<const ROMImage> load(const std::string& path, Word address);
+
+	// first page covered and number of pages
+	u32 firstPage;
+	u32 pageCount;
+
+	// pageCount pages of data
+	Byte* data;
+
+	// contribution of the image to the memory hash (see StateHash.h)
+	u64 hash;
+};
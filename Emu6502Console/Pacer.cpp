@@ -0,0 +1,96 @@
+#include "Pacer.h"
+#include <iostream>
+#include <thread>
+#if defined(__linux__)
+#include <errno.h>
+#include <time.h>
+#endif
+
+Pacer::Pacer(double clockHz, double framesPerSecond)
+	: frames(0), lateFrames(0), resyncs(0), sleptFrames(0), totalJitterNs(0), maxJitterNs(0),
+	clockHz(clockHz), framesPerSecond(framesPerSecond), startCycles(0), frame(0)
+{
+	startTime = Clock::now();
+}
+
+void Pacer::start(u64 totalCycles)
+{
+	startTime = Clock::now();
+	startCycles = totalCycles;
+	frame = 0;
+}
+
+s32 Pacer::frameBudget(u64 totalCycles) const
+{
+	// cycles due by the end of the current frame, less what has run already
+	const u64 Due = startCycles + (u64)((double)(frame + 1) * clockHz / framesPerSecond);
+	const u64 Done = totalCycles;
+	if (Done >= Due)
+	{
+		return 0;
+	}
+	const u64 Budget = Due - Done;
+	return Budget > 0x40000000 ? 0x40000000 : (s32)Budget;
+}
+
+Pacer::Clock::duration Pacer::deadline(u64 frame) const
+{
+	return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>((double)frame / framesPerSecond));
+}
+
+void Pacer::endFrame()
+{
+	frame++;
+	frames++;
+
+	const Clock::time_point Deadline = startTime + deadline(frame);
+	const Clock::time_point Now = Clock::now();
+	if (Now > Deadline)
+	{
+		lateFrames++;
+		if (Now - Deadline > deadline(MaxFramesBehind))
+		{
+			// far behind (host stalled, debugger, ...), start over from here
+			resyncs++;
+			startTime = Now;
+			startCycles += (u64)((double)frame * clockHz / framesPerSecond);
+			frame = 0;
+		}
+		return;
+	}
+
+	sleepUntil(Deadline);
+
+	const double Jitter = std::chrono::duration<double, std::nano>(Clock::now() - Deadline).count();
+	sleptFrames++;
+	totalJitterNs += Jitter;
+	if (Jitter > maxJitterNs)
+	{
+		maxJitterNs = Jitter;
+	}
+}
+
+void Pacer::sleepUntil(Clock::time_point when)
+{
+#if defined(__linux__)
+	// steady_clock is CLOCK_MONOTONIC on Linux, so its time points are valid absolute deadlines
+	const auto Since = std::chrono::duration_cast<std::chrono::nanoseconds>(when.time_since_epoch()).count();
+	timespec Deadline;
+	Deadline.tv_sec = (time_t)(Since / 1000000000);
+	Deadline.tv_nsec = (long)(Since % 1000000000);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &Deadline, NULL) == EINTR)
+	{
+	}
+#else
+	std::this_thread::sleep_until(when);
+#endif
+}
+
+void Pacer::printStats() const
+{
+	std::cout << "Frames: " << frames << '\n';
+	std::cout << "Late frames: " << lateFrames << '\n';
+	std::cout << "Resyncs: " << resyncs << '\n';
+	std::cout << "Mean jitter (us): " << (sleptFrames ? totalJitterNs / sleptFrames / 1000.0 : 0.0) << '\n';
+	std::cout << "Max jitter (us): " << maxJitterNs / 1000.0 << std::endl;
+}
@@ -0,0 +1,76 @@
+/**
+* Class name: Pacer
+* Purpose: Run the emulation in real time at a target clock, one frame of cycles at a time.
+*
+* Frame n ends at the absolute deadline start + n / fps and by then the CPU should have executed
+* floor(n * clock / fps) cycles. Both are computed from the start rather than accumulated, so
+* neither sleep error nor the few cycles execute overruns a budget by can drift. Between frames
+* the host thread sleeps (clock_nanosleep with TIMER_ABSTIME where available) instead of spinning.
+*
+*	Pacer pacer(1789773, 60);
+*	pacer.start(cpu.TotalCycles);
+*	while (running)
+*	{
+*		cpu.execute(pacer.frameBudget(cpu.TotalCycles), memory);
+*		pacer.endFrame();
+*	}
+**/
+#pragma once
+#include <chrono>
+#include "CPU.h"
+
+class Pacer
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	// a frame finishing more than this many frames behind its deadline restarts the schedule
+	// rather than running the missed frames back to back
+	static constexpr u32 MaxFramesBehind = 5;
+
+	// clock in Hz, frames per second
+	Pacer(double clockHz, double framesPerSecond);
+
+	// start the schedule now, with the CPU at totalCycles
+	void start(u64 totalCycles);
+
+	// cycles to execute for the current frame, given the CPU's TotalCycles
+	s32 frameBudget(u64 totalCycles) const;
+
+	// sleep until the deadline of the current frame and move on to the next one
+	void endFrame();
+
+	// print the counters on the console
+	void printStats() const;
+
+	// frames completed
+	u64 frames;
+
+	// frames whose work finished after their deadline
+	u64 lateFrames;
+
+	// times the schedule was restarted after falling MaxFramesBehind frames behind
+	u64 resyncs;
+
+	// wake-up time minus deadline, over the frames that slept
+	u64 sleptFrames;
+	double totalJitterNs;
+	double maxJitterNs;
+
+private:
+	// the deadline of frame relative to the start of the schedule
+	Clock::duration deadline(u64 frame) const;
+
+	// sleep until the absolute time point
+	static void sleepUntil(Clock::time_point when);
+
+	const double clockHz;
+	const double framesPerSecond;
+
+	// start of the schedule and the CPU's TotalCycles at that moment
+	Clock::time_point startTime;
+	u64 startCycles;
+
+	// frames since the start of the schedule, the current one is frame + 1
+	u64 frame;
+};
@@ -0,0 +1,323 @@
+#include "PerfCounters.h"
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// begin/end pairs timed to measure the cost of reading the counters
+static constexpr u32 CalibrationRounds = 1000;
+
+const char* const PerfCounters::CounterNames[CounterCount] = {
+	"task_clock_ns", "cycles", "instructions", "branch_misses", "l1d_misses"
+};
+
+const char* const PerfCounters::ClassNames[ClassCount] = {
+	"load", "store", "transfer", "stack", "arithmetic", "logic", "shift",
+	"incdec", "compare", "branch", "jump", "flag", "other"
+};
+
+PerfCounters::PerfCounters(const OpcodeTable& table)
+	: leader(-1), opened(0), instructionClass(Other), instructionCycles(0)
+{
+	struct Member
+	{
+		const char* Mnemonic;
+		OpcodeClass Class;
+	};
+	static const Member Members[] = {
+		{ "LDA", Load }, { "LDX", Load }, { "LDY", Load },
+		{ "STA", Store }, { "STX", Store }, { "STY", Store }, { "STZ", Store },
+		{ "TAX", Transfer }, { "TAY", Transfer }, { "TXA", Transfer }, { "TYA", Transfer },
+		{ "TSX", Transfer }, { "TXS", Transfer },
+		{ "PHA", Stack }, { "PLA", Stack }, { "PHP", Stack }, { "PLP", Stack },
+		{ "PHX", Stack }, { "PLX", Stack }, { "PHY", Stack }, { "PLY", Stack },
+		{ "ADC", Arithmetic }, { "SBC", Arithmetic },
+		{ "AND", Logic }, { "ORA", Logic }, { "EOR", Logic }, { "BIT", Logic },
+		{ "ASL", Shift }, { "LSR", Shift }, { "ROL", Shift }, { "ROR", Shift },
+		{ "INC", IncDec }, { "DEC", IncDec }, { "INX", IncDec }, { "INY", IncDec },
+		{ "DEX", IncDec }, { "DEY", IncDec },
+		{ "CMP", Compare }, { "CPX", Compare }, { "CPY", Compare },
+		{ "BCC", Branch }, { "BCS", Branch }, { "BEQ", Branch }, { "BNE", Branch },
+		{ "BMI", Branch }, { "BPL", Branch }, { "BVC", Branch }, { "BVS", Branch }, { "BRA", Branch },
+		{ "JMP", Jump }, { "JSR", Jump }, { "RTS", Jump }, { "RTI", Jump }, { "BRK", Jump },
+		{ "CLC", Flag }, { "SEC", Flag }, { "CLI", Flag }, { "SEI", Flag },
+		{ "CLD", Flag }, { "SED", Flag }, { "CLV", Flag },
+	};
+
+	for (u32 Opcode = 0; Opcode < 256; Opcode++)
+	{
+		classOf[Opcode] = Other;
+		for (const Member& M : Members)
+		{
+			if (strcmp(table[(Byte)Opcode].Mnemonic, M.Mnemonic) == 0)
+			{
+				classOf[Opcode] = M.Class;
+				break;
+			}
+		}
+	}
+
+	memset(&total, 0, sizeof(total));
+	memset(classes, 0, sizeof(classes));
+	memset(overhead, 0, sizeof(overhead));
+	memset(&instructionStart, 0, sizeof(instructionStart));
+	for (u32 c = 0; c < CounterCount; c++)
+	{
+		fds[c] = -1;
+		slot[c] = 0;
+	}
+}
+
+PerfCounters::~PerfCounters()
+{
+#if defined(__linux__)
+	for (u32 c = 0; c < CounterCount; c++)
+	{
+		if (fds[c] >= 0)
+		{
+			close(fds[c]);
+		}
+	}
+#endif
+}
+
+bool PerfCounters::open()
+{
+#if defined(__linux__)
+	struct Definition
+	{
+		u32 Type;
+		u64 Config;
+	};
+	static const Definition Definitions[CounterCount] = {
+		{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+			| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	};
+
+	// one group, so a single read returns every counter over the same interval. The task clock
+	// leads because it is a software counter that exists even where the hardware ones do not
+	for (u32 c = 0; c < CounterCount; c++)
+	{
+		perf_event_attr Attr;
+		memset(&Attr, 0, sizeof(Attr));
+		Attr.size = sizeof(Attr);
+		Attr.type = Definitions[c].Type;
+		Attr.config = Definitions[c].Config;
+		Attr.exclude_kernel = 1;
+		Attr.exclude_hv = 1;
+		Attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		const int Fd = (int)syscall(SYS_perf_event_open, &Attr, 0, -1, leader, 0);
+		if (Fd < 0)
+		{
+			continue;
+		}
+		if (leader < 0)
+		{
+			leader = Fd;
+		}
+		fds[c] = Fd;
+		slot[c] = opened++;
+	}
+	if (opened == 0)
+	{
+		return false;
+	}
+
+	// the cost of the reads themselves, subtracted from every profiled instruction
+	Totals Calibration;
+	memset(&Calibration, 0, sizeof(Calibration));
+	for (u32 i = 0; i < CalibrationRounds; i++)
+	{
+		Sample Start;
+		read(Start);
+		Sample End;
+		read(End);
+		accumulate(Calibration, Start, End, nullptr);
+	}
+	for (u32 c = 0; c < CounterCount; c++)
+	{
+		overhead[c] = Calibration.Counts[c] / CalibrationRounds;
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+void PerfCounters::read(Sample& sample) const
+{
+	memset(&sample, 0, sizeof(sample));
+#if defined(__linux__)
+	// count, time enabled, time running, then the values in the order they were opened
+	u64 Buffer[3 + CounterCount];
+	if (leader < 0 || ::read(leader, Buffer, sizeof(Buffer)) < (ssize_t)((3 + opened) * sizeof(u64)))
+	{
+		return;
+	}
+	sample.Enabled = Buffer[1];
+	sample.Running = Buffer[2];
+	for (u32 c = 0; c < CounterCount; c++)
+	{
+		if (fds[c] >= 0)
+		{
+			sample.Values[c] = Buffer[3 + slot[c]];
+		}
+	}
+#endif
+}
+
+void PerfCounters::accumulate(Totals& totals, const Sample& start, const Sample& end, const double* overhead)
+{
+	// while other groups take turns on the hardware this one only counts part of the time
+	const u64 Running = end.Running - start.Running;
+	const double Scale = Running > 0 ? (double)(end.Enabled - start.Enabled) / Running : 1.0;
+	for (u32 c = 0; c < CounterCount; c++)
+	{
+		double Count = (double)(end.Values[c] - start.Values[c]) * Scale;
+		if (overhead)
+		{
+			Count -= overhead[c];
+		}
+		totals.Counts[c] += Count;
+	}
+}
+
+void PerfCounters::beginInstruction(Byte opcode, s32 cycles)
+{
+	instructionClass = classOf[opcode];
+	instructionCycles = cycles;
+	// last, so that as little as possible of this function is charged to the instruction
+	read(instructionStart);
+}
+
+void PerfCounters::endInstruction(s32 cycles)
+{
+	Sample End;
+	read(End);
+	Totals& Class = classes[instructionClass];
+	accumulate(Class, instructionStart, End, overhead);
+	Class.Instructions++;
+	Class.Cycles += instructionCycles - cycles;
+}
+
+// count per unit, 0 when there are no units
+static double Ratio(double count, u64 units)
+{
+	return units > 0 ? count / units : 0.0;
+}
+
+void PerfCounters::printReport() const
+{
+	printf("Host counters over %llu instructions, %llu cycles:\n", total.Instructions, total.Cycles);
+	printf("%-16s %16s %16s %16s\n", "counter", "total", "per instruction", "per cycle");
+	for (u32 c = 0; c < CounterCount; c++)
+	{
+		if (!available((Counter)c))
+		{
+			printf("%-16s %16s\n", CounterNames[c], "n/a");
+			continue;
+		}
+		printf("%-16s %16.0f %16.3f %16.3f\n", CounterNames[c], total.Counts[c],
+			Ratio(total.Counts[c], total.Instructions), Ratio(total.Counts[c], total.Cycles));
+	}
+
+	u64 Profiled = 0;
+	for (u32 k = 0; k < ClassCount; k++)
+	{
+		Profiled += classes[k].Instructions;
+	}
+	if (Profiled == 0)
+	{
+		return;
+	}
+
+	// noise can leave a class with less than the calibrated read cost, shown as 0
+	printf("Per instruction by opcode class:\n");
+	printf("%-12s %12s %12s", "class", "instructions", "cycles");
+	for (u32 c = 0; c < CounterCount; c++)
+	{
+		if (available((Counter)c))
+		{
+			printf(" %14s", CounterNames[c]);
+		}
+	}
+	printf("\n");
+	for (u32 k = 0; k < ClassCount; k++)
+	{
+		const Totals& Class = classes[k];
+		if (Class.Instructions == 0)
+		{
+			continue;
+		}
+		printf("%-12s %12llu %12llu", ClassNames[k], Class.Instructions, Class.Cycles);
+		for (u32 c = 0; c < CounterCount; c++)
+		{
+			if (available((Counter)c))
+			{
+				const double PerInstruction = Ratio(Class.Counts[c], Class.Instructions);
+				printf(" %14.3f", PerInstruction > 0 ? PerInstruction : 0.0);
+			}
+		}
+		printf("\n");
+	}
+	fflush(stdout);
+}
+
+bool PerfCounters::writeJSON(const std::string& path) const
+{
+	FILE* file = fopen(path.c_str(), "w");
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	// unavailable counters are null
+	fprintf(file, "{\n  \"version\": 1,\n  \"instructions\": %llu,\n  \"cycles\": %llu,\n  \"counters\": {\n",
+		total.Instructions, total.Cycles);
+	for (u32 c = 0; c < CounterCount; c++)
+	{
+		const char* Separator = c + 1 < CounterCount ? "," : "";
+		if (!available((Counter)c))
+		{
+			fprintf(file, "    \"%s\": null%s\n", CounterNames[c], Separator);
+			continue;
+		}
+		fprintf(file, "    \"%s\": { \"total\": %.0f, \"per_instruction\": %.6f, \"per_cycle\": %.6f }%s\n",
+			CounterNames[c], total.Counts[c], Ratio(total.Counts[c], total.Instructions),
+			Ratio(total.Counts[c], total.Cycles), Separator);
+	}
+	fprintf(file, "  },\n  \"classes\": [\n");
+
+	bool First = true;
+	for (u32 k = 0; k < ClassCount; k++)
+	{
+		const Totals& Class = classes[k];
+		if (Class.Instructions == 0)
+		{
+			continue;
+		}
+		fprintf(file, "%s    { \"class\": \"%s\", \"instructions\": %llu, \"cycles\": %llu, \"per_instruction\": {",
+			First ? "" : ",\n", ClassNames[k], Class.Instructions, Class.Cycles);
+		First = false;
+		for (u32 c = 0; c < CounterCount; c++)
+		{
+			const char* Separator = c + 1 < CounterCount ? "," : "";
+			if (!available((Counter)c))
+			{
+				fprintf(file, " \"%s\": null%s", CounterNames[c], Separator);
+				continue;
+			}
+			const double PerInstruction = Ratio(Class.Counts[c], Class.Instructions);
+			fprintf(file, " \"%s\": %.6f%s", CounterNames[c], PerInstruction > 0 ? PerInstruction : 0.0, Separator);
+		}
+		fprintf(file, " } }");
+	}
+	fprintf(file, "%s  ]\n}\n", First ? "" : "\n");
+	fclose(file);
+	return true;
+}
@@ -0,0 +1,141 @@
+/**
+* Class name: PerfCounters
+* Purpose: Host performance counters around CPU::execute, from Linux perf_event_open.
+*
+* Counts task clock, cycles, instructions, branch misses and L1d read misses of the calling
+* thread in user space, and relates them to the emulated instructions and cycles of the execute
+* calls made through execute(). Counters the host does not offer (virtual machines often have no
+* PMU) are left out and reported as unavailable; on other systems none are available.
+*
+* With profiling on (cpu.profiler = &counters) execute also reads the counters around every
+* instruction and charges the difference to the instruction's opcode class, less the cost of the
+* two reads measured when the counters are opened. Each read is a system call, so profiled runs
+* are many times slower and their totals include the reads; the per class figures do not. The
+* hardware counters exclude the kernel and resolve single instructions, while the task clock
+* includes the time spent inside the reads and only stands out from their jitter for
+* instructions that reach the host, such as device I/O.
+**/
+#pragma once
+#include "Disassembler.h"
+
+class PerfCounters
+{
+public:
+	enum Counter
+	{
+		TaskClock,
+		Cycles,
+		Instructions,
+		BranchMisses,
+		L1DMisses,
+		CounterCount
+	};
+
+	enum OpcodeClass
+	{
+		Load,
+		Store,
+		Transfer,
+		Stack,
+		Arithmetic,
+		Logic,
+		Shift,
+		IncDec,
+		Compare,
+		Branch,
+		Jump,
+		Flag,
+		Other,
+		ClassCount
+	};
+
+	// counter and class names, as used in the report and the JSON file
+	static const char* const CounterNames[CounterCount];
+	static const char* const ClassNames[ClassCount];
+
+	// host counts and the emulated work they were spent on
+	struct Totals
+	{
+		double Counts[CounterCount];
+		u64 Instructions;
+		u64 Cycles;
+	};
+
+	// table classifies the opcodes for profiling
+	explicit PerfCounters(const OpcodeTable& table = Opcodes);
+
+	// destructor, closes the counters
+	~PerfCounters();
+
+	// open the counters for the calling thread, returning false if none could be opened
+	bool open();
+
+	// whether the host offers counter
+	bool available(Counter counter) const { return fds[counter] >= 0; }
+
+	// cpu.execute(cycles, memory) with its host cost added to total
+	template <class CPUType>
+	s32 execute(CPUType& cpu, s32 cycles, CPUBase::Memory& memory)
+	{
+		const u64 Instructions = cpu.TotalInstructions;
+		Sample Start;
+		read(Start);
+		const s32 Used = cpu.execute(cycles, memory);
+		Sample End;
+		read(End);
+		accumulate(total, Start, End, nullptr);
+		total.Instructions += cpu.TotalInstructions - Instructions;
+		total.Cycles += Used;
+		return Used;
+	}
+
+	// called by execute before and after each instruction while this is the CPU's profiler
+	void beginInstruction(Byte opcode, s32 cycles);
+	void endInstruction(s32 cycles);
+
+	// print the totals, and the classes if any instruction was profiled, on the console
+	void printReport() const;
+
+	// write the same as printReport to a JSON file, returning false if it could not be written
+	bool writeJSON(const std::string& path) const;
+
+	// over every execute made through execute()
+	Totals total;
+
+	// over the profiled instructions of each class
+	Totals classes[ClassCount];
+
+private:
+	// counter values of one read, with the times the group was enabled and running
+	struct Sample
+	{
+		u64 Values[CounterCount];
+		u64 Enabled;
+		u64 Running;
+	};
+
+	// read every open counter at once
+	void read(Sample& sample) const;
+
+	// add the counts from start to end, scaled up if the group was multiplexed, less overhead
+	static void accumulate(Totals& totals, const Sample& start, const Sample& end, const double* overhead);
+
+	// file descriptor of each counter, -1 if it is not available
+	int fds[CounterCount];
+
+	// group leader that all counters are read through, and the position of each in a read
+	int leader;
+	u32 slot[CounterCount];
+	u32 opened;
+
+	// class of each opcode
+	Byte classOf[256];
+
+	// mean counts between beginInstruction and endInstruction with no instruction in between
+	double overhead[CounterCount];
+
+	// state of the instruction being profiled
+	Sample instructionStart;
+	Byte instructionClass;
+	s32 instructionCycles;
+};
@@ -0,0 +1,101 @@
+#include "StateHash.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define STATEHASH_SSE2
+#endif
+
+// Memory::hashKey for every address, so the full rehash is a plain multiply-accumulate
+struct HashKeyTable
+{
+	alignas(16) u64 Keys[CPUBase::Memory::MAX_MEM];
+
+	HashKeyTable()
+	{
+		for (u32 i = 0; i < CPUBase::Memory::MAX_MEM; i++)
+		{
+			Keys[i] = CPUBase::Memory::hashKey((Word)i);
+		}
+	}
+};
+
+static const HashKeyTable& Keys()
+{
+	static const HashKeyTable* Table = new HashKeyTable();
+	return *Table;
+}
+
+// hash of one page of data, with Key pointing at the keys of its first address
+static u64 HashPage(const Byte* data, const u64* Key)
+{
+#ifdef STATEHASH_SSE2
+	// two 64-bit lanes; a 64x8 bit product is built from two 32x32 bit multiplies
+	const __m128i Zero = _mm_setzero_si128();
+	__m128i Sum = Zero;
+	for (u32 i = 0; i < CPUBase::Memory::PAGE_SIZE; i += 16)
+	{
+		const __m128i Bytes = _mm_loadu_si128((const __m128i*)&data[i]);
+		const __m128i Words[2] = { _mm_unpacklo_epi8(Bytes, Zero), _mm_unpackhi_epi8(Bytes, Zero) };
+		for (u32 w = 0; w < 2; w++)
+		{
+			const __m128i Dwords[2] = { _mm_unpacklo_epi16(Words[w], Zero), _mm_unpackhi_epi16(Words[w], Zero) };
+			for (u32 d = 0; d < 2; d++)
+			{
+				const __m128i Qwords[2] = { _mm_unpacklo_epi32(Dwords[d], Zero), _mm_unpackhi_epi32(Dwords[d], Zero) };
+				for (u32 q = 0; q < 2; q++)
+				{
+					const __m128i K = _mm_load_si128((const __m128i*)&Key[i + w * 8 + d * 4 + q * 2]);
+					const __m128i Lo = _mm_mul_epu32(K, Qwords[q]);
+					const __m128i Hi = _mm_mul_epu32(_mm_srli_epi64(K, 32), Qwords[q]);
+					Sum = _mm_add_epi64(Sum, _mm_add_epi64(Lo, _mm_slli_epi64(Hi, 32)));
+				}
+			}
+		}
+	}
+	alignas(16) u64 Lanes[2];
+	_mm_store_si128((__m128i*)Lanes, Sum);
+	return Lanes[0] + Lanes[1];
+#else
+	u64 Sum = 0;
+	for (u32 i = 0; i < CPUBase::Memory::PAGE_SIZE; i++)
+	{
+		Sum += Key[i] * data[i];
+	}
+	return Sum;
+#endif
+}
+
+u64 HashMemory(const CPUBase::Memory& memory)
+{
+	const u64* Key = Keys().Keys;
+	u64 Sum = 0;
+	for (u32 Page = 0; Page < CPUBase::Memory::PAGES; Page++)
+	{
+		Sum += HashPage(memory.pages[Page], Key + Page * CPUBase::Memory::PAGE_SIZE);
+	}
+	return Sum;
+}
+
+// mix the registers and status into a memory hash
+static u64 CombineRegisters(const CPUBase& cpu, u64 memoryHash)
+{
+	u64 Registers = cpu.registers.A
+		| ((u64)cpu.registers.X << 8)
+		| ((u64)cpu.registers.Y << 16)
+		| ((u64)cpu.registers.SP << 24)
+		| ((u64)cpu.registers.PC << 32)
+		| ((u64)cpu.PS << 48);
+	Registers = (Registers ^ (Registers >> 31)) * 0x7FB5D329728EA185ull;
+	Registers = (Registers ^ (Registers >> 27)) * 0x81DADEF4BC2DD44Dull;
+	return memoryHash ^ Registers ^ (Registers >> 33);
+}
+
+u64 HashState(const CPUBase& cpu, const CPUBase::Memory& memory)
+{
+	return CombineRegisters(cpu, memory.hash);
+}
+
+u64 RehashState(const CPUBase& cpu, const CPUBase::Memory& memory)
+{
+	return CombineRegisters(cpu, HashMemory(memory));
+}
@@ -0,0 +1,19 @@
+/**
+* Purpose: 64-bit hashing of the whole machine state (registers, PS and memory).
+*
+* The memory part is the sum of Memory::hashKey(address) * read(address) modulo 2^64.
+* Because it is linear in each byte, Memory::write updates it from the old and new
+* byte, so hashing a state never needs to look at all 64 KB. HashMemory recomputes
+* it from scratch for verification, or after the pages were written directly.
+**/
+#pragma once
+#include "CPU.h"
+
+// recompute the memory hash from scratch
+u64 HashMemory(const CPUBase::Memory& memory);
+
+// hash of the machine state, using the incrementally maintained memory hash
+u64 HashState(const CPUBase& cpu, const CPUBase::Memory& memory);
+
+// hash of the machine state, recomputing the memory hash from scratch
+u64 RehashState(const CPUBase& cpu, const CPUBase::Memory& memory);
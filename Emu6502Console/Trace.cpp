@@ -0,0 +1,136 @@
+#include "Trace.h"
+#include <chrono>
+#include <string.h>
+
+constexpr char Tracer::Magic[4];
+
+// records the writer collects before issuing a write, so that the file
+// sees a few large sequential writes instead of one per instruction
+static constexpr u32 WriteBatch = 1 << 16;
+
+// smallest power of two not below value, the ring indexes with a mask
+static u32 RoundUpToPowerOfTwo(u32 value)
+{
+	u32 Power = 1;
+	while (Power < value && Power < 0x80000000u)
+	{
+		Power <<= 1;
+	}
+	return Power;
+}
+
+Tracer::Tracer(u32 capacity)
+	: capacity(RoundUpToPowerOfTwo(capacity)), mask(this->capacity - 1),
+	head(0), tailCache(0), tail(0), stopping(false), file(nullptr), failed(false)
+{
+	buffer = new TraceRecord[this->capacity];
+}
+
+Tracer::~Tracer()
+{
+	close();
+	delete[] buffer;
+}
+
+bool Tracer::open(const std::string& path)
+{
+	close();
+
+	file = fopen(path.c_str(), "wb");
+	if (file == NULL)
+	{
+		return false;
+	}
+	// we only ever write big blocks, stdio buffering would just add a copy
+	setvbuf(file, NULL, _IONBF, 0);
+
+	TraceHeader Header;
+	memcpy(Header.Magic, Magic, sizeof(Header.Magic));
+	Header.Version = Version;
+	Header.RecordSize = sizeof(TraceRecord);
+	Header.Reserved = 0;
+	failed = fwrite(&Header, sizeof(Header), 1, file) != 1;
+
+	head.store(0, std::memory_order_relaxed);
+	tail.store(0, std::memory_order_relaxed);
+	tailCache = 0;
+	stopping.store(false, std::memory_order_relaxed);
+	writer = std::thread(&Tracer::drain, this);
+	return true;
+}
+
+bool Tracer::close()
+{
+	if (writer.joinable())
+	{
+		stopping.store(true, std::memory_order_release);
+		writer.join();
+	}
+	if (file)
+	{
+		failed |= fclose(file) != 0;
+		file = nullptr;
+	}
+	return !failed;
+}
+
+void Tracer::waitForSpace(u64 Head)
+{
+	tailCache = tail.load(std::memory_order_acquire);
+	while (Head - tailCache >= capacity)
+	{
+		std::this_thread::yield();
+		tailCache = tail.load(std::memory_order_acquire);
+	}
+}
+
+void Tracer::writeRange(u64 from, u64 to)
+{
+	// the range may wrap around the end of the ring, split it in two
+	while (from < to)
+	{
+		const u32 Start = (u32)(from & mask);
+		u64 Count = to - from;
+		if (Start + Count > capacity)
+		{
+			Count = capacity - Start;
+		}
+		// after a failed write the records are still consumed, so the CPU is never blocked
+		if (!failed && fwrite(&buffer[Start], sizeof(TraceRecord), (size_t)Count, file) != Count)
+		{
+			failed = true;
+		}
+		from += Count;
+	}
+}
+
+void Tracer::drain()
+{
+	// small rings must not wait for more records than they can hold
+	u64 Batch = capacity / 2 < WriteBatch ? capacity / 2 : WriteBatch;
+	if (Batch == 0)
+	{
+		Batch = 1;
+	}
+
+	u64 Tail = tail.load(std::memory_order_relaxed);
+	while (true)
+	{
+		const bool Stop = stopping.load(std::memory_order_acquire);
+		const u64 Head = head.load(std::memory_order_acquire);
+		if (Head - Tail >= Batch || (Stop && Head != Tail))
+		{
+			writeRange(Tail, Head);
+			Tail = Head;
+			tail.store(Tail, std::memory_order_release);
+		}
+		else if (Stop)
+		{
+			break;
+		}
+		else
+		{
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+		}
+	}
+}
@@ -0,0 +1,122 @@
+/**
+* Class name: Tracer
+* Purpose: Record every executed instruction into a compact binary trace file
+**/
+#pragma once
+#include <atomic>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include "CPU.h"
+
+#pragma pack(push, 1)
+// one executed instruction, captured before it runs
+struct TraceRecord
+{
+	// low 32 bits of the cycle count at the start of the instruction
+	u32 Cycles;
+	// address of the opcode
+	Word PC;
+	// opcode and the two bytes that follow it
+	Byte Opcode;
+	Byte Operands[2];
+	// registers and status
+	Byte A;
+	Byte X;
+	Byte Y;
+	Byte SP;
+	Byte PS;
+	Byte Reserved[2];
+};
+
+// trace file header, followed by a stream of TraceRecords
+struct TraceHeader
+{
+	char Magic[4];
+	u32 Version;
+	u32 RecordSize;
+	u32 Reserved;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord must stay 16 bytes");
+
+class Tracer
+{
+public:
+	static constexpr char Magic[4] = { 'E', '6', 'T', 'R' };
+	static constexpr u32 Version = 1;
+
+	// ring buffer size in records
+	static constexpr u32 DefaultCapacity = 1 << 20;
+
+	// constructor, capacity is rounded up to a power of two
+	explicit Tracer(u32 capacity = DefaultCapacity);
+
+	// destructor, flushes and closes the trace file, use close to learn if that failed
+	~Tracer();
+
+	// open the trace file and start the writer thread
+	bool open(const std::string& path);
+
+	// drain the ring buffer, stop the writer thread and close the file. False if writing the
+	// trace failed at any point since open, the file is then truncated
+	bool close();
+
+	// number of records handed to the writer so far
+	u64 recorded() const { return head.load(std::memory_order_relaxed); }
+
+	// record the instruction about to execute at cpu.registers.PC
+	void record(const CPUBase& cpu, const CPUBase::Memory& memory, u64 cycles)
+	{
+		const u64 Head = head.load(std::memory_order_relaxed);
+		if (Head - tailCache >= capacity)
+		{
+			waitForSpace(Head);
+		}
+
+		TraceRecord& Record = buffer[Head & mask];
+		const Word PC = cpu.registers.PC;
+		Record.Cycles = (u32)cycles;
+		Record.PC = PC;
+		Record.Opcode = memory.read(PC);
+		Record.Operands[0] = memory.read((Word)(PC + 1));
+		Record.Operands[1] = memory.read((Word)(PC + 2));
+		Record.A = cpu.registers.A;
+		Record.X = cpu.registers.X;
+		Record.Y = cpu.registers.Y;
+		Record.SP = cpu.registers.SP;
+		Record.PS = cpu.PS;
+		Record.Reserved[0] = 0;
+		Record.Reserved[1] = 0;
+
+		head.store(Head + 1, std::memory_order_release);
+	}
+
+private:
+	// block the CPU thread until the writer has freed a slot
+	void waitForSpace(u64 Head);
+
+	// writer thread body
+	void drain();
+
+	// write records [from, to) to the file
+	void writeRange(u64 from, u64 to);
+
+	TraceRecord* buffer;
+	const u32 capacity;
+	const u32 mask;
+
+	// producer side (CPU thread)
+	alignas(64) std::atomic<u64> head;
+	u64 tailCache;
+
+	// consumer side (writer thread)
+	alignas(64) std::atomic<u64> tail;
+	std::atomic<bool> stopping;
+
+	FILE* file;
+	std::thread writer;
+	// a write to the file failed, set by open and the writer thread and read after it is joined
+	bool failed;
+};
@@ -0,0 +1,12 @@
+/**
+* Purpose: Integer types shared by the emulator sources.
+**/
+#pragma once
+
+using SByte = char;
+using Byte = unsigned char;
+using Word = unsigned short;
+
+using u32 = unsigned int;
+using s32 = int;
+using u64 = unsigned long long;
@@ -0,0 +1,514 @@
+#include "VideoDevice.h"
+#include <algorithm>
+#include <ctype.h>
+#include <iostream>
+#include <new>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <tmmintrin.h>
+#define VIDEO_SSSE3
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SSSE3_TARGET
+#else
+#define SSSE3_TARGET __attribute__((target("ssse3")))
+#endif
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// palette until the guest writes its own, the 16 CGA colours
+static const u32 DefaultPalette[VideoDevice::Colours] = {
+	0x000000, 0x0000AA, 0x00AA00, 0x00AAAA, 0xAA0000, 0xAA00AA, 0xAA5500, 0xAAAAAA,
+	0x555555, 0x5555FF, 0x55FF55, 0x55FFFF, 0xFF5555, 0xFF55FF, 0xFFFF55, 0xFFFFFF,
+};
+
+// stored deflate blocks hold at most this many bytes
+static constexpr u32 StoredBlockSize = 65535;
+
+static bool HostHasSSSE3()
+{
+#if !defined(VIDEO_SSSE3)
+	return false;
+#elif defined(_MSC_VER)
+	int Info[4];
+	__cpuid(Info, 1);
+	return (Info[2] & (1 << 9)) != 0;
+#else
+	return __builtin_cpu_supports("ssse3");
+#endif
+}
+
+#ifdef VIDEO_SSSE3
+// 16 VRAM bytes to 32 RGBA pixels: split the nibbles into pixel order, look each channel up
+// with one shuffle per 16 pixels, then interleave the channels into pixels
+SSSE3_TARGET static void ConvertSSSE3(const Byte* source, u32 count, u32* destination, const Byte (*channels)[16])
+{
+	const __m128i Low = _mm_set1_epi8(0x0F);
+	const __m128i Tables[4] = {
+		_mm_load_si128((const __m128i*)channels[0]), _mm_load_si128((const __m128i*)channels[1]),
+		_mm_load_si128((const __m128i*)channels[2]), _mm_load_si128((const __m128i*)channels[3]),
+	};
+	u32 i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		const __m128i Bytes = _mm_loadu_si128((const __m128i*)(source + i));
+		const __m128i Left = _mm_and_si128(_mm_srli_epi16(Bytes, 4), Low);
+		const __m128i Right = _mm_and_si128(Bytes, Low);
+		const __m128i Indices[2] = { _mm_unpacklo_epi8(Left, Right), _mm_unpackhi_epi8(Left, Right) };
+		for (u32 h = 0; h < 2; h++)
+		{
+			const __m128i R = _mm_shuffle_epi8(Tables[0], Indices[h]);
+			const __m128i G = _mm_shuffle_epi8(Tables[1], Indices[h]);
+			const __m128i B = _mm_shuffle_epi8(Tables[2], Indices[h]);
+			const __m128i A = _mm_shuffle_epi8(Tables[3], Indices[h]);
+			const __m128i RGLow = _mm_unpacklo_epi8(R, G);
+			const __m128i RGHigh = _mm_unpackhi_epi8(R, G);
+			const __m128i BALow = _mm_unpacklo_epi8(B, A);
+			const __m128i BAHigh = _mm_unpackhi_epi8(B, A);
+			__m128i* Out = (__m128i*)(destination + i * 2 + h * 16);
+			_mm_storeu_si128(Out + 0, _mm_unpacklo_epi16(RGLow, BALow));
+			_mm_storeu_si128(Out + 1, _mm_unpackhi_epi16(RGLow, BALow));
+			_mm_storeu_si128(Out + 2, _mm_unpacklo_epi16(RGHigh, BAHigh));
+			_mm_storeu_si128(Out + 3, _mm_unpackhi_epi16(RGHigh, BAHigh));
+		}
+	}
+}
+#endif
+
+// the printf format for one frame file from a pattern holding a single integer conversion with
+// optional 0 or - flags, width and precision (frame%05d.png), converting an unsigned long long;
+// empty if the pattern holds any other %
+static std::string FrameNumberFormat(const std::string& pattern)
+{
+	const size_t Percent = pattern.find('%');
+	size_t End = Percent + 1;
+	while (End < pattern.size() && (pattern[End] == '0' || pattern[End] == '-'))
+	{
+		End++;
+	}
+	while (End < pattern.size() && (isdigit((unsigned char)pattern[End]) || pattern[End] == '.'))
+	{
+		End++;
+	}
+	const size_t Spec = End;
+	// length modifiers are replaced by ll
+	while (End < pattern.size() && strchr("hljzt", pattern[End]))
+	{
+		End++;
+	}
+	if (End >= pattern.size() || !strchr("diu", pattern[End]) || pattern.find('%', End) != std::string::npos)
+	{
+		return std::string();
+	}
+	return pattern.substr(0, Spec) + "llu" + pattern.substr(End + 1);
+}
+
+// CRC-32 of PNG chunks
+static u32 Crc32(u32 crc, const Byte* data, size_t size)
+{
+	struct CrcTable
+	{
+		u32 Entries[256];
+
+		CrcTable()
+		{
+			for (u32 n = 0; n < 256; n++)
+			{
+				u32 c = n;
+				for (u32 k = 0; k < 8; k++)
+				{
+					c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+				}
+				Entries[n] = c;
+			}
+		}
+	};
+	static const CrcTable Table;
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++)
+	{
+		crc = Table.Entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+// Adler-32 of the zlib stream, reducing only every 5552 bytes where the sums cannot overflow
+static u32 Adler32(const Byte* data, size_t size)
+{
+	u32 A = 1;
+	u32 B = 0;
+	while (size > 0)
+	{
+		const size_t Block = size < 5552 ? size : 5552;
+		for (size_t i = 0; i < Block; i++)
+		{
+			A += data[i];
+			B += A;
+		}
+		A %= 65521;
+		B %= 65521;
+		data += Block;
+		size -= Block;
+	}
+	return (B << 16) | A;
+}
+
+static void PutBigEndian(std::vector<Byte>& out, u32 value)
+{
+	const Byte Bytes[4] = { (Byte)(value >> 24), (Byte)(value >> 16), (Byte)(value >> 8), (Byte)value };
+	out.insert(out.end(), Bytes, Bytes + 4);
+}
+
+// append a chunk whose data is the last size bytes of out, after the length and type
+static void FinishChunk(std::vector<Byte>& out, size_t start)
+{
+	const u32 Size = (u32)(out.size() - start - 8);
+	out[start] = (Byte)(Size >> 24);
+	out[start + 1] = (Byte)(Size >> 16);
+	out[start + 2] = (Byte)(Size >> 8);
+	out[start + 3] = (Byte)Size;
+	PutBigEndian(out, Crc32(0, out.data() + start + 4, Size + 4));
+}
+
+static size_t BeginChunk(std::vector<Byte>& out, const char* type)
+{
+	const size_t Start = out.size();
+	PutBigEndian(out, 0);
+	out.insert(out.end(), type, type + 4);
+	return Start;
+}
+
+VideoDevice::VideoDevice(Word base, u64 frameCycles, u32 width, u32 height)
+	: AsyncDevice(windowSize(width, height)), base(base), frameCycles(frameCycles), width(width), height(height),
+	frames(0), tilesConverted(0), unchangedFrames(0),
+	rowBytes(width / 2), tilesX(width / TileSize), tilesY(height / TileSize), controlBase(size - ControlSize),
+	vram(rowBytes * height, 0x00), dirty(tilesX * tilesY, 1), paletteChanged(true), pixels(width * height, 0),
+	useSSSE3(HostHasSSSE3()), nextVBlank(frameCycles), framesSeen(0),
+	rawFile(nullptr), pngFile(nullptr), shared(nullptr), sharedSize(0)
+{
+	for (u32 c = 0; c < Colours; c++)
+	{
+		const u32 RGB = DefaultPalette[c];
+		Byte* Entry = palette + c * ColourBytes;
+		Entry[0] = (Byte)(RGB >> 16);
+		Entry[1] = (Byte)(RGB >> 8);
+		Entry[2] = (Byte)RGB;
+		Entry[3] = 0xFF;
+	}
+	// so the guest reads back the default palette
+	memcpy(shadow + controlBase + Palette, palette, sizeof(palette));
+	loadPalette();
+}
+
+VideoDevice::~VideoDevice()
+{
+	stop();
+	if (rawFile)
+	{
+		fclose(rawFile);
+	}
+	if (pngFile)
+	{
+		fclose(pngFile);
+	}
+#ifndef _WIN32
+	if (shared)
+	{
+		munmap(shared, sharedSize);
+		shm_unlink(sharedName.c_str());
+	}
+#endif
+}
+
+u32 VideoDevice::windowSize(u32 width, u32 height)
+{
+	u32 Size = CPUBase::Memory::PAGE_SIZE;
+	while (Size < width / 2 * height + ControlSize)
+	{
+		Size *= 2;
+	}
+	return Size;
+}
+
+void VideoDevice::map(CPUBase& cpu)
+{
+	cpu.mapDevice(this, base, (Word)(base + size - 1));
+}
+
+bool VideoDevice::openRaw(const std::string& path)
+{
+	rawFile = fopen(path.c_str(), "wb");
+	return rawFile != NULL;
+}
+
+bool VideoDevice::openPNG(const std::string& path)
+{
+	if (path.find('%') != std::string::npos)
+	{
+		pngPattern = FrameNumberFormat(path);
+		return !pngPattern.empty();
+	}
+	pngFile = fopen(path.c_str(), "wb");
+	return pngFile != NULL;
+}
+
+bool VideoDevice::openSharedMemory(const std::string& name)
+{
+#ifdef _WIN32
+	return false;
+#else
+	sharedSize = SharedFrame::PixelOffset + pixels.size() * sizeof(u32);
+	const int Fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+	if (Fd < 0)
+	{
+		return false;
+	}
+	void* Mapped = MAP_FAILED;
+	if (ftruncate(Fd, (off_t)sharedSize) == 0)
+	{
+		Mapped = mmap(nullptr, sharedSize, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+	}
+	close(Fd);
+	if (Mapped == MAP_FAILED)
+	{
+		shm_unlink(name.c_str());
+		return false;
+	}
+	shared = new (Mapped) SharedFrame();
+	shared->Magic = SharedFrame::MagicValue;
+	shared->Width = width;
+	shared->Height = height;
+	shared->Reserved = 0;
+	shared->Sequence.store(0, std::memory_order_relaxed);
+	shared->Cycle = 0;
+	sharedName = name;
+	return true;
+#endif
+}
+
+void VideoDevice::printStats() const
+{
+	std::cout << "Video frames: " << frames << '\n';
+	std::cout << "Unchanged frames: " << unchangedFrames << '\n';
+	std::cout << "Tiles converted: " << tilesConverted << " of " << frames * tilesX * tilesY << std::endl;
+}
+
+void VideoDevice::advance(u64 cycle)
+{
+	while (cycle >= nextVBlank)
+	{
+		completeFrame(nextVBlank);
+		nextVBlank += frameCycles;
+	}
+}
+
+void VideoDevice::registerWritten(u32 reg, Byte value, u64 /*cycle*/)
+{
+	if (reg < vram.size())
+	{
+		if (vram[reg] != value)
+		{
+			vram[reg] = value;
+			const u32 Row = reg / rowBytes;
+			dirty[(Row / TileSize) * tilesX + (reg - Row * rowBytes) * 2 / TileSize] = 1;
+		}
+	}
+	else if (reg >= controlBase + Palette && reg < controlBase + Palette + sizeof(palette))
+	{
+		palette[reg - controlBase - Palette] = value;
+		paletteChanged = true;
+	}
+}
+
+bool VideoDevice::readHasSideEffect(u32 reg) const
+{
+	return reg == controlBase + Status || reg == controlBase + FrameCount;
+}
+
+Byte VideoDevice::registerRead(u32 reg, u64 /*cycle*/)
+{
+	if (reg == controlBase + Status)
+	{
+		const bool Completed = frames != framesSeen;
+		framesSeen = frames;
+		return Completed ? VBlank : 0x00;
+	}
+	return (Byte)frames;
+}
+
+void VideoDevice::loadPalette()
+{
+	const Byte* Entries = palette;
+	for (u32 c = 0; c < Colours; c++)
+	{
+		for (u32 k = 0; k < ColourBytes; k++)
+		{
+			channels[k][c] = Entries[c * ColourBytes + k];
+		}
+	}
+	for (u32 b = 0; b < 256; b++)
+	{
+		u32 Pixel[2];
+		memcpy(&Pixel[0], Entries + (b >> 4) * ColourBytes, ColourBytes);
+		memcpy(&Pixel[1], Entries + (b & 0x0F) * ColourBytes, ColourBytes);
+		memcpy(&pairs[b], Pixel, sizeof(pairs[b]));
+	}
+}
+
+void VideoDevice::convert(const Byte* source, u32 count, u32* destination) const
+{
+	u32 i = 0;
+#ifdef VIDEO_SSSE3
+	if (useSSSE3)
+	{
+		ConvertSSSE3(source, count, destination, channels);
+		i = count & ~15u;
+	}
+#endif
+	for (; i < count; i++)
+	{
+		memcpy(destination + i * 2, &pairs[source[i]], sizeof(u64));
+	}
+}
+
+void VideoDevice::completeFrame(u64 cycle)
+{
+	if (paletteChanged)
+	{
+		loadPalette();
+		std::fill(dirty.begin(), dirty.end(), 1);
+		paletteChanged = false;
+	}
+
+	// runs of adjacent dirty tiles, converted a scanline at a time
+	u32 Converted = 0;
+	const u32 TileBytes = TileSize / 2;
+	for (u32 ty = 0; ty < tilesY; ty++)
+	{
+		Byte* Row = &dirty[ty * tilesX];
+		for (u32 tx = 0; tx < tilesX;)
+		{
+			if (!Row[tx])
+			{
+				tx++;
+				continue;
+			}
+			u32 End = tx;
+			while (End < tilesX && Row[End])
+			{
+				Row[End++] = 0;
+			}
+			for (u32 y = ty * TileSize; y < (ty + 1) * TileSize; y++)
+			{
+				convert(&vram[y * rowBytes + tx * TileBytes], (End - tx) * TileBytes, &pixels[y * width + tx * TileSize]);
+			}
+			Converted += End - tx;
+			tx = End;
+		}
+	}
+	tilesConverted += Converted;
+	if (Converted == 0)
+	{
+		unchangedFrames++;
+	}
+	frames++;
+	writeOutputs(Converted > 0, cycle);
+}
+
+void VideoDevice::encodePNG()
+{
+	// filter byte 0 before every row, then the rows as stored (uncompressed) deflate blocks:
+	// the pixels are already in memory, and compressing them would cost more than writing them
+	const u32 Stride = width * 4;
+	scanlines.resize((size_t)(Stride + 1) * height);
+	for (u32 y = 0; y < height; y++)
+	{
+		scanlines[(size_t)y * (Stride + 1)] = 0;
+		memcpy(&scanlines[(size_t)y * (Stride + 1) + 1], &pixels[y * width], Stride);
+	}
+
+	static const Byte Signature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+	png.assign(Signature, Signature + sizeof(Signature));
+
+	size_t Chunk = BeginChunk(png, "IHDR");
+	PutBigEndian(png, width);
+	PutBigEndian(png, height);
+	// 8 bits per channel, RGBA, deflate, adaptive filtering, no interlace
+	const Byte Format[5] = { 8, 6, 0, 0, 0 };
+	png.insert(png.end(), Format, Format + sizeof(Format));
+	FinishChunk(png, Chunk);
+
+	Chunk = BeginChunk(png, "IDAT");
+	png.push_back(0x78);
+	png.push_back(0x01);
+	for (size_t Offset = 0; Offset < scanlines.size(); Offset += StoredBlockSize)
+	{
+		const u32 Size = (u32)std::min<size_t>(StoredBlockSize, scanlines.size() - Offset);
+		const bool Last = Offset + Size == scanlines.size();
+		const Byte Header[5] = { (Byte)(Last ? 1 : 0), (Byte)Size, (Byte)(Size >> 8), (Byte)~Size, (Byte)(~Size >> 8) };
+		png.insert(png.end(), Header, Header + sizeof(Header));
+		png.insert(png.end(), scanlines.begin() + Offset, scanlines.begin() + Offset + Size);
+	}
+	PutBigEndian(png, Adler32(scanlines.data(), scanlines.size()));
+	FinishChunk(png, Chunk);
+
+	Chunk = BeginChunk(png, "IEND");
+	FinishChunk(png, Chunk);
+}
+
+void VideoDevice::writeOutputs(bool changed, u64 cycle)
+{
+	if (rawFile)
+	{
+		fwrite(pixels.data(), sizeof(u32), pixels.size(), rawFile);
+	}
+
+	if (pngFile || !pngPattern.empty())
+	{
+		if (changed || png.empty())
+		{
+			encodePNG();
+		}
+		if (pngFile)
+		{
+			fwrite(png.data(), 1, png.size(), pngFile);
+		}
+		else
+		{
+			const unsigned long long Frame = frames - 1;
+			std::string Path(snprintf(NULL, 0, pngPattern.c_str(), Frame), '\0');
+			snprintf(&Path[0], Path.size() + 1, pngPattern.c_str(), Frame);
+			FILE* File = fopen(Path.c_str(), "wb");
+			if (File)
+			{
+				fwrite(png.data(), 1, png.size(), File);
+				fclose(File);
+			}
+			else
+			{
+				// report the first failure and write no further frames
+				std::cout << "Error: Could not open file: " << Path << std::endl;
+				pngPattern.clear();
+			}
+		}
+	}
+
+	if (shared)
+	{
+		// a reader copies the frame, then checks that Sequence is even and has not changed
+		const u64 Sequence = shared->Sequence.load(std::memory_order_relaxed);
+		shared->Sequence.store(Sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		if (changed)
+		{
+			memcpy((Byte*)shared + SharedFrame::PixelOffset, pixels.data(), pixels.size() * sizeof(u32));
+		}
+		shared->Cycle = cycle;
+		shared->Sequence.store(frames * 2, std::memory_order_release);
+	}
+}
@@ -0,0 +1,169 @@
+/**
+* Class name: VideoDevice
+* Purpose: Headless memory-mapped framebuffer that turns the guest's indexed-colour VRAM into
+*          RGBA frames on disk or in shared memory, with no GPU or window system.
+*
+* The device takes a window of size bytes (a power of two, and the window must start on a
+* multiple of it). VRAM comes first: width x height pixels at 4 bits per pixel, width / 2 bytes
+* per row, the left pixel of each pair in the high nibble. The registers sit at the top of the
+* window, from ControlBase:
+*	- Palette:    16 entries of R, G, B, A bytes (read and write)
+*	- Status:     bit 7 set if a frame was completed since the last read of Status, which clears it
+*	- FrameCount: low byte of the number of frames completed
+*
+* Every frameCycles cycles, at vblank, the frame is converted and written to the open outputs.
+* All of that runs on the AsyncDevice worker, so the CPU only pays for queueing its writes.
+* Frames depend only on the cycles of the writes, never on how the threads are scheduled.
+*
+* Conversion works on 8x8 pixel tiles. A write that changes VRAM marks its tile dirty, and
+* vblank converts only the dirty tiles, one run of adjacent tiles per scanline, through SSSE3
+* shuffles that look up 32 pixels at a time where the host has them. Changing the palette
+* converts the whole frame again. An unchanged frame reuses its encoded PNG.
+**/
+#pragma once
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "AsyncDevice.h"
+
+class VideoDevice : public AsyncDevice
+{
+public:
+	// default screen, 20 x 15 tiles
+	static constexpr u32 DefaultWidth = 160;
+	static constexpr u32 DefaultHeight = 120;
+
+	// tiles are TileSize x TileSize pixels
+	static constexpr u32 TileSize = 8;
+
+	// palette entries and bytes per entry
+	static constexpr u32 Colours = 16;
+	static constexpr u32 ColourBytes = 4;
+
+	// bytes of registers at the top of the window
+	static constexpr u32 ControlSize = 128;
+
+	// register offsets from ControlBase
+	static constexpr u32 Palette = 0;
+	static constexpr u32 Status = Colours * ColourBytes;
+	static constexpr u32 FrameCount = Status + 1;
+
+	// Status bits
+	static constexpr Byte VBlank = 0x80;
+
+	// the shared memory a frame is published in: this header, then width * height RGBA pixels at
+	// PixelOffset. Sequence is odd while a frame is being written and 2 * frames once it is done
+	struct SharedFrame
+	{
+		static constexpr u32 MagicValue = 0x56353645;	// "E65V"
+		static constexpr u32 PixelOffset = 64;
+
+		u32 Magic;
+		u32 Width;
+		u32 Height;
+		u32 Reserved;
+		std::atomic<u64> Sequence;
+		// cycle of the vblank that completed the frame
+		u64 Cycle;
+	};
+
+	// width and height multiples of TileSize, mapped from base; frameCycles between vblanks
+	VideoDevice(Word base, u64 frameCycles, u32 width = DefaultWidth, u32 height = DefaultHeight);
+
+	// destructor, stops the worker and closes the outputs
+	~VideoDevice();
+
+	// bytes of address space the device takes, base must be a multiple of it
+	static u32 windowSize(u32 width, u32 height);
+
+	// map the window into cpu
+	void map(CPUBase& cpu);
+
+	// outputs, to be opened before start(). Each returns false if it could not be opened
+	// every frame as raw RGBA, appended to the file at path
+	bool openRaw(const std::string& path);
+	// every frame as a PNG, one file per frame if path holds a printf pattern for the frame
+	// number (frame%05d.png), otherwise one concatenated stream (ffmpeg -f image2pipe). Also
+	// false if the pattern holds anything but one integer conversion
+	bool openPNG(const std::string& path);
+	// the latest frame in POSIX shared memory under name (see SharedFrame)
+	bool openSharedMemory(const std::string& name);
+
+	// print the frame and conversion counters on the console, with the worker stopped or synced
+	void printStats() const;
+
+	// the last completed frame, width * height RGBA pixels
+	const u32* frame() const { return pixels.data(); }
+
+	const Word base;
+	const u64 frameCycles;
+	const u32 width;
+	const u32 height;
+
+	// frames completed, tiles converted and frames with no tile to convert
+	u64 frames;
+	u64 tilesConverted;
+	u64 unchangedFrames;
+
+protected:
+	// AsyncDevice
+	void advance(u64 cycle) override;
+	void registerWritten(u32 reg, Byte value, u64 cycle) override;
+	bool readHasSideEffect(u32 reg) const override;
+	Byte registerRead(u32 reg, u64 cycle) override;
+
+private:
+	// convert the dirty tiles and write the frame that ends at cycle to the outputs
+	void completeFrame(u64 cycle);
+
+	// rebuild the lookup tables from palette
+	void loadPalette();
+
+	// convert count VRAM bytes (2 * count pixels) of one scanline
+	void convert(const Byte* source, u32 count, u32* destination) const;
+
+	// encode pixels as a PNG into png
+	void encodePNG();
+
+	void writeOutputs(bool changed, u64 cycle);
+
+	// VRAM bytes per row, tiles per row and column
+	const u32 rowBytes;
+	const u32 tilesX;
+	const u32 tilesY;
+
+	// offset of the registers in the window
+	const u32 controlBase;
+
+	// VRAM as the worker has applied it, and one flag per tile written since the last frame
+	std::vector<Byte> vram;
+	std::vector<Byte> dirty;
+	// the palette registers as the worker has applied them; the shadow registers run ahead
+	Byte palette[Colours * ColourBytes];
+	bool paletteChanged;
+
+	// the converted frame
+	std::vector<u32> pixels;
+
+	// the palette one channel at a time, as shuffle tables, and as the RGBA pixels of both
+	// halves of every VRAM byte for the scalar path
+	alignas(16) Byte channels[ColourBytes][Colours];
+	u64 pairs[256];
+	bool useSSSE3;
+
+	// cycle of the next vblank
+	u64 nextVBlank;
+
+	// frames at the last read of Status, CPU thread only
+	u64 framesSeen;
+
+	// outputs
+	FILE* rawFile;
+	FILE* pngFile;
+	std::string pngPattern;
+	std::vector<Byte> png;
+	std::vector<Byte> scanlines;
+	SharedFrame* shared;
+	size_t sharedSize;
+	std::string sharedName;
+};
@@ -0,0 +1,376 @@
+// usage: Emu6502Fuzz --rom <file> --input <address>:<length> [--input ...]
+//                    [--start <address>] [--warmup <cycles>] [--cycles <count>]
+//                    [--execs <count>] [--seed <value>] [--threads <count>] [--out <prefix>]
+//
+//   --rom      ROM image loaded at $0000 with CPU::loadROM
+//   --input    memory region the input bytes are written to, may be repeated;
+//              the input is the concatenation of all regions
+//   --start    start address (default: the reset vector at $FFFC)
+//   --warmup   cycles to run before taking the snapshot every case starts from (default 0)
+//   --cycles   cycles to run per case (default 2000)
+//   --execs    total number of cases to run (default 1000000)
+//   --out      write inputs that execute an unknown instruction to <prefix>crash-<n>.bin, where
+//              n numbers every crash; only crashes that also reach new coverage are written
+//
+
+#include "CoverageFuzz.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "../Emu6502Console/CPU.h"
+
+struct InputRegion
+{
+	Word Address;
+	Word Length;
+};
+
+struct CoverageOptions
+{
+	std::string RomPath;
+	std::vector<InputRegion> Regions;
+	bool HasStart = false;
+	Word Start = 0;
+	u64 Warmup = 0;
+	s32 Cycles = 2000;
+	u64 Execs = 1000000;
+	u64 Seed = 1;
+	u32 Threads = 0;
+	std::string OutPrefix;
+};
+
+// state shared by all workers
+struct FuzzShared
+{
+	const CoverageOptions* Options;
+	const CPU::Snapshot* Snapshot;
+
+	// every hit count bucket seen so far, per edge
+	std::atomic<Byte>* Virgin;
+
+	std::mutex CorpusLock;
+	std::vector<std::vector<Byte>> Corpus;
+
+	std::atomic<u64> Execs{ 0 };
+	std::atomic<u64> Crashes{ 0 };
+};
+
+static u64 NextRandom(u64& state)
+{
+	u64 z = (state += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+// hit count buckets, so that loops running a few more times do not count as new coverage
+static Byte Bucket(Byte hits)
+{
+	if (hits <= 3) return hits == 3 ? 4 : hits;
+	if (hits <= 7) return 8;
+	if (hits <= 15) return 16;
+	if (hits <= 31) return 32;
+	if (hits <= 127) return 64;
+	return 128;
+}
+
+// fold a case's hit counts into the shared map, clearing them, and report whether anything was new
+static bool MergeCoverage(Byte* trace, std::atomic<Byte>* virgin)
+{
+	bool New = false;
+	u64* Words = (u64*)trace;
+	for (u32 w = 0; w < CPU::CoverageMapSize / 8; w++)
+	{
+		if (Words[w] == 0)
+		{
+			continue;
+		}
+		for (u32 i = w * 8; i < w * 8 + 8; i++)
+		{
+			if (trace[i] == 0)
+			{
+				continue;
+			}
+			const Byte B = Bucket(trace[i]);
+			if ((virgin[i].load(std::memory_order_relaxed) & B) == 0)
+			{
+				virgin[i].fetch_or(B, std::memory_order_relaxed);
+				New = true;
+			}
+		}
+		Words[w] = 0;
+	}
+	return New;
+}
+
+static void Mutate(std::vector<Byte>& input, u64& state)
+{
+	static const Byte Interesting[] = { 0x00, 0x01, 0x7F, 0x80, 0xFF };
+	if (input.empty())
+	{
+		return;
+	}
+	const u32 Count = 1 + (u32)(NextRandom(state) % 8);
+	for (u32 i = 0; i < Count; i++)
+	{
+		const u64 Random = NextRandom(state);
+		Byte& Target = input[(Random >> 8) % input.size()];
+		switch (Random % 4)
+		{
+		case 0:
+			Target ^= 1 << ((Random >> 40) & 7);
+			break;
+		case 1:
+			Target = (Byte)(Random >> 40);
+			break;
+		case 2:
+			Target = Interesting[(Random >> 40) % sizeof(Interesting)];
+			break;
+		case 3:
+			Target += (Byte)(((Random >> 40) % 33) - 16);
+			break;
+		}
+	}
+}
+
+static void Worker(FuzzShared& shared, u32 index)
+{
+	const CoverageOptions& Options = *shared.Options;
+	CPU* cpu = new CPU();
+	CPU::Memory* memory = new CPU::Memory();
+	Byte* trace = new Byte[CPU::CoverageMapSize]();
+	cpu->coverage = trace;
+	cpu->verbose = false;
+
+	u64 State = Options.Seed + index * 0x1000193ull;
+	std::vector<Byte> Input;
+	while (shared.Execs.fetch_add(1, std::memory_order_relaxed) < Options.Execs)
+	{
+		{
+			std::lock_guard<std::mutex> Lock(shared.CorpusLock);
+			Input = shared.Corpus[NextRandom(State) % shared.Corpus.size()];
+		}
+		Mutate(Input, State);
+
+		// start from the warmed-up snapshot instead of a reset
+		cpu->restoreSnapshot(*shared.Snapshot, *memory);
+		size_t At = 0;
+		for (const InputRegion& Region : Options.Regions)
+		{
+			for (Word i = 0; i < Region.Length; i++)
+			{
+				memory->write(Region.Address + i, Input[At++]);
+			}
+		}
+		cpu->execute(Options.Cycles, *memory);
+
+		// every crash counts, even along edges that were seen before
+		const bool Crashed = cpu->UnknownInstructions != shared.Snapshot->UnknownInstructions;
+		const u64 Number = Crashed ? shared.Crashes.fetch_add(1) : 0;
+		if (MergeCoverage(trace, shared.Virgin))
+		{
+			if (Crashed && !Options.OutPrefix.empty())
+			{
+				std::string Path = Options.OutPrefix + "crash-" + std::to_string(Number) + ".bin";
+				FILE* file = fopen(Path.c_str(), "wb");
+				if (file)
+				{
+					fwrite(Input.data(), 1, Input.size(), file);
+					fclose(file);
+				}
+			}
+			std::lock_guard<std::mutex> Lock(shared.CorpusLock);
+			shared.Corpus.push_back(Input);
+		}
+	}
+
+	cpu->coverage = nullptr;
+	delete[] trace;
+	delete memory;
+	delete cpu;
+}
+
+static bool ParseRegion(const char* text, InputRegion& region)
+{
+	char* End;
+	const unsigned long Address = strtoul(text, &End, 0);
+	if (*End != ':' || Address > 0xFFFF)
+	{
+		return false;
+	}
+	const unsigned long Length = strtoul(End + 1, &End, 0);
+	if (*End != '\0' || Length == 0 || Address + Length > 0x10000)
+	{
+		return false;
+	}
+	region.Address = (Word)Address;
+	region.Length = (Word)Length;
+	return true;
+}
+
+int RunCoverageFuzzer(int argc, char* argv[])
+{
+	CoverageOptions options;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--rom") == 0 && i + 1 < argc)
+		{
+			options.RomPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc)
+		{
+			InputRegion Region;
+			if (!ParseRegion(argv[++i], Region))
+			{
+				fprintf(stderr, "Error: Bad input region: %s\n", argv[i]);
+				return 1;
+			}
+			options.Regions.push_back(Region);
+		}
+		else if (strcmp(argv[i], "--start") == 0 && i + 1 < argc)
+		{
+			options.HasStart = true;
+			options.Start = (Word)strtoul(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+		{
+			options.Warmup = strtoull(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+		{
+			options.Cycles = (s32)strtol(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--execs") == 0 && i + 1 < argc)
+		{
+			options.Execs = strtoull(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+		{
+			options.Seed = strtoull(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			options.Threads = (u32)strtoul(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+		{
+			options.OutPrefix = argv[++i];
+		}
+		else
+		{
+			fprintf(stderr, "Error: Unknown argument: %s\n", argv[i]);
+			return 1;
+		}
+	}
+	if (options.RomPath.empty())
+	{
+		fprintf(stderr, "Error: --rom needs a file\n");
+		return 1;
+	}
+	if (options.Regions.empty())
+	{
+		fprintf(stderr, "Error: At least one --input region is required\n");
+		return 1;
+	}
+	if (options.Threads == 0)
+	{
+		options.Threads = std::thread::hardware_concurrency();
+		if (options.Threads == 0)
+		{
+			options.Threads = 1;
+		}
+	}
+
+	// boot the ROM and warm it up once, every case starts from this snapshot
+	CPU* cpu = new CPU();
+	CPU::Memory* memory = new CPU::Memory();
+	cpu->verbose = false;
+	cpu->reset(*memory);
+	if (!cpu->loadROM(options.RomPath, *memory))
+	{
+		fprintf(stderr, "Error: Could not read ROM: %s\n", options.RomPath.c_str());
+		delete memory;
+		delete cpu;
+		return 1;
+	}
+	cpu->registers.PC = options.HasStart ? options.Start
+		: memory->read(0xFFFC) | (memory->read(0xFFFD) << 8);
+	while (cpu->TotalCycles < options.Warmup)
+	{
+		const u64 Remaining = options.Warmup - cpu->TotalCycles;
+		cpu->execute(Remaining > 100000 ? 100000 : (s32)Remaining, *memory);
+	}
+	CPU::Snapshot* snapshot = new CPU::Snapshot();
+	cpu->saveSnapshot(*snapshot, *memory);
+	delete memory;
+	delete cpu;
+
+	FuzzShared shared;
+	shared.Options = &options;
+	shared.Snapshot = snapshot;
+	shared.Virgin = new std::atomic<Byte>[CPU::CoverageMapSize]();
+
+	// the snapshot's own bytes are the first input
+	std::vector<Byte> Seed;
+	for (const InputRegion& Region : options.Regions)
+	{
+		for (Word i = 0; i < Region.Length; i++)
+		{
+			Seed.push_back(snapshot->memory[(Word)(Region.Address + i)]);
+		}
+	}
+	shared.Corpus.push_back(Seed);
+
+	const auto Start = std::chrono::steady_clock::now();
+	std::vector<std::thread> Threads;
+	for (u32 i = 0; i < options.Threads; i++)
+	{
+		Threads.emplace_back(Worker, std::ref(shared), i);
+	}
+
+	auto Report = [&]() {
+		u32 Edges = 0;
+		for (u32 i = 0; i < CPU::CoverageMapSize; i++)
+		{
+			Edges += shared.Virgin[i].load(std::memory_order_relaxed) != 0;
+		}
+		const double Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+		u64 Execs = shared.Execs.load();
+		if (Execs > options.Execs)
+		{
+			Execs = options.Execs;
+		}
+		size_t CorpusSize;
+		{
+			std::lock_guard<std::mutex> Lock(shared.CorpusLock);
+			CorpusSize = shared.Corpus.size();
+		}
+		printf("execs %llu (%.0f/s)  corpus %zu  edges %u  crashes %llu\n",
+			Execs, Seconds > 0 ? Execs / Seconds : 0.0, CorpusSize, Edges, shared.Crashes.load());
+		fflush(stdout);
+	};
+
+	for (u32 Tick = 1; shared.Execs.load() < options.Execs; Tick++)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		if (Tick % 10 == 0)
+		{
+			Report();
+		}
+	}
+	for (std::thread& T : Threads)
+	{
+		T.join();
+	}
+	Report();
+
+	delete[] shared.Virgin;
+	delete snapshot;
+	return shared.Crashes.load() ? 2 : 0;
+}
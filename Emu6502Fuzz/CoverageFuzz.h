@@ -0,0 +1,9 @@
+/**
+* Purpose: Coverage-guided fuzzing of a ROM image. Mutated inputs are written into chosen
+*          memory regions of a warmed-up machine snapshot, and inputs that reach new
+*          previous PC -> PC edges are kept in the corpus.
+**/
+#pragma once
+
+// run the coverage fuzzer with the given command line, returning the process exit status
+int RunCoverageFuzzer(int argc, char* argv[]);
@@ -0,0 +1,563 @@
+// Fuzz.cpp : Differential fuzzing of CPU::execute against ReferenceCPU.
+//
+// usage: Emu6502Fuzz [--cases <count>] [--steps <count>] [--seed <value>] [--threads <count>] [--binary]
+//                    [--variant 6502|65C02|2A03]
+//        Emu6502Fuzz --rom <file> ...    (coverage-guided ROM fuzzing, see CoverageFuzz.cpp)
+//
+//   --cases    number of random cases to run (default 100000)
+//   --steps    instructions per case (default 32)
+//   --seed     first case seed, case n uses seed + n (default 1)
+//   --threads  worker threads (default: all cores)
+//   --binary   do not compare ADC/SBC in decimal mode
+//   --variant  6502, 65C02 or 2A03: fuzz CPU, CPU65C02 or CPU2A03 against the reference model
+//              of that variant (default 6502)
+//
+// Each case is a random initial machine state and a random stream of instructions documented
+// for the variant. Both models execute it one instruction at a time and their registers,
+// flags, memory and the cycles the step took are compared after every step. At the end
+// of the case the incremental memory hash is checked against a full rehash, and in one
+// case out of eight again after bulk writes, a snapshot restore and mapping a ROM. The
+// first failing case is shrunk to a minimal one and printed.
+//
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include "../Emu6502Console/CPU.h"
+#include "../Emu6502Console/Disassembler.h"
+#include "../Emu6502Console/StateHash.h"
+#include "CoverageFuzz.h"
+#include "ReferenceCPU.h"
+
+// status bits that are compared, B and U only exist on the stack
+static constexpr Byte ComparedFlags = 0xCF;
+
+struct FuzzOptions
+{
+	u64 Cases = 100000;
+	u32 Steps = 32;
+	u64 Seed = 1;
+	u32 Threads = 0;
+	bool Decimal = true;
+	const char* Variant = NMOS6502::Name;
+};
+
+struct FuzzCase
+{
+	// seed for the initial memory contents, 0 for zeroed memory
+	u64 MemorySeed;
+	Byte A;
+	Byte X;
+	Byte Y;
+	Byte SP;
+	Byte P;
+	Word PC;
+	// instruction bytes, one entry per instruction
+	std::vector<std::vector<Byte>> Instructions;
+};
+
+struct FuzzFailure
+{
+	// instruction index at which the models diverged
+	u32 Step;
+	// the instruction that diverged, which may lie outside the stream after a branch
+	Word PC;
+	Byte Instruction[3];
+	std::string Description;
+};
+
+// splitmix64
+static u64 NextRandom(u64& state)
+{
+	u64 z = (state += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+static bool IsDocumented(const OpcodeTable& table, Byte opcode)
+{
+	return table[opcode].Mnemonic[0] != '?';
+}
+
+static bool IsDecimalArithmetic(const OpcodeTable& table, Byte opcode)
+{
+	const char* Mnemonic = table[opcode].Mnemonic;
+	return strcmp(Mnemonic, "ADC") == 0 || strcmp(Mnemonic, "SBC") == 0;
+}
+
+template <class Variant>
+static FuzzCase GenerateCase(u64 seed, u32 steps)
+{
+	const OpcodeTable& Table = BasicReferenceCPU<Variant>::Table;
+
+	// documented opcodes to draw from
+	static const std::vector<Byte> Documented = [&Table] {
+		std::vector<Byte> List;
+		for (u32 i = 0; i < 256; i++)
+		{
+			if (IsDocumented(Table, (Byte)i))
+			{
+				List.push_back((Byte)i);
+			}
+		}
+		return List;
+	}();
+
+	u64 State = seed;
+	FuzzCase Case;
+	Case.MemorySeed = NextRandom(State) | 1;
+	const u64 Registers = NextRandom(State);
+	Case.A = (Byte)Registers;
+	Case.X = (Byte)(Registers >> 8);
+	Case.Y = (Byte)(Registers >> 16);
+	Case.SP = (Byte)(Registers >> 24);
+	Case.P = (Byte)(Registers >> 32) & ComparedFlags;
+	Case.PC = 0x0200 + (Word)(NextRandom(State) % 0xFC00);
+
+	for (u32 i = 0; i < steps; i++)
+	{
+		const u64 Random = NextRandom(State);
+		const Byte Opcode = Documented[Random % Documented.size()];
+		std::vector<Byte> Instruction(1, Opcode);
+		for (u32 b = 1; b < Table[Opcode].Length; b++)
+		{
+			Instruction.push_back((Byte)(Random >> (16 + 8 * b)));
+		}
+		Case.Instructions.push_back(Instruction);
+	}
+	return Case;
+}
+
+// put both models into the initial state of the case
+template <class Variant>
+static void Setup(const FuzzCase& fuzzCase, BasicCPU<Variant>& cpu, CPUBase::Memory& memory, BasicReferenceCPU<Variant>& ref)
+{
+	if (fuzzCase.MemorySeed == 0)
+	{
+		memset(ref.Memory, 0, sizeof(ref.Memory));
+	}
+	else
+	{
+		u64 State = fuzzCase.MemorySeed;
+		for (u32 i = 0; i < sizeof(ref.Memory); i += 8)
+		{
+			const u64 Random = NextRandom(State);
+			memcpy(&ref.Memory[i], &Random, 8);
+		}
+	}
+
+	Word Address = fuzzCase.PC;
+	for (const std::vector<Byte>& Instruction : fuzzCase.Instructions)
+	{
+		for (Byte b : Instruction)
+		{
+			ref.Memory[Address++] = b;
+		}
+	}
+
+	ref.A = fuzzCase.A;
+	ref.X = fuzzCase.X;
+	ref.Y = fuzzCase.Y;
+	ref.SP = fuzzCase.SP;
+	ref.P = fuzzCase.P;
+	ref.PC = fuzzCase.PC;
+
+	// the fuzzer maps no ROM, so ram is the whole address space; written directly, it needs a rehash
+	memcpy(memory.ram, ref.Memory, sizeof(ref.Memory));
+	memory.hash = HashMemory(memory);
+	cpu.registers.A = ref.A;
+	cpu.registers.X = ref.X;
+	cpu.registers.Y = ref.Y;
+	cpu.registers.SP = ref.SP;
+	cpu.registers.PC = ref.PC;
+	cpu.PS = ref.P;
+}
+
+// describe how the two models differ, or return an empty string if they agree
+template <class Variant>
+static std::string Compare(const BasicCPU<Variant>& cpu, const CPUBase::Memory& memory, const BasicReferenceCPU<Variant>& ref)
+{
+	char Text[160];
+	if (cpu.registers.A != ref.A || cpu.registers.X != ref.X || cpu.registers.Y != ref.Y
+		|| cpu.registers.SP != ref.SP || cpu.registers.PC != ref.PC
+		|| (cpu.PS & ComparedFlags) != (ref.P & ComparedFlags))
+	{
+		snprintf(Text, sizeof(Text),
+			"registers differ: cpu A=%02X X=%02X Y=%02X SP=%02X PC=%04X P=%02X, ref A=%02X X=%02X Y=%02X SP=%02X PC=%04X P=%02X",
+			cpu.registers.A, cpu.registers.X, cpu.registers.Y, cpu.registers.SP, cpu.registers.PC, cpu.PS & ComparedFlags,
+			ref.A, ref.X, ref.Y, ref.SP, ref.PC, ref.P & ComparedFlags);
+		return Text;
+	}
+	if (memcmp(memory.ram, ref.Memory, sizeof(ref.Memory)) != 0)
+	{
+		u32 Address = 0;
+		while (memory.ram[Address] == ref.Memory[Address])
+		{
+			Address++;
+		}
+		snprintf(Text, sizeof(Text), "memory differs at $%04X: cpu %02X, ref %02X",
+			Address, memory.ram[Address], ref.Memory[Address]);
+		return Text;
+	}
+	return std::string();
+}
+
+// describe how the incremental memory hash differs from a full rehash, or return an empty string
+static std::string CompareHash(const CPUBase::Memory& memory, const char* after)
+{
+	const u64 Rehash = HashMemory(memory);
+	if (memory.hash == Rehash)
+	{
+		return std::string();
+	}
+	char Text[128];
+	snprintf(Text, sizeof(Text), "memory hash out of step after %s: incremental %016llX, rehash %016llX",
+		after, (unsigned long long)memory.hash, (unsigned long long)Rehash);
+	return Text;
+}
+
+// cases whose MemorySeed has none of these bits set also run CheckMemoryHash, which costs as
+// much as the rest of the case
+static constexpr u64 CheckMemoryHashMask = 0x0E;
+
+// exercise the other ways memory changes on the final state of a case: a bulk copy and a fill
+// (as DMA does them), restoring a snapshot and mapping a ROM, checking the hash after each
+template <class Variant>
+static std::string CheckMemoryHash(const FuzzCase& fuzzCase, BasicCPU<Variant>& cpu, CPUBase::Memory& memory, BasicReferenceCPU<Variant>& ref)
+{
+	static thread_local std::unique_ptr<CPUBase::Snapshot> Snapshot(new CPUBase::Snapshot());
+	cpu.saveSnapshot(*Snapshot, memory);
+
+	u64 State = fuzzCase.MemorySeed ^ fuzzCase.PC;
+	for (u32 i = 0; i < 2; i++)
+	{
+		// a block within one page, from anywhere for the copy
+		const u64 Random = NextRandom(State);
+		const Word To = (Word)Random;
+		const Word From = (Word)(Random >> 16);
+		const u32 Offset = (To & 0xFF) > (From & 0xFF) ? (To & 0xFF) : (From & 0xFF);
+		const u32 Room = CPUBase::Memory::PAGE_SIZE - Offset;
+		const u32 Length = 1 + (u32)(Random >> 32) % Room;
+		if (i == 0)
+		{
+			memory.writeRAM(memory.ram + To, To, memory.ram + From, Length);
+			memmove(&ref.Memory[To], &ref.Memory[From], Length);
+		}
+		else
+		{
+			memory.fillRAM(memory.ram + To, To, (Byte)(Random >> 56), Length);
+			memset(&ref.Memory[To], (Byte)(Random >> 56), Length);
+		}
+	}
+	std::string Difference = Compare(cpu, memory, ref);
+	if (Difference.empty())
+	{
+		Difference = CompareHash(memory, "writeRAM and fillRAM");
+	}
+	if (!Difference.empty())
+	{
+		return Difference;
+	}
+
+	cpu.restoreSnapshot(*Snapshot, memory);
+	Difference = CompareHash(memory, "restoreSnapshot");
+	if (!Difference.empty())
+	{
+		return Difference;
+	}
+
+	// the top pages as ROM, the image taken from the reference memory, and writes to both kinds of page
+	const u64 Random = NextRandom(State);
+	const Word ROMAddress = (Word)(0x8000 + (Random & 0x7F00));
+	auto ROM = std::make_shared<const ROMImage>(ROMAddress, &ref.Memory[ROMAddress], 0x10000 - ROMAddress);
+	CPUBase::Memory Mapped(MemoryArena::shared(), ROM);
+	Mapped.write((Word)(Random >> 16) & 0x7FFF, (Byte)(Random >> 32));
+	Mapped.write(ROMAddress, (Byte)(Random >> 40));
+	return CompareHash(Mapped, "mapping a ROM");
+}
+
+// run a case on both models, returning true and filling failure if they diverge
+template <class Variant>
+static bool RunCase(const FuzzCase& fuzzCase, const FuzzOptions& options, BasicCPU<Variant>& cpu, CPUBase::Memory& memory, BasicReferenceCPU<Variant>& ref, FuzzFailure& failure)
+{
+	const OpcodeTable& Table = BasicReferenceCPU<Variant>::Table;
+
+	Setup(fuzzCase, cpu, memory, ref);
+	for (u32 Step = 0; Step < fuzzCase.Instructions.size(); Step++)
+	{
+		// control flow may wander into bytes that are not part of the stream
+		const Byte Opcode = ref.Memory[ref.PC];
+		if (!IsDocumented(Table, Opcode) || (!options.Decimal && (ref.P & ref.FlagD) && IsDecimalArithmetic(Table, Opcode)))
+		{
+			return false;
+		}
+
+		failure.PC = ref.PC;
+		for (Word i = 0; i < 3; i++)
+		{
+			failure.Instruction[i] = ref.Memory[(Word)(ref.PC + i)];
+		}
+
+		s32 Cycles = 0;
+		try
+		{
+			Cycles = cpu.execute(1, memory);
+		}
+		catch (...)
+		{
+			failure.Step = Step;
+			failure.Description = "CPU::execute threw an exception";
+			return true;
+		}
+		ref.step();
+
+		std::string Difference = Compare(cpu, memory, ref);
+		if (Difference.empty() && (u32)Cycles != ref.Cycles)
+		{
+			char Text[64];
+			snprintf(Text, sizeof(Text), "cycles differ: cpu %d, ref %u", Cycles, ref.Cycles);
+			Difference = Text;
+		}
+		if (!Difference.empty())
+		{
+			failure.Step = Step;
+			failure.Description = Difference;
+			return true;
+		}
+	}
+
+	// a hash that falls out of step stays out, so one rehash covers every step; shrinking the
+	// case then leaves the instruction that caused it
+	std::string Difference = CompareHash(memory, "the last step");
+	if (Difference.empty() && (fuzzCase.MemorySeed & CheckMemoryHashMask) == 0)
+	{
+		Difference = CheckMemoryHash(fuzzCase, cpu, memory, ref);
+	}
+	if (!Difference.empty())
+	{
+		failure.Step = (u32)fuzzCase.Instructions.size();
+		failure.Description = Difference;
+		return true;
+	}
+	return false;
+}
+
+// reduce a failing case while it keeps failing
+template <class Variant>
+static FuzzCase Shrink(FuzzCase fuzzCase, const FuzzOptions& options, BasicCPU<Variant>& cpu, CPUBase::Memory& memory, BasicReferenceCPU<Variant>& ref)
+{
+	FuzzFailure Failure;
+	auto Fails = [&](const FuzzCase& candidate) { return RunCase(candidate, options, cpu, memory, ref, Failure); };
+
+	bool Progress = true;
+	while (Progress)
+	{
+		Progress = false;
+
+		// drop instructions, starting with the ones after the failure
+		for (size_t i = fuzzCase.Instructions.size(); i-- > 0;)
+		{
+			FuzzCase Candidate = fuzzCase;
+			Candidate.Instructions.erase(Candidate.Instructions.begin() + i);
+			if (!Candidate.Instructions.empty() && Fails(Candidate))
+			{
+				fuzzCase = Candidate;
+				Progress = true;
+			}
+		}
+
+		// simplify the initial state
+		auto Try = [&](FuzzCase candidate) {
+			if (Fails(candidate))
+			{
+				fuzzCase = candidate;
+				Progress = true;
+			}
+		};
+		if (fuzzCase.MemorySeed != 0) { FuzzCase c = fuzzCase; c.MemorySeed = 0; Try(c); }
+		if (fuzzCase.A != 0) { FuzzCase c = fuzzCase; c.A = 0; Try(c); }
+		if (fuzzCase.X != 0) { FuzzCase c = fuzzCase; c.X = 0; Try(c); }
+		if (fuzzCase.Y != 0) { FuzzCase c = fuzzCase; c.Y = 0; Try(c); }
+		if (fuzzCase.SP != 0xFF) { FuzzCase c = fuzzCase; c.SP = 0xFF; Try(c); }
+		if (fuzzCase.P != 0) { FuzzCase c = fuzzCase; c.P = 0; Try(c); }
+
+		// simplify operand bytes
+		for (size_t i = 0; i < fuzzCase.Instructions.size(); i++)
+		{
+			for (size_t b = 1; b < fuzzCase.Instructions[i].size(); b++)
+			{
+				if (fuzzCase.Instructions[i][b] != 0)
+				{
+					FuzzCase c = fuzzCase;
+					c.Instructions[i][b] = 0;
+					Try(c);
+				}
+			}
+		}
+	}
+	return fuzzCase;
+}
+
+static void PrintCase(const FuzzCase& fuzzCase, const FuzzFailure& failure, const OpcodeTable& table)
+{
+	printf("initial state: A=%02X X=%02X Y=%02X SP=%02X P=%02X PC=%04X memory=%s\n",
+		fuzzCase.A, fuzzCase.X, fuzzCase.Y, fuzzCase.SP, fuzzCase.P, fuzzCase.PC,
+		fuzzCase.MemorySeed ? "random" : "zero");
+	Word Address = fuzzCase.PC;
+	for (size_t i = 0; i < fuzzCase.Instructions.size(); i++)
+	{
+		const std::vector<Byte>& Instruction = fuzzCase.Instructions[i];
+		char Text[DisassemblyMaxLength];
+		Disassemble(Address, Instruction[0], Instruction.size() > 1 ? Instruction[1] : 0,
+			Instruction.size() > 2 ? Instruction[2] : 0, Text, table);
+		printf("  %04X  %s\n", Address, Text);
+		Address += (Word)Instruction.size();
+	}
+	char Text[DisassemblyMaxLength];
+	Disassemble(failure.PC, failure.Instruction[0], failure.Instruction[1], failure.Instruction[2], Text, table);
+	printf("step %u diverges at %04X  %s\n%s\n", failure.Step, failure.PC, Text, failure.Description.c_str());
+}
+
+// fuzz the variant's CPU against its reference model, returning the process exit code
+template <class Variant>
+static int RunFuzzer(const FuzzOptions& options)
+{
+	std::atomic<u64> nextCase(0);
+	std::atomic<bool> failed(false);
+	std::mutex failureLock;
+	u64 failingSeed = ~0ull;
+
+	auto Worker = [&]() {
+		BasicCPU<Variant>* cpu = new BasicCPU<Variant>();
+		CPUBase::Memory* memory = new CPUBase::Memory();
+		BasicReferenceCPU<Variant>* ref = new BasicReferenceCPU<Variant>();
+		FuzzFailure Failure;
+		while (!failed.load(std::memory_order_relaxed))
+		{
+			const u64 Index = nextCase.fetch_add(1);
+			if (Index >= options.Cases)
+			{
+				break;
+			}
+			const u64 Seed = options.Seed + Index;
+			if (RunCase(GenerateCase<Variant>(Seed, options.Steps), options, *cpu, *memory, *ref, Failure))
+			{
+				// keep the lowest failing seed so that reruns report the same case
+				std::lock_guard<std::mutex> Lock(failureLock);
+				if (Seed < failingSeed)
+				{
+					failingSeed = Seed;
+				}
+				failed.store(true);
+			}
+		}
+		delete ref;
+		delete memory;
+		delete cpu;
+	};
+
+	std::vector<std::thread> Threads;
+	for (u32 i = 0; i < options.Threads; i++)
+	{
+		Threads.emplace_back(Worker);
+	}
+	for (std::thread& T : Threads)
+	{
+		T.join();
+	}
+
+	if (!failed)
+	{
+		printf("%llu %s cases passed\n", options.Cases, Variant::Name);
+		return 0;
+	}
+
+	BasicCPU<Variant>* cpu = new BasicCPU<Variant>();
+	CPUBase::Memory* memory = new CPUBase::Memory();
+	BasicReferenceCPU<Variant>* ref = new BasicReferenceCPU<Variant>();
+	FuzzCase Minimal = Shrink(GenerateCase<Variant>(failingSeed, options.Steps), options, *cpu, *memory, *ref);
+	FuzzFailure Failure;
+	RunCase(Minimal, options, *cpu, *memory, *ref, Failure);
+	printf("%s case with seed %llu failed, shrunk to:\n", Variant::Name, failingSeed);
+	PrintCase(Minimal, Failure, BasicReferenceCPU<Variant>::Table);
+	delete ref;
+	delete memory;
+	delete cpu;
+	return 1;
+}
+
+int main(int argc, char* argv[])
+{
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--rom") == 0)
+		{
+			return RunCoverageFuzzer(argc, argv);
+		}
+	}
+
+	FuzzOptions options;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--cases") == 0 && i + 1 < argc)
+		{
+			options.Cases = strtoull(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc)
+		{
+			options.Steps = (u32)strtoul(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+		{
+			options.Seed = strtoull(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			options.Threads = (u32)strtoul(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--binary") == 0)
+		{
+			options.Decimal = false;
+		}
+		else if (strcmp(argv[i], "--variant") == 0 && i + 1 < argc)
+		{
+			options.Variant = argv[++i];
+		}
+		else
+		{
+			fprintf(stderr, "Error: Unknown argument: %s\n", argv[i]);
+			return 1;
+		}
+	}
+	if (options.Threads == 0)
+	{
+		options.Threads = std::thread::hardware_concurrency();
+		if (options.Threads == 0)
+		{
+			options.Threads = 1;
+		}
+	}
+
+
+	if (strcmp(options.Variant, NMOS6502::Name) == 0)
+	{
+		return RunFuzzer<NMOS6502>(options);
+	}
+	if (strcmp(options.Variant, WDC65C02::Name) == 0)
+	{
+		return RunFuzzer<WDC65C02>(options);
+	}
+	if (strcmp(options.Variant, Ricoh2A03::Name) == 0)
+	{
+		return RunFuzzer<Ricoh2A03>(options);
+	}
+	fprintf(stderr, "Error: Unknown variant: %s\n", options.Variant);
+	return 1;
+}
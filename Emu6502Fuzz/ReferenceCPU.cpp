@@ -0,0 +1,381 @@
+#include "ReferenceCPU.h"
+
+// Decimal mode follows the per-digit sequences of Bruce Clark's "Decimal Mode" tutorial
+// (6502.org, appendix A), not the core's nibble arithmetic, so the fuzzer checks one against
+// the other. They also cover operands that are not valid BCD.
+template <class Variant>
+void BasicReferenceCPU<Variant>::adc(Byte value)
+{
+	const s32 Carry = flag(FlagC) ? 1 : 0;
+	const u32 Binary = A + value + Carry;
+	if (!Variant::HasDecimalMode || !flag(FlagD))
+	{
+		setFlag(FlagC, Binary > 0xFF);
+		setFlag(FlagV, (~(A ^ value) & (A ^ Binary) & 0x80) != 0);
+		A = (Byte)Binary;
+		setZN(A);
+		return;
+	}
+
+	// the low digit, a decimal carry out of it is added to the high digit as $10
+	s32 Low = (A & 0x0F) + (value & 0x0F) + Carry;
+	if (Low >= 0x0A)
+	{
+		Low = ((Low + 0x06) & 0x0F) + 0x10;
+	}
+	// the high digits before their adjustment, as signed bytes for N and V (both variants)
+	const s32 Signed = (SByte)(A & 0xF0) + (SByte)(value & 0xF0) + Low;
+	s32 Sum = (A & 0xF0) + (value & 0xF0) + Low;
+	if (Sum >= 0xA0)
+	{
+		Sum += 0x60;
+	}
+	setFlag(FlagC, Sum >= 0x100);
+	setFlag(FlagV, Signed < -128 || Signed > 127);
+	if (Variant::HasCMOSTiming)
+	{
+		// 65C02: N and Z are valid for the decimal result, at the cost of a cycle
+		A = (Byte)Sum;
+		setZN(A);
+		Cycles++;
+		return;
+	}
+	// NMOS: Z from the binary sum, N from the unadjusted high digits
+	setFlag(FlagZ, (Binary & 0xFF) == 0);
+	setFlag(FlagN, (Signed & 0x80) != 0);
+	A = (Byte)Sum;
+}
+
+template <class Variant>
+void BasicReferenceCPU<Variant>::sbc(Byte value)
+{
+	if (!Variant::HasDecimalMode || !flag(FlagD))
+	{
+		// binary subtraction is addition of the complement
+		adc(~value);
+		return;
+	}
+
+	// C and V come from the binary difference on both variants, N and Z too on the NMOS 6502
+	const s32 Borrow = flag(FlagC) ? 0 : 1;
+	const s32 Binary = A - value - Borrow;
+	setFlag(FlagC, Binary >= 0);
+	setFlag(FlagV, ((A ^ value) & (A ^ Binary) & 0x80) != 0);
+	setZN((Byte)Binary);
+
+	s32 Low = (A & 0x0F) - (value & 0x0F) - Borrow;
+	s32 Difference;
+	if (Variant::HasCMOSTiming)
+	{
+		// 65C02: the whole difference is adjusted, then the low digit if it borrowed
+		Difference = Binary;
+		if (Difference < 0)
+		{
+			Difference -= 0x60;
+		}
+		if (Low < 0)
+		{
+			Difference -= 0x06;
+		}
+		A = (Byte)Difference;
+		setZN(A);
+		Cycles++;
+		return;
+	}
+	// NMOS: the low digit is adjusted and borrows $10 from the high digits
+	if (Low < 0)
+	{
+		Low = ((Low - 0x06) & 0x0F) - 0x10;
+	}
+	Difference = (A & 0xF0) - (value & 0xF0) + Low;
+	if (Difference < 0)
+	{
+		Difference -= 0x60;
+	}
+	A = (Byte)Difference;
+}
+
+template <class Variant>
+void BasicReferenceCPU<Variant>::compare(Byte reg, Byte value)
+{
+	setFlag(FlagC, reg >= value);
+	setZN((Byte)(reg - value));
+}
+
+template <class Variant>
+void BasicReferenceCPU<Variant>::branch(bool condition)
+{
+	const SByte Offset = (SByte)fetch();
+	if (condition)
+	{
+		const Word Target = (Word)(PC + Offset);
+		Cycles += 1 + ((PC ^ Target) >> 8 != 0);
+		PC = Target;
+	}
+}
+
+template <class Variant>
+void BasicReferenceCPU<Variant>::step()
+{
+	// effective address for each addressing mode, fetching the operand bytes
+	auto zp = [this]() -> Word { return fetch(); };
+	auto zpx = [this]() -> Word { return (Byte)(fetch() + X); };
+	auto zpy = [this]() -> Word { return (Byte)(fetch() + Y); };
+	auto abs = [this]() -> Word { return fetchWord(); };
+	// reads pay a cycle when indexing crosses a page, writes always take the longer path
+	auto absx = [this](bool penalty = false) -> Word { const Word Base = fetchWord(); return indexed(Base, (Word)(Base + X), penalty); };
+	auto absy = [this](bool penalty = false) -> Word { const Word Base = fetchWord(); return indexed(Base, (Word)(Base + Y), penalty); };
+	auto indx = [this]() -> Word { return readZeroPageWord((Byte)(fetch() + X)); };
+	auto indy = [this](bool penalty = false) -> Word { const Word Base = readZeroPageWord(fetch()); return indexed(Base, (Word)(Base + Y), penalty); };
+
+	// shifts and rotates
+	auto asl = [this](Byte v) -> Byte { setFlag(FlagC, (v & 0x80) != 0); v <<= 1; setZN(v); return v; };
+	auto lsr = [this](Byte v) -> Byte { setFlag(FlagC, (v & 0x01) != 0); v >>= 1; setZN(v); return v; };
+	auto rol = [this](Byte v) -> Byte { Byte c = flag(FlagC); setFlag(FlagC, (v & 0x80) != 0); v = (v << 1) | c; setZN(v); return v; };
+	auto ror = [this](Byte v) -> Byte { Byte c = flag(FlagC); setFlag(FlagC, (v & 0x01) != 0); v = (v >> 1) | (c << 7); setZN(v); return v; };
+
+	Word Address;
+	Byte Value;
+	const Byte Opcode = fetch();
+	Cycles = Table[Opcode].Cycles;
+	if (Variant::HasCMOSInstructions && stepCMOS(Opcode))
+	{
+		return;
+	}
+	switch (Opcode)
+	{
+	// LDA
+	case 0xA9: A = fetch(); setZN(A); break;
+	case 0xA5: A = read(zp()); setZN(A); break;
+	case 0xB5: A = read(zpx()); setZN(A); break;
+	case 0xAD: A = read(abs()); setZN(A); break;
+	case 0xBD: A = read(absx(true)); setZN(A); break;
+	case 0xB9: A = read(absy(true)); setZN(A); break;
+	case 0xA1: A = read(indx()); setZN(A); break;
+	case 0xB1: A = read(indy(true)); setZN(A); break;
+	// LDX
+	case 0xA2: X = fetch(); setZN(X); break;
+	case 0xA6: X = read(zp()); setZN(X); break;
+	case 0xB6: X = read(zpy()); setZN(X); break;
+	case 0xAE: X = read(abs()); setZN(X); break;
+	case 0xBE: X = read(absy(true)); setZN(X); break;
+	// LDY
+	case 0xA0: Y = fetch(); setZN(Y); break;
+	case 0xA4: Y = read(zp()); setZN(Y); break;
+	case 0xB4: Y = read(zpx()); setZN(Y); break;
+	case 0xAC: Y = read(abs()); setZN(Y); break;
+	case 0xBC: Y = read(absx(true)); setZN(Y); break;
+	// STA
+	case 0x85: write(zp(), A); break;
+	case 0x95: write(zpx(), A); break;
+	case 0x8D: write(abs(), A); break;
+	case 0x9D: write(absx(), A); break;
+	case 0x99: write(absy(), A); break;
+	case 0x81: write(indx(), A); break;
+	case 0x91: write(indy(), A); break;
+	// STX
+	case 0x86: write(zp(), X); break;
+	case 0x96: write(zpy(), X); break;
+	case 0x8E: write(abs(), X); break;
+	// STY
+	case 0x84: write(zp(), Y); break;
+	case 0x94: write(zpx(), Y); break;
+	case 0x8C: write(abs(), Y); break;
+	// stack and transfers
+	case 0xBA: X = SP; setZN(X); break;
+	case 0x9A: SP = X; break;
+	case 0x48: push(A); break;
+	case 0x68: A = pull(); setZN(A); break;
+	case 0x08: push(P | FlagB | FlagU); break;
+	case 0x28: P = pull() & ~(FlagB | FlagU); break;
+	case 0xAA: X = A; setZN(X); break;
+	case 0xA8: Y = A; setZN(Y); break;
+	case 0x8A: A = X; setZN(A); break;
+	case 0x98: A = Y; setZN(A); break;
+	// jumps and subroutines
+	case 0x4C: PC = abs(); break;
+	case 0x6C:
+		Address = abs();
+		if (Variant::HasJMPIndirectBug)
+		{
+			// NMOS bug: the pointer's high byte is read from the same page
+			PC = read(Address) | (read((Address & 0xFF00) | ((Address + 1) & 0x00FF)) << 8);
+		}
+		else
+		{
+			PC = readWord(Address);
+		}
+		break;
+	case 0x20: Address = abs(); PC--; push(PC >> 8); push(PC & 0xFF); PC = Address; break;
+	case 0x60: PC = pull(); PC |= pull() << 8; PC++; break;
+	case 0x00: PC++; push(PC >> 8); push(PC & 0xFF); push(P | FlagB | FlagU); setFlag(FlagI, true); PC = readWord(0xFFFE);
+		if (Variant::BRKClearsDecimal)
+		{
+			setFlag(FlagD, false);
+		}
+		break;
+	case 0x40: P = pull() & ~(FlagB | FlagU); PC = pull(); PC |= pull() << 8; break;
+	// AND
+	case 0x29: A &= fetch(); setZN(A); break;
+	case 0x25: A &= read(zp()); setZN(A); break;
+	case 0x35: A &= read(zpx()); setZN(A); break;
+	case 0x2D: A &= read(abs()); setZN(A); break;
+	case 0x3D: A &= read(absx(true)); setZN(A); break;
+	case 0x39: A &= read(absy(true)); setZN(A); break;
+	case 0x21: A &= read(indx()); setZN(A); break;
+	case 0x31: A &= read(indy(true)); setZN(A); break;
+	// ORA
+	case 0x09: A |= fetch(); setZN(A); break;
+	case 0x05: A |= read(zp()); setZN(A); break;
+	case 0x15: A |= read(zpx()); setZN(A); break;
+	case 0x0D: A |= read(abs()); setZN(A); break;
+	case 0x1D: A |= read(absx(true)); setZN(A); break;
+	case 0x19: A |= read(absy(true)); setZN(A); break;
+	case 0x01: A |= read(indx()); setZN(A); break;
+	case 0x11: A |= read(indy(true)); setZN(A); break;
+	// EOR
+	case 0x49: A ^= fetch(); setZN(A); break;
+	case 0x45: A ^= read(zp()); setZN(A); break;
+	case 0x55: A ^= read(zpx()); setZN(A); break;
+	case 0x4D: A ^= read(abs()); setZN(A); break;
+	case 0x5D: A ^= read(absx(true)); setZN(A); break;
+	case 0x59: A ^= read(absy(true)); setZN(A); break;
+	case 0x41: A ^= read(indx()); setZN(A); break;
+	case 0x51: A ^= read(indy(true)); setZN(A); break;
+	// BIT
+	case 0x24: case 0x2C:
+		Value = read(Opcode == 0x24 ? zp() : abs());
+		setFlag(FlagZ, (A & Value) == 0);
+		setFlag(FlagN, (Value & 0x80) != 0);
+		setFlag(FlagV, (Value & 0x40) != 0);
+		break;
+	// increments and decrements
+	case 0xE8: X++; setZN(X); break;
+	case 0xC8: Y++; setZN(Y); break;
+	case 0xCA: X--; setZN(X); break;
+	case 0x88: Y--; setZN(Y); break;
+	case 0xC6: Address = zp(); Value = read(Address) - 1; write(Address, Value); setZN(Value); break;
+	case 0xD6: Address = zpx(); Value = read(Address) - 1; write(Address, Value); setZN(Value); break;
+	case 0xCE: Address = abs(); Value = read(Address) - 1; write(Address, Value); setZN(Value); break;
+	case 0xDE: Address = absx(); Value = read(Address) - 1; write(Address, Value); setZN(Value); break;
+	case 0xE6: Address = zp(); Value = read(Address) + 1; write(Address, Value); setZN(Value); break;
+	case 0xF6: Address = zpx(); Value = read(Address) + 1; write(Address, Value); setZN(Value); break;
+	case 0xEE: Address = abs(); Value = read(Address) + 1; write(Address, Value); setZN(Value); break;
+	case 0xFE: Address = absx(); Value = read(Address) + 1; write(Address, Value); setZN(Value); break;
+	// branches
+	case 0x10: branch(!flag(FlagN)); break;
+	case 0x30: branch(flag(FlagN)); break;
+	case 0x50: branch(!flag(FlagV)); break;
+	case 0x70: branch(flag(FlagV)); break;
+	case 0x90: branch(!flag(FlagC)); break;
+	case 0xB0: branch(flag(FlagC)); break;
+	case 0xD0: branch(!flag(FlagZ)); break;
+	case 0xF0: branch(flag(FlagZ)); break;
+	// flags
+	case 0x18: setFlag(FlagC, false); break;
+	case 0x38: setFlag(FlagC, true); break;
+	case 0x58: setFlag(FlagI, false); break;
+	case 0x78: setFlag(FlagI, true); break;
+	case 0xB8: setFlag(FlagV, false); break;
+	case 0xD8: setFlag(FlagD, false); break;
+	case 0xF8: setFlag(FlagD, true); break;
+	// ADC
+	case 0x69: adc(fetch()); break;
+	case 0x65: adc(read(zp())); break;
+	case 0x75: adc(read(zpx())); break;
+	case 0x6D: adc(read(abs())); break;
+	case 0x7D: adc(read(absx(true))); break;
+	case 0x79: adc(read(absy(true))); break;
+	case 0x61: adc(read(indx())); break;
+	case 0x71: adc(read(indy(true))); break;
+	// SBC
+	case 0xE9: sbc(fetch()); break;
+	case 0xE5: sbc(read(zp())); break;
+	case 0xF5: sbc(read(zpx())); break;
+	case 0xED: sbc(read(abs())); break;
+	case 0xFD: sbc(read(absx(true))); break;
+	case 0xF9: sbc(read(absy(true))); break;
+	case 0xE1: sbc(read(indx())); break;
+	case 0xF1: sbc(read(indy(true))); break;
+	// compares
+	case 0xC9: compare(A, fetch()); break;
+	case 0xC5: compare(A, read(zp())); break;
+	case 0xD5: compare(A, read(zpx())); break;
+	case 0xCD: compare(A, read(abs())); break;
+	case 0xDD: compare(A, read(absx(true))); break;
+	case 0xD9: compare(A, read(absy(true))); break;
+	case 0xC1: compare(A, read(indx())); break;
+	case 0xD1: compare(A, read(indy(true))); break;
+	case 0xE0: compare(X, fetch()); break;
+	case 0xE4: compare(X, read(zp())); break;
+	case 0xEC: compare(X, read(abs())); break;
+	case 0xC0: compare(Y, fetch()); break;
+	case 0xC4: compare(Y, read(zp())); break;
+	case 0xCC: compare(Y, read(abs())); break;
+	// shifts and rotates, the 65C02 only paying for abs,X when it crosses a page
+	case 0x0A: A = asl(A); break;
+	case 0x06: Address = zp(); write(Address, asl(read(Address))); break;
+	case 0x16: Address = zpx(); write(Address, asl(read(Address))); break;
+	case 0x0E: Address = abs(); write(Address, asl(read(Address))); break;
+	case 0x1E: Address = absx(Variant::HasCMOSTiming); write(Address, asl(read(Address))); break;
+	case 0x4A: A = lsr(A); break;
+	case 0x46: Address = zp(); write(Address, lsr(read(Address))); break;
+	case 0x56: Address = zpx(); write(Address, lsr(read(Address))); break;
+	case 0x4E: Address = abs(); write(Address, lsr(read(Address))); break;
+	case 0x5E: Address = absx(Variant::HasCMOSTiming); write(Address, lsr(read(Address))); break;
+	case 0x2A: A = rol(A); break;
+	case 0x26: Address = zp(); write(Address, rol(read(Address))); break;
+	case 0x36: Address = zpx(); write(Address, rol(read(Address))); break;
+	case 0x2E: Address = abs(); write(Address, rol(read(Address))); break;
+	case 0x3E: Address = absx(Variant::HasCMOSTiming); write(Address, rol(read(Address))); break;
+	case 0x6A: A = ror(A); break;
+	case 0x66: Address = zp(); write(Address, ror(read(Address))); break;
+	case 0x76: Address = zpx(); write(Address, ror(read(Address))); break;
+	case 0x6E: Address = abs(); write(Address, ror(read(Address))); break;
+	case 0x7E: Address = absx(Variant::HasCMOSTiming); write(Address, ror(read(Address))); break;
+	// NOP
+	case 0xEA: break;
+	default:
+		// undocumented opcodes are never generated
+		break;
+	}
+}
+
+template <class Variant>
+bool BasicReferenceCPU<Variant>::stepCMOS(Byte opcode)
+{
+	// (zp): a pointer in the zero page, not indexed
+	auto zpi = [this]() -> Word { return readZeroPageWord(fetch()); };
+
+	switch (opcode)
+	{
+	// BRA, whose 3 cycles in the table already include the branch being taken
+	case 0x80: branch(true); Cycles--; break;
+	// STZ
+	case 0x64: write(fetch(), 0); break;
+	case 0x74: write((Byte)(fetch() + X), 0); break;
+	case 0x9C: write(fetchWord(), 0); break;
+	case 0x9E: write((Word)(fetchWord() + X), 0); break;
+	// stack
+	case 0xDA: push(X); break;
+	case 0xFA: X = pull(); setZN(X); break;
+	case 0x5A: push(Y); break;
+	case 0x7A: Y = pull(); setZN(Y); break;
+	// (zp)
+	case 0x12: A |= read(zpi()); setZN(A); break;
+	case 0x32: A &= read(zpi()); setZN(A); break;
+	case 0x52: A ^= read(zpi()); setZN(A); break;
+	case 0x72: adc(read(zpi())); break;
+	case 0x92: write(zpi(), A); break;
+	case 0xB2: A = read(zpi()); setZN(A); break;
+	case 0xD2: compare(A, read(zpi())); break;
+	case 0xF2: sbc(read(zpi())); break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+template class BasicReferenceCPU<NMOS6502>;
+template class BasicReferenceCPU<WDC65C02>;
+template class BasicReferenceCPU<Ricoh2A03>;
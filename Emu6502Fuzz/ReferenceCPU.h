@@ -0,0 +1,83 @@
+/**
+* Class name: BasicReferenceCPU
+* Purpose: A deliberately simple 6502 stepper used as the oracle for differential fuzzing.
+*          It favours being obviously correct over being fast: every instruction is decoded into
+*          an addressing mode and an operation, and memory is a flat array. Cycles are the base
+*          count from the opcode table plus the page crossing and branch penalties, so comparing
+*          them checks the interpreter's handlers against the table. It takes the same variant
+*          traits as BasicCPU, and ReferenceCPU, ReferenceCPU65C02 and ReferenceCPU2A03 model
+*          CPU, CPU65C02 and CPU2A03.
+**/
+#pragma once
+#include "../Emu6502Console/CPU.h"
+#include "../Emu6502Console/Disassembler.h"
+
+template <class Variant>
+class BasicReferenceCPU
+{
+public:
+	// opcode metadata of the variant
+	static constexpr const OpcodeTable& Table = Variant::HasCMOSInstructions ? Opcodes65C02 : Opcodes;
+
+	Byte A;
+	Byte X;
+	Byte Y;
+	Byte SP;
+	Byte P;
+	Word PC;
+	Byte Memory[0x10000];
+
+	// cycles the last step took
+	u32 Cycles;
+
+	// status register bits
+	static constexpr Byte
+		FlagC = 0x01,
+		FlagZ = 0x02,
+		FlagI = 0x04,
+		FlagD = 0x08,
+		FlagB = 0x10,
+		FlagU = 0x20,
+		FlagV = 0x40,
+		FlagN = 0x80;
+
+	// execute the instruction at PC
+	void step();
+
+private:
+	Byte read(Word address) { return Memory[address]; }
+	void write(Word address, Byte value) { Memory[address] = value; }
+	Word readWord(Word address) { return read(address) | (read((Word)(address + 1)) << 8); }
+	// read a pointer from the zero page, wrapping within it
+	Word readZeroPageWord(Byte address) { return read(address) | (read((Byte)(address + 1)) << 8); }
+
+	Byte fetch() { return read(PC++); }
+	Word fetchWord() { Word Value = readWord(PC); PC += 2; return Value; }
+
+	void push(Byte value) { write(0x0100 | SP, value); SP--; }
+	Byte pull() { SP++; return read(0x0100 | SP); }
+
+	void setFlag(Byte flag, bool value) { P = value ? (P | flag) : (P & ~flag); }
+	bool flag(Byte flag) const { return (P & flag) != 0; }
+	void setZN(Byte value) { setFlag(FlagZ, value == 0); setFlag(FlagN, (value & 0x80) != 0); }
+
+	void adc(Byte value);
+	void sbc(Byte value);
+	void compare(Byte reg, Byte value);
+	void branch(bool condition);
+
+	// execute the 65C02 instruction opcode, returning false if it is not one
+	bool stepCMOS(Byte opcode);
+
+	// charge the page crossing penalty if base and address lie in different pages
+	Word indexed(Word base, Word address, bool penalty) { Cycles += penalty && (base ^ address) >> 8; return address; }
+};
+
+// instantiated in ReferenceCPU.cpp
+extern template class BasicReferenceCPU<NMOS6502>;
+extern template class BasicReferenceCPU<WDC65C02>;
+extern template class BasicReferenceCPU<Ricoh2A03>;
+
+using ReferenceCPU = BasicReferenceCPU<NMOS6502>;
+using ReferenceCPU65C02 = BasicReferenceCPU<WDC65C02>;
+using ReferenceCPU2A03 = BasicReferenceCPU<Ricoh2A03>;
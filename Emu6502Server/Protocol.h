@@ -0,0 +1,180 @@
+/**
+* Purpose: Wire format of the emulation server (Emu6502Server), for clients in any language.
+*
+* Clients talk to the server over a Unix domain stream socket. Every request and response is a
+* MessageHeader followed by Length bytes of payload; all fields are little-endian and the structs
+* below have no padding. A response carries the request's Tag and Command, so a client may send
+* several requests before reading the responses. Requests for one session are executed in the
+* order they arrive; responses for different sessions may come back in any order. A session
+* lives until it is destroyed or the connection that created it closes, and only that
+* connection may use it: requests for other connections' sessions get UnknownSession.
+*
+* Map responses carry a read-only file descriptor (SCM_RIGHTS) of the shared memory file that
+* holds the session's RAM and nothing else. Mapping it gives the client the session's memory
+* without a copy, current whenever the session is idle, i.e. after the response to its last
+* request.
+**/
+#pragma once
+#include "../Emu6502Console/Types.h"
+
+namespace Protocol
+{
+	// bumped whenever a command or field is added
+	static constexpr u32 Version = 1;
+
+	// largest payload accepted, larger requests close the connection
+	static constexpr u32 MaxPayload = 0x20000;
+
+	enum Command : Byte
+	{
+		// payload none, response HelloResponse
+		Hello = 0,
+		// payload CreateRequest, response Session set to the new session
+		Create = 1,
+		// payload none, response none
+		Destroy = 2,
+		// payload AddROMRequest then the image, response AddROMResponse
+		AddROM = 3,
+		// payload RemoveROMRequest, response none. Sessions mapping the image keep it
+		RemoveROM = 4,
+		// payload ResetRequest, response none. Resets registers and counters and clears RAM
+		Reset = 5,
+		// payload RunRequest, response RunResponse
+		Run = 6,
+		// payload AddressRequest then the bytes, response none. Writes to ROM pages are ignored
+		Write = 7,
+		// payload ReadRequest, response the bytes
+		Read = 8,
+		// payload none, response Registers
+		GetRegisters = 9,
+		// payload Registers, response none
+		SetRegisters = 10,
+		// payload none, response MapResponse and a file descriptor
+		Map = 11,
+	};
+
+	enum Status : Byte
+	{
+		Ok = 0,
+		UnknownCommand = 1,
+		UnknownSession = 2,
+		UnknownROM = 3,
+		BadRequest = 4,
+		// the server cannot do this on its host, e.g. Map without shared memory files
+		Unsupported = 5,
+		OutOfMemory = 6,
+	};
+
+	// CPU variants, as in libemu6502
+	enum Variant : Byte
+	{
+		NMOS6502 = 0,
+		CMOS65C02 = 1,
+		Ricoh2A03 = 2,
+	};
+
+	struct MessageHeader
+	{
+		// payload bytes after the header
+		u32 Length;
+		// chosen by the client, echoed in the response
+		u32 Tag;
+		// session the request is for; in a Create response the new session
+		u32 Session;
+		Byte Command;
+		// Status in responses, 0 in requests
+		Byte Status;
+		Word Reserved;
+	};
+	static_assert(sizeof(MessageHeader) == 16, "MessageHeader is 16 bytes on the wire");
+
+	struct HelloResponse
+	{
+		u32 Version;
+		// worker threads running sessions
+		u32 Threads;
+	};
+
+	struct CreateRequest
+	{
+		Byte Variant;
+		Byte Reserved[3];
+		// image from AddROM mapped read-only over its pages, 0 for none
+		u32 ROM;
+	};
+
+	// AddROM and Write: the bytes after this struct go to Address. Write wraps at $FFFF, AddROM
+	// clips the image at the end of memory and refuses one that leaves no page for RAM
+	struct AddressRequest
+	{
+		Word Address;
+		Word Reserved;
+	};
+	typedef AddressRequest AddROMRequest;
+
+	struct AddROMResponse
+	{
+		u32 ROM;
+	};
+
+	struct RemoveROMRequest
+	{
+		u32 ROM;
+	};
+
+	struct ResetRequest
+	{
+		Word PC;
+		Word Reserved;
+	};
+
+	struct RunRequest
+	{
+		// at least this many cycles, the last instruction may overrun
+		u64 Cycles;
+	};
+
+	struct ReadRequest
+	{
+		Word Address;
+		Word Reserved;
+		// bytes to read from Address, wrapping at $FFFF, at most 65536
+		u32 Length;
+	};
+
+	struct Registers
+	{
+		Byte A;
+		Byte X;
+		Byte Y;
+		Byte SP;
+		Word PC;
+		Byte P;
+		Byte Reserved;
+	};
+	static_assert(sizeof(Registers) == 8, "Registers is 8 bytes on the wire");
+
+	struct RunResponse
+	{
+		// cycles used by this run
+		u64 Cycles;
+		// since the last reset
+		u64 TotalCycles;
+		u64 TotalInstructions;
+		Registers State;
+	};
+	static_assert(sizeof(RunResponse) == 32, "RunResponse is 32 bytes on the wire");
+
+	// the session's RAM pages are RAMPages * 256 bytes at Offset in the file, in address order
+	// with the ROMPages pages from FirstROMPage on left out
+	struct MapResponse
+	{
+		u64 Offset;
+		// size of the whole file
+		u64 FileSize;
+		u32 RAMPages;
+		Word FirstROMPage;
+		Word ROMPages;
+	};
+	static_assert(sizeof(MapResponse) == 24, "MapResponse is 24 bytes on the wire");
+}
@@ -0,0 +1,1041 @@
+// usage: Emu6502Server --socket <path> [--threads <count>]
+//
+//   --socket   path of the Unix domain socket to listen on, replaced if it exists
+//   --threads  worker threads running sessions (default: one per hardware thread)
+//
+// Hosts any number of independent emulator sessions for clients speaking the protocol in
+// Protocol.h, so a test suite that starts thousands of short runs pays for process startup and
+// ROM loading once. Sessions take their RAM from one shareable MemoryArena and map ROM images
+// added once with AddROM. A pool of worker threads runs them: every session has a queue of
+// requests, and a session with requests waiting is queued for the next free worker. A Run is
+// done in slices of RunSlice cycles with the session going to the back of the queue between
+// slices, so a long run does not hold up the others.
+//
+// Sockets are non-blocking. A response goes out as far as the socket takes it and the rest waits
+// in the connection's output queue, which the I/O thread sends when the socket has room again.
+// A client that lets more than MaxOutput bytes of responses pile up is disconnected, so neither
+// a worker nor the I/O thread ever waits on a client.
+//
+// A connection only reaches the sessions it created, and each session's RAM is a file of its own
+// that Map passes read-only.
+//
+// POSIX only (Unix domain sockets, and memfd for Map, which needs Linux); there is no Visual
+// Studio project for it. Build with the CPU sources, e.g.
+//   g++ -std=c++17 -O2 -pthread -o emu6502-server Emu6502Server/Server.cpp
+//       Emu6502Console/{CPU,Disassembler,Trace,MemoryArena,PerfCounters}.cpp
+
+#include "Protocol.h"
+#include "../Emu6502Console/CPU.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// cycles a session runs before going to the back of the queue
+static constexpr s32 RunSlice = 1 << 20;
+
+// bytes read from a connection at a time
+static constexpr size_t ReceiveSize = 0x10000;
+
+// bytes of responses a connection may have waiting before it is closed
+static constexpr size_t MaxOutput = 64 * Protocol::MaxPayload;
+
+// set by SIGINT and SIGTERM
+static volatile sig_atomic_t Stopping = 0;
+
+static void OnSignal(int)
+{
+	Stopping = 1;
+}
+
+struct Connection
+{
+	// a response, or what is left of it
+	struct Chunk
+	{
+		std::vector<Byte> Bytes;
+		size_t Sent;
+		// descriptor to pass with the first byte, -1 for none. Owned by the chunk
+		int Fd;
+	};
+
+	Connection(int fd, int wakeFd) : Fd(fd), WakeFd(wakeFd) {}
+	~Connection()
+	{
+		for (Chunk& C : Output)
+		{
+			if (C.Fd >= 0)
+			{
+				close(C.Fd);
+			}
+		}
+		close(Fd);
+	}
+
+	const int Fd;
+
+	// written to when output starts waiting, so that the I/O thread polls for room, and when a
+	// closed connection lets go of its last request, so that it is reaped
+	const int WakeFd;
+
+	// guards the members below
+	std::mutex WriteLock;
+	// responses waiting for room in the socket, oldest first
+	std::deque<Chunk> Output;
+	size_t OutputSize = 0;
+	// set once the client has gone or stopped reading, nothing more is sent
+	bool Broken = false;
+
+	// bytes received that are not yet a whole request, I/O thread only
+	std::vector<Byte> Input;
+
+	// sessions created on this connection and not destroyed, the only ones it may use. Destroyed
+	// when it closes. I/O thread only
+	std::unordered_set<u32> Sessions;
+
+	// the client closed its end; the connection stays until its responses are out. Set by the I/O
+	// thread
+	std::atomic<bool> Closed{ false };
+};
+
+struct Request
+{
+	Protocol::MessageHeader Header;
+	std::vector<Byte> Payload;
+	// where the response goes, nullptr for none
+	std::shared_ptr<Connection> From;
+	// cycles of a Run done in earlier slices
+	u64 Done;
+};
+
+struct Session
+{
+	~Session()
+	{
+		delete Memory;
+		if (Cpu)
+		{
+			Destroy(Cpu);
+		}
+	}
+
+	u32 Id = 0;
+	CPUBase* Cpu = nullptr;
+	CPUBase::Memory* Memory = nullptr;
+	// execute and delete of the session's variant
+	s32 (*Execute)(CPUBase& cpu, CPUBase::Memory& memory, s32 cycles) = nullptr;
+	void (*Destroy)(CPUBase* cpu) = nullptr;
+
+	// guards the members below
+	std::mutex Lock;
+	// requests not yet done, in arrival order
+	std::deque<Request> Pending;
+	// whether the session is queued or on a worker
+	bool Scheduled = false;
+	// set by a Destroy request or when the connection closes, the requests after it are answered
+	// with UnknownSession
+	bool Destroyed = false;
+};
+
+template <class CPUType>
+static s32 Execute(CPUBase& cpu, CPUBase::Memory& memory, s32 cycles)
+{
+	return static_cast<CPUType&>(cpu).execute(cycles, memory);
+}
+
+template <class CPUType>
+static void Destroy(CPUBase* cpu)
+{
+	delete static_cast<CPUType*>(cpu);
+}
+
+// wake the I/O thread polling on the other end of fd
+static void Wake(int fd)
+{
+	const Byte Signal = 1;
+	// a full pipe already wakes the I/O thread
+	const ssize_t Written = write(fd, &Signal, 1);
+	(void)Written;
+}
+
+// throw away connection's output and send nothing more, with WriteLock held
+static void Drop(Connection& connection)
+{
+	for (Connection::Chunk& C : connection.Output)
+	{
+		if (C.Fd >= 0)
+		{
+			close(C.Fd);
+		}
+	}
+	connection.Output.clear();
+	connection.OutputSize = 0;
+	connection.Broken = true;
+}
+
+// send as much of connection's output as the socket takes, with WriteLock held
+static void Flush(Connection& connection)
+{
+	alignas(cmsghdr) char Control[CMSG_SPACE(sizeof(int))];
+	while (!connection.Output.empty())
+	{
+		Connection::Chunk& Next = connection.Output.front();
+		iovec Part = { Next.Bytes.data() + Next.Sent, Next.Bytes.size() - Next.Sent };
+		msghdr Message;
+		memset(&Message, 0, sizeof(Message));
+		Message.msg_iov = &Part;
+		Message.msg_iovlen = 1;
+		if (Next.Fd >= 0)
+		{
+			Message.msg_control = Control;
+			Message.msg_controllen = sizeof(Control);
+			cmsghdr* Header = CMSG_FIRSTHDR(&Message);
+			Header->cmsg_level = SOL_SOCKET;
+			Header->cmsg_type = SCM_RIGHTS;
+			Header->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(Header), &Next.Fd, sizeof(int));
+		}
+		const ssize_t Sent = sendmsg(connection.Fd, &Message, MSG_NOSIGNAL);
+		if (Sent < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				// the client has gone, its connection is closed by the I/O thread
+				Drop(connection);
+			}
+			return;
+		}
+		// the descriptor went with the first bytes
+		if (Next.Fd >= 0)
+		{
+			close(Next.Fd);
+			Next.Fd = -1;
+		}
+		Next.Sent += Sent;
+		connection.OutputSize -= Sent;
+		if (Next.Sent == Next.Bytes.size())
+		{
+			connection.Output.pop_front();
+		}
+	}
+}
+
+// send parts to the connection, with fd attached if it is not -1, queueing what the socket does
+// not take. fd is closed once it has been sent
+static void Send(Connection& connection, const iovec* parts, int count, int fd)
+{
+	std::lock_guard<std::mutex> Guard(connection.WriteLock);
+	if (connection.Broken)
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return;
+	}
+
+	Connection::Chunk Response;
+	for (int i = 0; i < count; i++)
+	{
+		const Byte* Part = (const Byte*)parts[i].iov_base;
+		Response.Bytes.insert(Response.Bytes.end(), Part, Part + parts[i].iov_len);
+	}
+	Response.Sent = 0;
+	Response.Fd = fd;
+	const bool Idle = connection.Output.empty();
+	connection.OutputSize += Response.Bytes.size();
+	connection.Output.push_back(std::move(Response));
+	if (Idle)
+	{
+		Flush(connection);
+	}
+
+	if (connection.OutputSize > MaxOutput)
+	{
+		// the client is not reading its responses, the I/O thread sees the connection close
+		Drop(connection);
+		shutdown(connection.Fd, SHUT_RDWR);
+	}
+	else if (Idle && !connection.Output.empty())
+	{
+		Wake(connection.WakeFd);
+	}
+}
+
+// answer request with status and payload, passing fd (closed once sent) if it is not -1
+static void Respond(const Request& request, Protocol::Status status, const void* payload = nullptr,
+	u32 size = 0, int fd = -1)
+{
+	if (!request.From)
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return;
+	}
+	Protocol::MessageHeader Header = request.Header;
+	Header.Length = size;
+	Header.Status = status;
+	Header.Reserved = 0;
+	const iovec Parts[2] = { { &Header, sizeof(Header) }, { const_cast<void*>(payload), size } };
+	Send(*request.From, Parts, size > 0 ? 2 : 1, fd);
+}
+
+// the fixed part of request's payload, false if the payload is too short for it
+template <class T>
+static bool Parse(const Request& request, T& value)
+{
+	if (request.Payload.size() < sizeof(T))
+	{
+		return false;
+	}
+	memcpy(&value, request.Payload.data(), sizeof(T));
+	return true;
+}
+
+static Protocol::Registers GetRegisters(const CPUBase& cpu)
+{
+	Protocol::Registers Registers;
+	Registers.A = cpu.registers.A;
+	Registers.X = cpu.registers.X;
+	Registers.Y = cpu.registers.Y;
+	Registers.SP = cpu.registers.SP;
+	Registers.PC = cpu.registers.PC;
+	Registers.P = cpu.PS;
+	Registers.Reserved = 0;
+	return Registers;
+}
+
+class Server
+{
+public:
+	explicit Server(u32 threads);
+	~Server();
+
+	// serve clients on the socket at path until SIGINT or SIGTERM, false if it could not be opened
+	bool serve(const std::string& path);
+
+private:
+	// worker thread: run queued sessions
+	void work();
+
+	// put session at the back of the ready queue
+	void schedule(const std::shared_ptr<Session>& session);
+
+	// do request on session, or the next slice of it for a Run. False if a Run is not done yet
+	bool step(Session& session, Request& request);
+
+	// I/O thread: handle a whole request from connection
+	void dispatch(const std::shared_ptr<Connection>& connection, Request& request);
+
+	// I/O thread: queue request on its session, or answer it if there is no such session or it
+	// belongs to another connection
+	void enqueue(Request& request);
+
+	// I/O thread: the requests that need no session
+	void create(const std::shared_ptr<Connection>& connection, Request& request);
+	void addROM(Request& request);
+	void removeROM(Request& request);
+
+	// I/O thread: the client closed connection, destroy its sessions
+	void disconnect(Connection& connection);
+
+	const u32 threads;
+
+	// RAM of every session, in shared memory files where the host has them so Map works
+	MemoryArena arena;
+
+	std::mutex sessionsLock;
+	std::unordered_map<u32, std::shared_ptr<Session>> sessions;
+	u32 nextSession;
+
+	// images added with AddROM, I/O thread only
+	std::unordered_map<u32, std::shared_ptr<const ROMImage>> roms;
+	u32 nextROM;
+
+	// sessions with requests waiting for a worker
+	std::mutex readyLock;
+	std::condition_variable readyChanged;
+	std::deque<std::shared_ptr<Session>> ready;
+	bool stopping;
+
+	std::vector<std::thread> workers;
+
+	// written by Send when a response has to wait for room, so that the I/O thread polls for it.
+	// Closed after the workers, which may still answer requests of closed connections
+	int wake[2];
+};
+
+Server::Server(u32 threads)
+	: threads(threads), arena(true), nextSession(1), nextROM(1), stopping(false), wake{ -1, -1 }
+{
+	// workers inherit the mask, so SIGINT and SIGTERM always interrupt the I/O thread's poll
+	sigset_t Signals;
+	sigset_t Previous;
+	sigemptyset(&Signals);
+	sigaddset(&Signals, SIGINT);
+	sigaddset(&Signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &Signals, &Previous);
+	for (u32 t = 0; t < threads; t++)
+	{
+		workers.emplace_back(&Server::work, this);
+	}
+	pthread_sigmask(SIG_SETMASK, &Previous, nullptr);
+}
+
+Server::~Server()
+{
+	{
+		std::lock_guard<std::mutex> Guard(readyLock);
+		stopping = true;
+	}
+	readyChanged.notify_all();
+	for (std::thread& Worker : workers)
+	{
+		Worker.join();
+	}
+	// sessions hold RAM from the arena, so they go first
+	ready.clear();
+	sessions.clear();
+	for (int Fd : wake)
+	{
+		if (Fd >= 0)
+		{
+			close(Fd);
+		}
+	}
+}
+
+void Server::schedule(const std::shared_ptr<Session>& session)
+{
+	{
+		std::lock_guard<std::mutex> Guard(readyLock);
+		ready.push_back(session);
+	}
+	readyChanged.notify_one();
+}
+
+void Server::work()
+{
+	for (;;)
+	{
+		std::shared_ptr<Session> Next;
+		{
+			std::unique_lock<std::mutex> Guard(readyLock);
+			readyChanged.wait(Guard, [this] { return stopping || !ready.empty(); });
+			if (stopping)
+			{
+				return;
+			}
+			Next = std::move(ready.front());
+			ready.pop_front();
+		}
+
+		// only the worker holding the session takes requests off the front, and pushing to the
+		// back of a deque leaves references to the front valid
+		Request* Front;
+		{
+			std::lock_guard<std::mutex> Guard(Next->Lock);
+			Front = &Next->Pending.front();
+		}
+		const bool Done = step(*Next, *Front);
+
+		bool Again;
+		std::shared_ptr<Connection> From;
+		{
+			std::lock_guard<std::mutex> Guard(Next->Lock);
+			if (Done)
+			{
+				From = std::move(Front->From);
+				Next->Pending.pop_front();
+			}
+			Again = !Next->Pending.empty();
+			Next->Scheduled = Again;
+		}
+		if (Again)
+		{
+			schedule(Next);
+		}
+		if (From && From->Closed)
+		{
+			// this may have been the last request holding the connection, let the I/O thread reap it
+			const int WakeFd = From->WakeFd;
+			From.reset();
+			Wake(WakeFd);
+		}
+	}
+}
+
+bool Server::step(Session& session, Request& request)
+{
+	bool Destroyed;
+	{
+		std::lock_guard<std::mutex> Guard(session.Lock);
+		Destroyed = session.Destroyed;
+	}
+	if (Destroyed)
+	{
+		Respond(request, Protocol::UnknownSession);
+		return true;
+	}
+
+	CPUBase& cpu = *session.Cpu;
+	CPUBase::Memory& memory = *session.Memory;
+	switch (request.Header.Command)
+	{
+	case Protocol::Destroy:
+	{
+		{
+			std::lock_guard<std::mutex> Guard(session.Lock);
+			session.Destroyed = true;
+		}
+		{
+			std::lock_guard<std::mutex> Guard(sessionsLock);
+			sessions.erase(session.Id);
+		}
+		Respond(request, Protocol::Ok);
+		return true;
+	}
+	case Protocol::Reset:
+	{
+		Protocol::ResetRequest Reset;
+		if (!Parse(request, Reset))
+		{
+			break;
+		}
+		cpu.reset(Reset.PC, memory);
+		Respond(request, Protocol::Ok);
+		return true;
+	}
+	case Protocol::Run:
+	{
+		Protocol::RunRequest Run;
+		if (!Parse(request, Run))
+		{
+			break;
+		}
+		if (request.Done < Run.Cycles)
+		{
+			const u64 Remaining = Run.Cycles - request.Done;
+			request.Done += session.Execute(cpu, memory, Remaining > (u64)RunSlice ? RunSlice : (s32)Remaining);
+			if (request.Done < Run.Cycles)
+			{
+				return false;
+			}
+		}
+		Protocol::RunResponse Response;
+		Response.Cycles = request.Done;
+		Response.TotalCycles = cpu.TotalCycles;
+		Response.TotalInstructions = cpu.TotalInstructions;
+		Response.State = GetRegisters(cpu);
+		Respond(request, Protocol::Ok, &Response, sizeof(Response));
+		return true;
+	}
+	case Protocol::Write:
+	{
+		Protocol::AddressRequest Write;
+		if (!Parse(request, Write))
+		{
+			break;
+		}
+		const u32 Size = (u32)(request.Payload.size() - sizeof(Write));
+		const Byte* Data = request.Payload.data() + sizeof(Write);
+		for (u32 i = 0; i < Size; i++)
+		{
+			memory.write((Word)(Write.Address + i), Data[i]);
+		}
+		Respond(request, Protocol::Ok);
+		return true;
+	}
+	case Protocol::Read:
+	{
+		Protocol::ReadRequest Read;
+		if (!Parse(request, Read) || Read.Length > CPUBase::Memory::MAX_MEM)
+		{
+			break;
+		}
+		std::vector<Byte> Data(Read.Length);
+		for (u32 i = 0; i < Read.Length; i++)
+		{
+			Data[i] = memory.read((Word)(Read.Address + i));
+		}
+		Respond(request, Protocol::Ok, Data.data(), Read.Length);
+		return true;
+	}
+	case Protocol::GetRegisters:
+	{
+		const Protocol::Registers Registers = GetRegisters(cpu);
+		Respond(request, Protocol::Ok, &Registers, sizeof(Registers));
+		return true;
+	}
+	case Protocol::SetRegisters:
+	{
+		Protocol::Registers Registers;
+		if (!Parse(request, Registers))
+		{
+			break;
+		}
+		cpu.registers.A = Registers.A;
+		cpu.registers.X = Registers.X;
+		cpu.registers.Y = Registers.Y;
+		cpu.registers.SP = Registers.SP;
+		cpu.registers.PC = Registers.PC;
+		cpu.PS = Registers.P;
+		Respond(request, Protocol::Ok);
+		return true;
+	}
+	case Protocol::Map:
+	{
+		Protocol::MapResponse Map;
+		int Fd;
+		if (!arena.locate(memory.ram, Fd, Map.Offset, Map.FileSize))
+		{
+			Respond(request, Protocol::Unsupported);
+			return true;
+		}
+		// the file holds this session's RAM only, and opening it again read-only keeps the client
+		// from changing memory behind the memory hash. The response owns the descriptor
+		char Path[32];
+		snprintf(Path, sizeof(Path), "/proc/self/fd/%d", Fd);
+		Fd = open(Path, O_RDONLY | O_CLOEXEC);
+		if (Fd < 0)
+		{
+			Respond(request, Protocol::Unsupported);
+			return true;
+		}
+		Map.RAMPages = memory.ramPages;
+		Map.FirstROMPage = memory.rom ? (Word)memory.rom->firstPage : 0;
+		Map.ROMPages = memory.rom ? (Word)memory.rom->pageCount : 0;
+		Respond(request, Protocol::Ok, &Map, sizeof(Map), Fd);
+		return true;
+	}
+	default:
+		Respond(request, Protocol::UnknownCommand);
+		return true;
+	}
+	Respond(request, Protocol::BadRequest);
+	return true;
+}
+
+void Server::enqueue(Request& request)
+{
+	// a client only reaches the sessions it created
+	if (request.From->Sessions.count(request.Header.Session) == 0)
+	{
+		Respond(request, Protocol::UnknownSession);
+		return;
+	}
+	if (request.Header.Command == Protocol::Destroy)
+	{
+		request.From->Sessions.erase(request.Header.Session);
+	}
+
+	std::shared_ptr<Session> Target;
+	{
+		std::lock_guard<std::mutex> Guard(sessionsLock);
+		auto Found = sessions.find(request.Header.Session);
+		if (Found != sessions.end())
+		{
+			Target = Found->second;
+		}
+	}
+	if (!Target)
+	{
+		Respond(request, Protocol::UnknownSession);
+		return;
+	}
+
+	bool Idle;
+	{
+		std::lock_guard<std::mutex> Guard(Target->Lock);
+		Target->Pending.push_back(std::move(request));
+		Idle = !Target->Scheduled;
+		Target->Scheduled = true;
+	}
+	if (Idle)
+	{
+		schedule(Target);
+	}
+}
+
+template <class CPUType>
+static void CreateSession(Session& session, MemoryArena& arena, const std::shared_ptr<const ROMImage>& rom)
+{
+	CPUType* cpu = new CPUType();
+	try
+	{
+		session.Memory = new CPUBase::Memory(arena, rom);
+	}
+	catch (const std::bad_alloc&)
+	{
+		delete cpu;
+		throw;
+	}
+	session.Cpu = cpu;
+	session.Execute = &Execute<CPUType>;
+	session.Destroy = &Destroy<CPUType>;
+	// many sessions share the server's console
+	cpu->verbose = false;
+	cpu->reset(0x0000, *session.Memory);
+}
+
+void Server::create(const std::shared_ptr<Connection>& connection, Request& request)
+{
+	Protocol::CreateRequest Create;
+	if (!Parse(request, Create) || Create.Variant > Protocol::Ricoh2A03)
+	{
+		Respond(request, Protocol::BadRequest);
+		return;
+	}
+	std::shared_ptr<const ROMImage> Image;
+	if (Create.ROM != 0)
+	{
+		auto Found = roms.find(Create.ROM);
+		if (Found == roms.end())
+		{
+			Respond(request, Protocol::UnknownROM);
+			return;
+		}
+		Image = Found->second;
+	}
+
+	std::shared_ptr<Session> New;
+	try
+	{
+		std::unique_ptr<Session> Building(new Session());
+		switch (Create.Variant)
+		{
+		case Protocol::NMOS6502:
+			CreateSession<CPU>(*Building, arena, Image);
+			break;
+		case Protocol::CMOS65C02:
+			CreateSession<CPU65C02>(*Building, arena, Image);
+			break;
+		case Protocol::Ricoh2A03:
+			CreateSession<CPU2A03>(*Building, arena, Image);
+			break;
+		}
+		New = std::shared_ptr<Session>(Building.release());
+	}
+	catch (const std::bad_alloc&)
+	{
+		Respond(request, Protocol::OutOfMemory);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> Guard(sessionsLock);
+		New->Id = nextSession++;
+		sessions[New->Id] = New;
+	}
+	connection->Sessions.insert(New->Id);
+	request.Header.Session = New->Id;
+	Respond(request, Protocol::Ok);
+}
+
+void Server::addROM(Request& request)
+{
+	Protocol::AddROMRequest Add;
+	if (!Parse(request, Add))
+	{
+		Respond(request, Protocol::BadRequest);
+		return;
+	}
+	try
+	{
+		std::shared_ptr<const ROMImage> Image = std::make_shared<const ROMImage>(Add.Address,
+			request.Payload.data() + sizeof(Add), (u32)(request.Payload.size() - sizeof(Add)));
+		// a machine needs some RAM, for its stack at least
+		if (Image->pageCount == CPUBase::Memory::PAGES)
+		{
+			Respond(request, Protocol::BadRequest);
+			return;
+		}
+		const u32 Id = nextROM++;
+		roms[Id] = std::move(Image);
+		const Protocol::AddROMResponse Response = { Id };
+		Respond(request, Protocol::Ok, &Response, sizeof(Response));
+	}
+	catch (const std::bad_alloc&)
+	{
+		Respond(request, Protocol::OutOfMemory);
+	}
+}
+
+void Server::removeROM(Request& request)
+{
+	Protocol::RemoveROMRequest Remove;
+	if (!Parse(request, Remove))
+	{
+		Respond(request, Protocol::BadRequest);
+		return;
+	}
+	Respond(request, roms.erase(Remove.ROM) > 0 ? Protocol::Ok : Protocol::UnknownROM);
+}
+
+void Server::dispatch(const std::shared_ptr<Connection>& connection, Request& request)
+{
+	request.From = connection;
+	request.Done = 0;
+	switch (request.Header.Command)
+	{
+	case Protocol::Hello:
+	{
+		const Protocol::HelloResponse Response = { Protocol::Version, threads };
+		Respond(request, Protocol::Ok, &Response, sizeof(Response));
+		break;
+	}
+	case Protocol::Create:
+		create(connection, request);
+		break;
+	case Protocol::AddROM:
+		addROM(request);
+		break;
+	case Protocol::RemoveROM:
+		removeROM(request);
+		break;
+	default:
+		// the rest, unknown commands included, are answered in order with the session's others
+		enqueue(request);
+		break;
+	}
+}
+
+void Server::disconnect(Connection& connection)
+{
+	// destroyed at once, so that a worker running one of them stops at the end of its slice and
+	// answers the requests still queued with UnknownSession
+	for (u32 Id : connection.Sessions)
+	{
+		std::shared_ptr<Session> Target;
+		{
+			std::lock_guard<std::mutex> Guard(sessionsLock);
+			auto Found = sessions.find(Id);
+			if (Found == sessions.end())
+			{
+				continue;
+			}
+			Target = std::move(Found->second);
+			sessions.erase(Found);
+		}
+		std::lock_guard<std::mutex> Guard(Target->Lock);
+		Target->Destroyed = true;
+	}
+	connection.Sessions.clear();
+}
+
+bool Server::serve(const std::string& path)
+{
+	sockaddr_un Address;
+	memset(&Address, 0, sizeof(Address));
+	Address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(Address.sun_path))
+	{
+		fprintf(stderr, "Error: Socket path too long: %s\n", path.c_str());
+		return false;
+	}
+	memcpy(Address.sun_path, path.c_str(), path.size());
+
+	const int Listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (Listener < 0)
+	{
+		fprintf(stderr, "Error: Could not create socket\n");
+		return false;
+	}
+	unlink(path.c_str());
+	// the server runs whatever its clients send it, so only the owner may connect
+	const mode_t Mask = umask(0077);
+	const bool Bound = bind(Listener, (sockaddr*)&Address, sizeof(Address)) == 0;
+	umask(Mask);
+	if (!Bound || listen(Listener, SOMAXCONN) != 0)
+	{
+		fprintf(stderr, "Error: Could not listen on socket: %s\n", path.c_str());
+		close(Listener);
+		return false;
+	}
+	if (pipe2(wake, O_NONBLOCK | O_CLOEXEC) != 0)
+	{
+		fprintf(stderr, "Error: Could not create pipe\n");
+		close(Listener);
+		return false;
+	}
+	printf("Listening on %s with %u worker threads\n", path.c_str(), threads);
+	fflush(stdout);
+
+	std::vector<std::shared_ptr<Connection>> Connections;
+	std::vector<pollfd> Polled;
+	std::vector<Byte> Received(ReceiveSize);
+	while (!Stopping)
+	{
+		// the listener and the wake pipe first, then the connections in order. A closed connection
+		// is only polled for room for its output
+		Polled.clear();
+		Polled.push_back({ Listener, POLLIN, 0 });
+		Polled.push_back({ wake[0], POLLIN, 0 });
+		for (const std::shared_ptr<Connection>& C : Connections)
+		{
+			short Events = C->Closed ? 0 : POLLIN;
+			{
+				std::lock_guard<std::mutex> Guard(C->WriteLock);
+				Events |= C->Output.empty() ? 0 : POLLOUT;
+			}
+			Polled.push_back({ Events != 0 ? C->Fd : -1, Events, 0 });
+		}
+		if (poll(Polled.data(), Polled.size(), -1) < 0)
+		{
+			// EINTR from a signal, checked above
+			continue;
+		}
+
+		if (Polled[1].revents & POLLIN)
+		{
+			while (read(wake[0], Received.data(), Received.size()) > 0)
+			{
+			}
+		}
+
+		for (size_t i = Connections.size(); i-- > 0;)
+		{
+			Connection& C = *Connections[i];
+			const short Events = Polled[i + 2].revents;
+			if (Events & (POLLOUT | POLLERR | POLLHUP))
+			{
+				std::lock_guard<std::mutex> Guard(C.WriteLock);
+				Flush(C);
+			}
+			if (C.Closed)
+			{
+				// gone once its responses are out and no request holds it
+				std::lock_guard<std::mutex> Guard(C.WriteLock);
+				if (C.Output.empty() && Connections[i].use_count() == 1)
+				{
+					Connections.erase(Connections.begin() + i);
+				}
+				continue;
+			}
+			if ((Events & (POLLIN | POLLERR | POLLHUP)) == 0)
+			{
+				continue;
+			}
+			const ssize_t Size = recv(C.Fd, Received.data(), Received.size(), 0);
+			bool Closed = Size == 0 || (Size < 0 && errno != EINTR && errno != EAGAIN);
+			if (Size > 0)
+			{
+				C.Input.insert(C.Input.end(), Received.begin(), Received.begin() + Size);
+				size_t Used = 0;
+				while (C.Input.size() - Used >= sizeof(Protocol::MessageHeader))
+				{
+					Request R;
+					memcpy(&R.Header, C.Input.data() + Used, sizeof(R.Header));
+					if (R.Header.Length > Protocol::MaxPayload)
+					{
+						Closed = true;
+						break;
+					}
+					if (C.Input.size() - Used - sizeof(R.Header) < R.Header.Length)
+					{
+						break;
+					}
+					const Byte* Payload = C.Input.data() + Used + sizeof(R.Header);
+					R.Payload.assign(Payload, Payload + R.Header.Length);
+					Used += sizeof(R.Header) + R.Header.Length;
+					dispatch(Connections[i], R);
+				}
+				C.Input.erase(C.Input.begin(), C.Input.begin() + Used);
+			}
+			if (Closed)
+			{
+				disconnect(C);
+				// workers still answering its requests keep the connection open until they finish
+				shutdown(C.Fd, SHUT_RD);
+				C.Closed = true;
+			}
+		}
+
+		if (Polled[0].revents & POLLIN)
+		{
+			const int Fd = accept4(Listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (Fd >= 0)
+			{
+				Connections.push_back(std::make_shared<Connection>(Fd, wake[1]));
+			}
+		}
+	}
+
+	for (const std::shared_ptr<Connection>& C : Connections)
+	{
+		if (!C->Closed)
+		{
+			disconnect(*C);
+		}
+	}
+	close(Listener);
+	unlink(path.c_str());
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	std::string socketPath;
+	u32 threads = std::thread::hardware_concurrency();
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+		{
+			socketPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			threads = (u32)strtoul(argv[++i], NULL, 0);
+		}
+		else
+		{
+			fprintf(stderr, "Error: Unknown argument: %s\n", argv[i]);
+			return 1;
+		}
+	}
+	if (socketPath.empty())
+	{
+		fprintf(stderr, "Error: No socket given, use --socket <path>\n");
+		return 1;
+	}
+	if (threads == 0)
+	{
+		threads = 1;
+	}
+
+	struct sigaction Action;
+	memset(&Action, 0, sizeof(Action));
+	Action.sa_handler = OnSignal;
+	sigaction(SIGINT, &Action, nullptr);
+	sigaction(SIGTERM, &Action, nullptr);
+	signal(SIGPIPE, SIG_IGN);
+
+	Server* server = new Server(threads);
+	const bool Served = server->serve(socketPath);
+	delete server;
+	return Served ? 0 : 1;
+}
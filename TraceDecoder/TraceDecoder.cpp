@@ -0,0 +1,171 @@
+// TraceDecoder.cpp : Print a binary instruction trace written by Emu6502Console --trace.
+//
+// usage: TraceDecoder <trace file> [--skip <records>] [--count <records>]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../Emu6502Console/Disassembler.h"
+#include "../Emu6502Console/Trace.h"
+
+// records read from the file per fread
+static constexpr u32 ReadBatch = 1 << 16;
+
+static const char HexDigits[] = "0123456789ABCDEF";
+
+static char* PutHex8(char* out, Byte value)
+{
+	out[0] = HexDigits[value >> 4];
+	out[1] = HexDigits[value & 0x0F];
+	return out + 2;
+}
+
+static char* PutHex16(char* out, Word value)
+{
+	out = PutHex8(out, value >> 8);
+	return PutHex8(out, value & 0xFF);
+}
+
+// right-aligned decimal in a field of the given width
+static char* PutDecimal(char* out, u32 value, int width)
+{
+	char digits[10];
+	int count = 0;
+	do
+	{
+		digits[count++] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+	for (int i = count; i < width; i++)
+	{
+		*out++ = ' ';
+	}
+	while (count)
+	{
+		*out++ = digits[--count];
+	}
+	return out;
+}
+
+static char* PutString(char* out, const char* text)
+{
+	while (*text)
+	{
+		*out++ = *text++;
+	}
+	return out;
+}
+
+// format one record into out, returning the end of the line
+static char* FormatRecord(char* out, const TraceRecord& record)
+{
+	out = PutDecimal(out, record.Cycles, 10);
+	out = PutString(out, "  ");
+	out = PutHex16(out, record.PC);
+	out = PutString(out, "  ");
+	out = PutHex8(out, record.Opcode);
+	*out++ = ' ';
+	out = PutHex8(out, record.Operands[0]);
+	*out++ = ' ';
+	out = PutHex8(out, record.Operands[1]);
+	out = PutString(out, "  ");
+
+	// pad the disassembly to a fixed column
+	char* Text = out;
+	out += Disassemble(record.PC, record.Opcode, record.Operands[0], record.Operands[1], out);
+	while (out < Text + DisassemblyMaxLength)
+	{
+		*out++ = ' ';
+	}
+
+	out = PutString(out, "A:");
+	out = PutHex8(out, record.A);
+	out = PutString(out, " X:");
+	out = PutHex8(out, record.X);
+	out = PutString(out, " Y:");
+	out = PutHex8(out, record.Y);
+	out = PutString(out, " SP:");
+	out = PutHex8(out, record.SP);
+	out = PutString(out, " P:");
+	static const char FlagNames[] = "NV-BDIZC";
+	for (int bit = 7; bit >= 0; bit--)
+	{
+		*out++ = (record.PS >> bit) & 1 ? FlagNames[7 - bit] : '.';
+	}
+	*out++ = '\n';
+	return out;
+}
+
+int main(int argc, char* argv[])
+{
+	const char* path = nullptr;
+	u64 skip = 0;
+	u64 count = ~0ull;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--skip") == 0 && i + 1 < argc)
+		{
+			skip = strtoull(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+		{
+			count = strtoull(argv[++i], NULL, 0);
+		}
+		else
+		{
+			path = argv[i];
+		}
+	}
+
+	if (path == nullptr)
+	{
+		fprintf(stderr, "usage: TraceDecoder <trace file> [--skip <records>] [--count <records>]\n");
+		return 1;
+	}
+
+	FILE* file = fopen(path, "rb");
+	if (file == NULL)
+	{
+		fprintf(stderr, "Error: Could not open file: %s\n", path);
+		return 1;
+	}
+
+	TraceHeader header;
+	if (fread(&header, sizeof(header), 1, file) != 1
+		|| memcmp(header.Magic, Tracer::Magic, sizeof(header.Magic)) != 0
+		|| header.Version != Tracer::Version
+		|| header.RecordSize != sizeof(TraceRecord))
+	{
+		fprintf(stderr, "Error: Not a trace file: %s\n", path);
+		fclose(file);
+		return 1;
+	}
+
+	TraceRecord* records = new TraceRecord[ReadBatch];
+	// one formatted line is well under 128 characters
+	char* text = new char[(size_t)ReadBatch * 128];
+
+	u64 index = 0;
+	size_t numRead;
+	while (count > 0 && (numRead = fread(records, sizeof(TraceRecord), ReadBatch, file)) > 0)
+	{
+		char* out = text;
+		for (size_t i = 0; i < numRead && count > 0; i++, index++)
+		{
+			if (index < skip)
+			{
+				continue;
+			}
+			out = FormatRecord(out, records[i]);
+			count--;
+		}
+		fwrite(text, 1, out - text, stdout);
+	}
+
+	delete[] text;
+	delete[] records;
+	fclose(file);
+	return 0;
+}
@@ -0,0 +1,276 @@
+// emu6502.cpp : C API of libemu6502 on top of BasicCPU.
+//
+// The handle picks the execute of its variant once, at creation, so run and step cost one
+// indirect call per batch rather than per instruction. RAM comes from the shared MemoryArena,
+// so handles created after others were destroyed reuse their pages.
+
+#include "emu6502.h"
+#include "../Emu6502Console/CPU.h"
+#include "../Emu6502Console/StateHash.h"
+#include <new>
+
+// largest slice handed to execute, which counts cycles in an s32
+static constexpr u64 MaxSlice = 0x40000000;
+
+struct emu6502
+{
+	CPUBase* cpu;
+	CPUBase::Memory* memory;
+	// execute and delete of the variant the handle was created with
+	s32 (*execute)(CPUBase& cpu, CPUBase::Memory& memory, s32 cycles);
+	void (*destroy)(CPUBase* cpu);
+};
+
+struct emu6502_rom
+{
+	std::shared_ptr<const ROMImage> image;
+};
+
+template <class CPUType>
+static s32 Execute(CPUBase& cpu, CPUBase::Memory& memory, s32 cycles)
+{
+	return static_cast<CPUType&>(cpu).execute(cycles, memory);
+}
+
+template <class CPUType>
+static void Destroy(CPUBase* cpu)
+{
+	delete static_cast<CPUType*>(cpu);
+}
+
+template <class CPUType>
+static emu6502* Create(const emu6502_rom* rom)
+{
+	CPUType* cpu = nullptr;
+	CPUBase::Memory* memory = nullptr;
+	emu6502* emu = nullptr;
+	try
+	{
+		cpu = new CPUType();
+		memory = new CPUBase::Memory(MemoryArena::shared(), rom ? rom->image : nullptr);
+		emu = new emu6502{ cpu, memory, &Execute<CPUType>, &Destroy<CPUType> };
+	}
+	catch (const std::bad_alloc&)
+	{
+		delete memory;
+		delete cpu;
+		return nullptr;
+	}
+	// a library must not write to the host's console
+	cpu->verbose = false;
+	cpu->reset(0x0000, *memory);
+	return emu;
+}
+
+static emu6502* Create(emu6502_variant variant, const emu6502_rom* rom)
+{
+	switch (variant)
+	{
+	case EMU6502_NMOS6502:
+		return Create<CPU>(rom);
+	case EMU6502_65C02:
+		return Create<CPU65C02>(rom);
+	case EMU6502_2A03:
+		return Create<CPU2A03>(rom);
+	}
+	return nullptr;
+}
+
+uint32_t emu6502_api_version(void)
+{
+	return EMU6502_API_VERSION;
+}
+
+emu6502* emu6502_create(emu6502_variant variant)
+{
+	return Create(variant, nullptr);
+}
+
+emu6502* emu6502_create_with_rom(emu6502_variant variant, const emu6502_rom* rom)
+{
+	return Create(variant, rom);
+}
+
+void emu6502_destroy(emu6502* emu)
+{
+	if (emu == nullptr)
+	{
+		return;
+	}
+	delete emu->memory;
+	emu->destroy(emu->cpu);
+	delete emu;
+}
+
+emu6502_rom* emu6502_rom_create(uint16_t address, const uint8_t* data, uint32_t size)
+{
+	try
+	{
+		return new emu6502_rom{ std::make_shared<const ROMImage>(address, data, size) };
+	}
+	catch (const std::bad_alloc&)
+	{
+		return nullptr;
+	}
+}
+
+emu6502_rom* emu6502_rom_load(const char* path, uint16_t address)
+{
+	try
+	{
+		std::shared_ptr<const ROMImage> Image = ROMImage::load(path, address);
+		return Image ? new emu6502_rom{ Image } : nullptr;
+	}
+	catch (const std::bad_alloc&)
+	{
+		return nullptr;
+	}
+}
+
+void emu6502_rom_release(emu6502_rom* rom)
+{
+	delete rom;
+}
+
+int emu6502_load_rom(emu6502* emu, const char* path)
+{
+	return emu->cpu->loadROM(path, *emu->memory) ? 0 : -1;
+}
+
+void emu6502_load(emu6502* emu, uint16_t address, const uint8_t* data, uint32_t size)
+{
+	CPUBase::Memory& memory = *emu->memory;
+	for (u32 i = 0; i < size; i++)
+	{
+		memory.write((Word)(address + i), data[i]);
+	}
+}
+
+void emu6502_reset(emu6502* emu, uint16_t pc)
+{
+	emu->cpu->reset(pc, *emu->memory);
+}
+
+uint64_t emu6502_run(emu6502* emu, uint64_t cycles)
+{
+	u64 Used = 0;
+	while (Used < cycles)
+	{
+		const u64 Remaining = cycles - Used;
+		Used += emu->execute(*emu->cpu, *emu->memory, (s32)(Remaining > MaxSlice ? MaxSlice : Remaining));
+	}
+	return Used;
+}
+
+uint64_t emu6502_step(emu6502* emu, uint32_t count)
+{
+	// a budget of one cycle executes exactly one instruction
+	u64 Used = 0;
+	for (u32 i = 0; i < count; i++)
+	{
+		Used += emu->execute(*emu->cpu, *emu->memory, 1);
+	}
+	return Used;
+}
+
+uint32_t emu6502_get_register(const emu6502* emu, emu6502_register reg)
+{
+	const CPUBase& cpu = *emu->cpu;
+	switch (reg)
+	{
+	case EMU6502_REG_A:
+		return cpu.registers.A;
+	case EMU6502_REG_X:
+		return cpu.registers.X;
+	case EMU6502_REG_Y:
+		return cpu.registers.Y;
+	case EMU6502_REG_SP:
+		return cpu.registers.SP;
+	case EMU6502_REG_PC:
+		return cpu.registers.PC;
+	case EMU6502_REG_P:
+		return cpu.PS;
+	}
+	return 0;
+}
+
+void emu6502_set_register(emu6502* emu, emu6502_register reg, uint32_t value)
+{
+	CPUBase& cpu = *emu->cpu;
+	switch (reg)
+	{
+	case EMU6502_REG_A:
+		cpu.registers.A = (Byte)value;
+		break;
+	case EMU6502_REG_X:
+		cpu.registers.X = (Byte)value;
+		break;
+	case EMU6502_REG_Y:
+		cpu.registers.Y = (Byte)value;
+		break;
+	case EMU6502_REG_SP:
+		cpu.registers.SP = (Byte)value;
+		break;
+	case EMU6502_REG_PC:
+		cpu.registers.PC = (Word)value;
+		break;
+	case EMU6502_REG_P:
+		cpu.PS = (Byte)value;
+		break;
+	}
+}
+
+void emu6502_get_registers(const emu6502* emu, emu6502_registers* registers)
+{
+	const CPUBase& cpu = *emu->cpu;
+	registers->a = cpu.registers.A;
+	registers->x = cpu.registers.X;
+	registers->y = cpu.registers.Y;
+	registers->sp = cpu.registers.SP;
+	registers->pc = cpu.registers.PC;
+	registers->p = cpu.PS;
+	registers->reserved = 0;
+}
+
+void emu6502_set_registers(emu6502* emu, const emu6502_registers* registers)
+{
+	CPUBase& cpu = *emu->cpu;
+	cpu.registers.A = registers->a;
+	cpu.registers.X = registers->x;
+	cpu.registers.Y = registers->y;
+	cpu.registers.SP = registers->sp;
+	cpu.registers.PC = registers->pc;
+	cpu.PS = registers->p;
+}
+
+uint64_t emu6502_cycles(const emu6502* emu)
+{
+	return emu->cpu->TotalCycles;
+}
+
+uint64_t emu6502_instructions(const emu6502* emu)
+{
+	return emu->cpu->TotalInstructions;
+}
+
+uint8_t* emu6502_memory(emu6502* emu)
+{
+	return emu->memory->rom ? nullptr : emu->memory->ram;
+}
+
+uint8_t* emu6502_page(emu6502* emu, uint8_t page)
+{
+	// ROM pages point into the shared image, the header says they are read only
+	return const_cast<uint8_t*>(emu->memory->pages[page]);
+}
+
+void emu6502_memory_written(emu6502* emu)
+{
+	CPUBase::Memory& memory = *emu->memory;
+	memory.hash = HashMemory(memory);
+}
+
+uint64_t emu6502_state_hash(const emu6502* emu)
+{
+	return HashState(*emu->cpu, *emu->memory);
+}
@@ -0,0 +1,125 @@
+/**
+* Purpose: Stable C API of libemu6502, for embedding the emulator in other programs and languages
+*          (ctypes, cgo, ...). Every call works on an opaque emu6502 handle. A handle must only be used
+*          by one thread at a time; separate handles are independent.
+**/
+#pragma once
+#include <stdint.h>
+
+#if defined(_WIN32)
+#if defined(EMU6502_EXPORTS)
+#define EMU6502_API __declspec(dllexport)
+#else
+#define EMU6502_API __declspec(dllimport)
+#endif
+#else
+#define EMU6502_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// bumped whenever a function is added; existing functions never change
+#define EMU6502_API_VERSION 2
+
+typedef struct emu6502 emu6502;
+
+// read-only memory image that any number of handles map without a copy of their own
+typedef struct emu6502_rom emu6502_rom;
+
+// CPU variants, fixed when the handle is created
+typedef enum emu6502_variant
+{
+	EMU6502_NMOS6502 = 0,
+	EMU6502_65C02 = 1,
+	EMU6502_2A03 = 2,
+} emu6502_variant;
+
+// register selectors for emu6502_get_register / emu6502_set_register
+typedef enum emu6502_register
+{
+	EMU6502_REG_A = 0,
+	EMU6502_REG_X = 1,
+	EMU6502_REG_Y = 2,
+	EMU6502_REG_SP = 3,
+	EMU6502_REG_PC = 4,
+	EMU6502_REG_P = 5,
+} emu6502_register;
+
+// all registers at once
+typedef struct emu6502_registers
+{
+	uint8_t a;
+	uint8_t x;
+	uint8_t y;
+	uint8_t sp;
+	uint16_t pc;
+	uint8_t p;
+	uint8_t reserved;
+} emu6502_registers;
+
+// EMU6502_API_VERSION of the loaded library
+EMU6502_API uint32_t emu6502_api_version(void);
+
+// create an emulator with zeroed memory, or NULL if variant is unknown or allocation failed
+EMU6502_API emu6502* emu6502_create(emu6502_variant variant);
+
+// create an emulator whose pages covered by rom read from the shared image, where writes are
+// ignored, and whose other pages are zeroed RAM. NULL if variant is unknown or allocation failed
+EMU6502_API emu6502* emu6502_create_with_rom(emu6502_variant variant, const emu6502_rom* rom);
+
+EMU6502_API void emu6502_destroy(emu6502* emu);
+
+// image of size bytes of data at address, covering whole pages (the rest of them reads as
+// zero), or NULL if allocation failed
+EMU6502_API emu6502_rom* emu6502_rom_create(uint16_t address, const uint8_t* data, uint32_t size);
+
+// image of the file at path placed at address, or NULL if the file could not be read
+EMU6502_API emu6502_rom* emu6502_rom_load(const char* path, uint16_t address);
+
+// drop the caller's reference; handles created with the image keep it alive until destroyed
+EMU6502_API void emu6502_rom_release(emu6502_rom* rom);
+
+// load a ROM file at $0000, returning 0 on success and -1 if the file could not be read
+EMU6502_API int emu6502_load_rom(emu6502* emu, const char* path);
+
+// copy size bytes of data to address, wrapping at $FFFF
+EMU6502_API void emu6502_load(emu6502* emu, uint16_t address, const uint8_t* data, uint32_t size);
+
+// reset registers, flags and counters, clear memory and start at pc
+EMU6502_API void emu6502_reset(emu6502* emu, uint16_t pc);
+
+// run for at least cycles cycles (the last instruction may overrun), returning the cycles used
+EMU6502_API uint64_t emu6502_run(emu6502* emu, uint64_t cycles);
+
+// execute count instructions, returning the cycles used
+EMU6502_API uint64_t emu6502_step(emu6502* emu, uint32_t count);
+
+EMU6502_API uint32_t emu6502_get_register(const emu6502* emu, emu6502_register reg);
+EMU6502_API void emu6502_set_register(emu6502* emu, emu6502_register reg, uint32_t value);
+EMU6502_API void emu6502_get_registers(const emu6502* emu, emu6502_registers* registers);
+EMU6502_API void emu6502_set_registers(emu6502* emu, const emu6502_registers* registers);
+
+// cycles and instructions executed since the last reset
+EMU6502_API uint64_t emu6502_cycles(const emu6502* emu);
+EMU6502_API uint64_t emu6502_instructions(const emu6502* emu);
+
+// the 64KB address space, valid until emu6502_destroy. Reads and writes go straight to the
+// emulated memory with no copy; after writing through it call emu6502_memory_written.
+// NULL for a handle created with a ROM, whose pages are not contiguous; use emu6502_page
+EMU6502_API uint8_t* emu6502_memory(emu6502* emu);
+
+// the 256 bytes of page (address >> 8), same rules as emu6502_memory. A page of a shared ROM
+// points into the image and must not be written
+EMU6502_API uint8_t* emu6502_page(emu6502* emu, uint8_t page);
+
+// resynchronise the state hash after writes through emu6502_memory or emu6502_page
+EMU6502_API void emu6502_memory_written(emu6502* emu);
+
+// hash of registers, flags and memory, equal for equal machine states
+EMU6502_API uint64_t emu6502_state_hash(const emu6502* emu);
+
+#ifdef __cplusplus
+}
+#endif